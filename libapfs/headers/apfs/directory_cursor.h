@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2017-present Orlando Bassotto
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __apfs_directory_cursor_h
+#define __apfs_directory_cursor_h
+
+#include "apfs/internal/directory.h"
+
+namespace nx { class enumerator; }
+
+namespace apfs {
+
+class object;
+
+//
+// Streams the entries of a directory in on-disk order, that is by name
+// hash, holding no more than a path of B-tree nodes in memory.
+//
+// A cursor must not outlive the object it was opened from.
+//
+class directory_cursor {
+public:
+    using entry = internal::directory::entry;
+
+private:
+    object const   *_object;
+    nx::enumerator *_enumerator;
+
+protected:
+    friend class object;
+    directory_cursor(object const *object);
+
+public:
+    ~directory_cursor();
+
+public:
+    bool rewind();
+    bool next(entry &entry);
+};
+
+}
+
+#endif  // !__apfs_directory_cursor_h
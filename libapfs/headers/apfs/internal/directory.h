@@ -47,6 +47,9 @@ protected:
 protected:
     void add_entry(void const *k, void const *v, bool insensitive);
 
+public:
+    static entry make_entry(void const *k, void const *v);
+
 protected:
     inline entry::name_map const &get_entries() const
     { return _entries; }
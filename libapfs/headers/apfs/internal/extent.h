@@ -25,6 +25,10 @@
 
 #include "apfs/internal/base.h"
 
+#include <atomic>
+#include <functional>
+#include <mutex>
+
 namespace apfs { namespace internal {
 
 struct extent {
@@ -37,6 +41,111 @@ struct extent {
     extent(uint64_t offset = 0, uint64_t lba = 0, uint64_t count = 0)
         : offset(offset), lba(lba), count(count)
     { }
+
+    inline uint64_t end() const
+    { return offset + count; }
+    inline bool contains(uint64_t bno) const
+    { return (bno >= offset && bno < offset + count); }
+};
+
+//
+// The extents of a file, sorted by logical offset, with adjacent
+// extents that are contiguous on disk merged together.
+//
+// Lookups remember the last extent hit, so that sequential reads
+// resolve in constant time; random accesses fall back to a binary
+// search.
+//
+class extent_map {
+public:
+    using const_iterator = extent::vector::const_iterator;
+
+private:
+    extent::vector              _extents;
+    mutable std::atomic<size_t> _cursor;
+
+public:
+    extent_map();
+    extent_map(extent_map const &other);
+    extent_map &operator=(extent_map const &other);
+
+public:
+    void insert(extent const &e);
+    void clear();
+
+public:
+    bool lookup(uint64_t bno, extent &e) const;
+
+public:
+    inline size_t size() const
+    { return _extents.size(); }
+    inline bool empty() const
+    { return _extents.empty(); }
+    inline const_iterator begin() const
+    { return _extents.begin(); }
+    inline const_iterator end() const
+    { return _extents.end(); }
+
+private:
+    void merge(size_t index);
+};
+
+//
+// A bounded window over the extents of a file.
+//
+// Extents are loaded on demand, a page at a time, by a loader that
+// fills a page starting from the extent holding the requested block;
+// the least recently used page is dropped once the window is full.
+// Each page covers a range of blocks without gaps, so a block that
+// falls within a page but in none of its extents is a hole.
+//
+class paged_extent_map {
+public:
+    typedef std::function<bool(uint64_t bno, uint64_t limit, size_t count,
+            extent_map &extents, uint64_t &first, uint64_t &last)>
+        loader_type;
+
+    enum : size_t {
+        DEFAULT_PAGE_SIZE = 512,
+        DEFAULT_MAX_PAGES = 16
+    };
+
+private:
+    struct page {
+        uint64_t   first;
+        uint64_t   last;
+        uint64_t   used;
+        extent_map extents;
+
+        inline bool contains(uint64_t bno) const
+        { return (bno >= first && bno < last); }
+    };
+
+private:
+    mutable std::mutex _lock;
+    std::vector<page>  _pages;
+    size_t             _page_size;
+    size_t             _max_pages;
+    size_t             _last;
+    uint64_t           _clock;
+
+public:
+    paged_extent_map(size_t page_size = DEFAULT_PAGE_SIZE,
+            size_t max_pages = DEFAULT_MAX_PAGES);
+    paged_extent_map(paged_extent_map const &other);
+    paged_extent_map &operator=(paged_extent_map const &other);
+
+public:
+    bool lookup(uint64_t bno, extent &e, loader_type const &loader);
+    void clear();
+
+public:
+    size_t get_page_count() const;
+    size_t get_extent_count() const;
+
+private:
+    size_t find(uint64_t bno) const;
+    bool load(uint64_t bno, loader_type const &loader, size_t &index);
 };
 
 } }
@@ -25,15 +25,18 @@
 
 #include "apfs/internal/extent.h"
 
+namespace nx { class volume; class readahead; }
+
 namespace apfs { namespace internal {
 
 class object {
 protected:
-    uint64_t       _oid;
-    std::string    _name;
-    extent::vector _extents;
-    apfs_dstream_t _dstream;
-    uint32_t       _device;
+    uint64_t                 _oid;
+    std::string              _name;
+    nx::volume const        *_nx_volume;
+    mutable paged_extent_map _extents;
+    apfs_dstream_t           _dstream;
+    uint32_t                 _device;
 
 protected:
     object();
@@ -45,8 +48,7 @@ protected:
     void set_dstream(apfs_dstream_t const &dstream);
     void set_device_spec(uint32_t device);
     void set_name(std::string &&name);
-
-    void add_extent(void const *k, void const *v);
+    void set_nx_volume(nx::volume const *volume);
 
 public:
     inline uint64_t get_oid() const
@@ -63,11 +65,17 @@ public:
 private:
     bool offset_to_extent(nx_off_t offset, uint64_t &lba, size_t &count,
             size_t &loffset) const;
+    bool load_extents(uint64_t bno, uint64_t limit, size_t count,
+            extent_map &extents, uint64_t &first, uint64_t &last) const;
 
 public:
     virtual ssize_t read(nx::device *device, void *buffer, size_t size,
             nx_off_t offset) const;
 
+    nx::readahead *open_stream(nx::device *device) const;
+    ssize_t read(nx::readahead *stream, void *buffer, size_t size,
+            nx_off_t offset) const;
+
 protected:
     static apfs_dstream_t swap_dstream(apfs_dstream_t const &in);
 };
@@ -25,26 +25,82 @@
 
 #include "apfs/internal/base.h"
 
+#include <atomic>
+#include <list>
 #include <mutex>
+#include <unordered_map>
+#include <vector>
 
 namespace apfs { class object; class volume; }
 
 namespace apfs { namespace internal {
 
+//
+// Objects opened on a volume, shared by all their users.
+//
+// Objects are spread over shards by file id, each with its own lock, hash
+// map and LRU list of the objects no longer referenced, so that lookups
+// of different objects rarely contend. References are counted in the
+// objects themselves: a release takes the shard lock only when it drops
+// the last reference, to put the object on the list, which is then
+// trimmed to the share of the volume byte budget of the shard.
+//
 class object_cache {
+public:
+    static size_t const SHARDS         = 16;
+    static size_t const DEFAULT_BUDGET = 64 * 1024 * 1024;
+
+    struct stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t inserts;
+        uint64_t evictions;
+        size_t   entries;
+        size_t   unreferenced;
+        size_t   bytes;
+
+        stats()
+        {
+            hits = 0;
+            misses = 0;
+            inserts = 0;
+            evictions = 0;
+            entries = 0;
+            unreferenced = 0;
+            bytes = 0;
+        }
+    };
+
 private:
+    struct entry;
+    typedef std::list<entry *>                    entry_list;
+    typedef std::unordered_map<uint64_t, entry *> entry_map;
+
     struct entry {
-        using oid_map = std::map<uint64_t, entry>;
+        apfs::object         *object;
+        size_t                size;
+        bool                  linked;
+        entry_list::iterator  position;
+    };
 
-        apfs::object *object;
-        size_t        refs;
-        time_t        expire;
+    struct shard {
+        std::mutex lock;
+        entry_map  entries;
+        entry_list unreferenced;
+        size_t     bytes;
+        stats      counters;
     };
 
+    typedef std::vector<apfs::object *> object_vector;
+
 private:
-    std::mutex      _lock;
-    entry::oid_map  _oids;
-    apfs::object   *_root;
+    mutable shard       _shards[SHARDS];
+    std::atomic<size_t> _budget;
+    apfs::object       *_root;
+
+public:
+    object_cache();
+    ~object_cache();
 
 protected:
     friend class apfs::volume;
@@ -53,13 +109,32 @@ protected:
 protected:
     void set_root(apfs::object *root);
 
-protected:
-    void lock();
-    void unlock();
+public:
+    //
+    // Unreferenced objects are kept up to the given number of bytes,
+    // as estimated from what they have loaded.
+    //
+    void set_budget(size_t bytes);
+    inline size_t get_budget() const
+    { return _budget.load(std::memory_order_relaxed); }
+    stats get_stats() const;
 
 protected:
-    void add_unlocked(apfs::object *o);
-    apfs::object *reference_unlocked(uint64_t oid);
+    //
+    // Returns the cached object with a new reference, or null.
+    //
+    apfs::object *reference(uint64_t oid);
+
+    //
+    // Caches an object with one reference, if another thread cached the
+    // same object meanwhile, that one is referenced and returned instead.
+    //
+    apfs::object *insert(apfs::object *o);
+
+    //
+    // Adds a reference to an object the caller already holds one of.
+    //
+    void retain(apfs::object *o);
 
 protected:
     void release(apfs::object *o);
@@ -68,7 +143,12 @@ protected:
     void clear();
 
 private:
-    void purge();
+    inline shard &shard_of(uint64_t oid)
+    { return _shards[((oid * UINT64_C(0x9e3779b97f4a7c15)) >> 32) % SHARDS]; }
+
+    void link_unlocked(shard &s, entry *e);
+    void unlink_unlocked(shard &s, entry *e);
+    void evict_unlocked(shard &s, object_vector &victims);
 };
 
 } }
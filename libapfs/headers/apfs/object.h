@@ -24,16 +24,26 @@
 #define __apfs_object_h
 
 #include "apfs/session.h"
+#include "apfs/directory_cursor.h"
 #include "apfs/internal/file.h"
 #include "apfs/internal/directory.h"
 
+#include <atomic>
+#include <mutex>
+
 namespace apfs { namespace internal { class object_cache; } }
 
 namespace apfs {
 
 class object : protected internal::file, protected internal::directory {
 protected:
-    volume *_volume;
+    volume                        *_volume;
+    uint64_t                       _inode_oid;
+    mutable std::mutex             _load_lock;
+    mutable std::atomic<unsigned>  _loaded;
+    std::atomic<size_t>            _refs;
+    unsigned                       _sized;
+    size_t                         _loaded_size;
 
 public:
     struct info {
@@ -86,7 +96,24 @@ protected:
     ~object();
 
 protected:
-    bool open(volume *volume, nx::enumerator *e);
+    bool open(volume *volume, uint64_t oid);
+
+private:
+    enum {
+        LOADED_XATTRS  = 1,
+        LOADED_ENTRIES = 2
+    };
+
+    void load(unsigned what) const;
+    void load_xattrs(nx::enumerator *e);
+    void load_entries(nx::enumerator *e);
+
+private:
+    //
+    // Estimated memory held by the object, charged against the cache
+    // budget while the object is unreferenced.
+    //
+    size_t get_memory_size();
 
 public:
     void release();
@@ -135,6 +162,15 @@ public:
 public:
     ssize_t read(void *buf, size_t size, nx_off_t offset) const;
 
+    //
+    // Reads through a stream are read ahead while sequential. Streams are
+    // used by one reader, typically an open file handle, and must be
+    // deleted before the object is released.
+    //
+    nx::readahead *open_stream() const;
+    ssize_t read(nx::readahead *stream, void *buf, size_t size,
+            nx_off_t offset) const;
+
 public:
     object *traverse(std::string const &path) const;
 
@@ -144,7 +180,16 @@ private:
 public:
     using directory_entry_map = directory::entry::name_map;
     directory_entry_map const &get_entries() const
-    { return directory::get_entries(); }
+    { load(LOADED_ENTRIES); return directory::get_entries(); }
+
+public:
+    using directory_entry = directory_cursor::entry;
+    directory_cursor *open_directory() const;
+    bool lookup(std::string const &name, directory_entry &entry) const;
+
+private:
+    friend class directory_cursor;
+    nx::enumerator *open_entries() const;
 
 public:
     inline uint64_t get_size() const
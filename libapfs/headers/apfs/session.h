@@ -34,6 +34,7 @@ private:
     nx::context                *_context;
     nx::container              *_container;
     bool                        _free_context;
+    bool                        _flatten_omap;
 
     std::map<size_t, volume *>  _volumes;
 
@@ -68,6 +69,16 @@ public:
     inline nx::container *get_container() const
     { return _container; }
 
+public:
+    //
+    // Load object maps in memory when the session starts, see
+    // nx::container::set_flatten_omap().
+    //
+    inline void set_flatten_omap(bool flatten)
+    { _flatten_omap = flatten; }
+    inline bool get_flatten_omap() const
+    { return _flatten_omap; }
+
 public:
     volume *open(size_t volid);
 };
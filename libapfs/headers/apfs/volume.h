@@ -78,6 +78,18 @@ public:
     inline char const *get_name() const
     { return _volume->get_name(); }
 
+public:
+    //
+    // Objects no longer referenced stay cached up to the given number of
+    // bytes.
+    //
+    inline void set_object_cache_size(size_t bytes)
+    { _cache.set_budget(bytes); }
+    inline size_t get_object_cache_size() const
+    { return _cache.get_budget(); }
+    inline internal::object_cache::stats get_object_cache_stats() const
+    { return _cache.get_stats(); }
+
 public:
     object *open_root();
     object *open(uint64_t oid);
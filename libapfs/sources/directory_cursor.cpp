@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2017-present Orlando Bassotto
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "apfs/directory_cursor.h"
+#include "apfs/object.h"
+
+#include "nx/enumerator.h"
+
+using apfs::directory_cursor;
+
+directory_cursor::directory_cursor(object const *object)
+    : _object    (object)
+    , _enumerator(nullptr)
+{
+}
+
+directory_cursor::~directory_cursor()
+{
+    delete _enumerator;
+}
+
+bool directory_cursor::
+rewind()
+{
+    delete _enumerator;
+    _enumerator = _object->open_entries();
+
+    return (_enumerator != nullptr);
+}
+
+bool directory_cursor::
+next(entry &entry)
+{
+    if (_enumerator == nullptr)
+        return false;
+
+    nx::object::sized_value_type key, value;
+
+    while (_enumerator->next(key, value)) {
+        auto obj_id = nx::swap(*reinterpret_cast<uint64_t const *>(key.first));
+
+        //
+        // The enumeration starts from the record preceding the entries.
+        //
+        if (APFS_OBJECT_ID_TYPE(obj_id) < APFS_OBJECT_TYPE_DREC)
+            continue;
+        if (APFS_OBJECT_ID_TYPE(obj_id) > APFS_OBJECT_TYPE_DREC)
+            break;
+
+        entry = internal::directory::make_entry(key.first, value.first);
+        return true;
+    }
+
+    //
+    // Release the B-tree nodes as soon as the end is reached.
+    //
+    delete _enumerator;
+    _enumerator = nullptr;
+
+    return false;
+}
@@ -29,21 +29,27 @@ using apfs::internal::directory;
 void directory::
 add_entry(void const *k, void const *v, bool insensitive)
 {
-    auto dk = reinterpret_cast<apfs_drec_key_t const *>(k);
-    auto dv = reinterpret_cast<apfs_drec_value_t const *>(v);
+    auto e = make_entry(k, v);
 
-    auto name = std::string(dk->hashed.name,
-            APFS_DREC_HASHED_NAME_LENGTH(dk) - 1);
-    auto key = name;
+    auto key = e.name;
     if (insensitive) {
         key = nxtools::to_lower(key);
     }
 
-    _entries[key] =
-        {
-            .oid       = nx::swap(dv->file_id),
-            .timestamp = nx::swap(dv->timestamp),
-            .hash      = APFS_DREC_HASHED_NAME_HASH(dk),
-            .name      = name
-        };
+    _entries[key] = std::move(e);
+}
+
+directory::entry directory::
+make_entry(void const *k, void const *v)
+{
+    auto dk = reinterpret_cast<apfs_drec_key_t const *>(k);
+    auto dv = reinterpret_cast<apfs_drec_value_t const *>(v);
+
+    return {
+        .oid       = nx::swap(dv->file_id),
+        .timestamp = nx::swap(dv->timestamp),
+        .hash      = APFS_DREC_HASHED_NAME_HASH(dk),
+        .name      = std::string(dk->hashed.name,
+                APFS_DREC_HASHED_NAME_LENGTH(dk) - 1)
+    };
 }
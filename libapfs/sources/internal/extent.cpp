@@ -0,0 +1,283 @@
+/*
+ * Copyright (c) 2017-present Orlando Bassotto
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "apfs/internal/extent.h"
+
+#include <algorithm>
+
+using apfs::internal::extent;
+using apfs::internal::extent_map;
+using apfs::internal::paged_extent_map;
+
+extent_map::extent_map()
+    : _cursor(0)
+{
+}
+
+extent_map::extent_map(extent_map const &other)
+    : _extents(other._extents)
+    , _cursor (0)
+{
+}
+
+extent_map &extent_map::
+operator=(extent_map const &other)
+{
+    if (this != &other) {
+        _extents = other._extents;
+        _cursor.store(0, std::memory_order_relaxed);
+    }
+    return *this;
+}
+
+void extent_map::
+insert(extent const &e)
+{
+    if (e.count == 0)
+        return;
+
+    //
+    // Extents come out of the file system tree in offset order, so
+    // the common case is appending (or growing) the last one.
+    //
+    if (_extents.empty() || e.offset >= _extents.back().end()) {
+        if (!_extents.empty()) {
+            auto &last = _extents.back();
+            if (e.offset == last.end() && e.lba == last.lba + last.count) {
+                last.count += e.count;
+                return;
+            }
+        }
+        _extents.push_back(e);
+        return;
+    }
+
+    auto i = std::upper_bound(_extents.begin(), _extents.end(), e.offset,
+            [](uint64_t value, extent const &x)
+            { return value < x.offset; });
+
+    size_t index = i - _extents.begin();
+    _extents.insert(i, e);
+
+    merge(index);
+    if (index > 0) {
+        merge(index - 1);
+    }
+}
+
+void extent_map::
+merge(size_t index)
+{
+    if (index + 1 >= _extents.size())
+        return;
+
+    auto &e    = _extents[index];
+    auto &next = _extents[index + 1];
+
+    if (next.offset == e.end() && next.lba == e.lba + e.count) {
+        e.count += next.count;
+        _extents.erase(_extents.begin() + index + 1);
+    }
+}
+
+void extent_map::
+clear()
+{
+    _extents.clear();
+    _cursor.store(0, std::memory_order_relaxed);
+}
+
+bool extent_map::
+lookup(uint64_t bno, extent &e) const
+{
+    size_t count = _extents.size();
+    if (count == 0)
+        return false;
+
+    //
+    // Try the extent last hit and the one following it first.
+    //
+    size_t cursor = _cursor.load(std::memory_order_relaxed);
+    if (cursor < count) {
+        if (_extents[cursor].contains(bno)) {
+            e = _extents[cursor];
+            return true;
+        }
+        if (cursor + 1 < count && _extents[cursor + 1].contains(bno)) {
+            _cursor.store(cursor + 1, std::memory_order_relaxed);
+            e = _extents[cursor + 1];
+            return true;
+        }
+    }
+
+    auto i = std::upper_bound(_extents.begin(), _extents.end(), bno,
+            [](uint64_t value, extent const &x)
+            { return value < x.offset; });
+    if (i == _extents.begin())
+        return false;
+
+    --i;
+    if (!i->contains(bno))
+        return false;
+
+    _cursor.store(i - _extents.begin(), std::memory_order_relaxed);
+    e = *i;
+    return true;
+}
+
+paged_extent_map::paged_extent_map(size_t page_size, size_t max_pages)
+    : _page_size(std::max(page_size, static_cast<size_t>(1)))
+    , _max_pages(std::max(max_pages, static_cast<size_t>(1)))
+    , _last     (0)
+    , _clock    (0)
+{
+}
+
+paged_extent_map::paged_extent_map(paged_extent_map const &other)
+    : _last (0)
+    , _clock(0)
+{
+    std::lock_guard<std::mutex> guard(other._lock);
+    _pages     = other._pages;
+    _page_size = other._page_size;
+    _max_pages = other._max_pages;
+}
+
+paged_extent_map &paged_extent_map::
+operator=(paged_extent_map const &other)
+{
+    if (this != &other) {
+        std::lock(_lock, other._lock);
+        std::lock_guard<std::mutex> guard(_lock, std::adopt_lock);
+        std::lock_guard<std::mutex> other_guard(other._lock, std::adopt_lock);
+        _pages     = other._pages;
+        _page_size = other._page_size;
+        _max_pages = other._max_pages;
+        _last      = 0;
+    }
+    return *this;
+}
+
+void paged_extent_map::
+clear()
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    _pages.clear();
+    _last = 0;
+}
+
+size_t paged_extent_map::
+get_page_count() const
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    return _pages.size();
+}
+
+size_t paged_extent_map::
+get_extent_count() const
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    size_t count = 0;
+    for (auto const &p : _pages) {
+        count += p.extents.size();
+    }
+    return count;
+}
+
+size_t paged_extent_map::
+find(uint64_t bno) const
+{
+    if (_last < _pages.size() && _pages[_last].contains(bno))
+        return _last;
+
+    auto i = std::upper_bound(_pages.begin(), _pages.end(), bno,
+            [](uint64_t value, page const &x)
+            { return value < x.first; });
+    if (i == _pages.begin() || !(--i)->contains(bno))
+        return _pages.size();
+
+    return i - _pages.begin();
+}
+
+bool paged_extent_map::
+load(uint64_t bno, loader_type const &loader, size_t &index)
+{
+    //
+    // The new page must fit between the resident pages around bno.
+    //
+    auto i = std::upper_bound(_pages.begin(), _pages.end(), bno,
+            [](uint64_t value, page const &x)
+            { return value < x.first; });
+
+    uint64_t lower = (i != _pages.begin()) ? (i - 1)->last : 0;
+    uint64_t limit = (i != _pages.end()) ? i->first : UINT64_MAX;
+
+    page p;
+    p.first = bno;
+    p.last  = limit;
+    p.used  = 0;
+    if (!loader(bno, limit, _page_size, p.extents, p.first, p.last))
+        return false;
+
+    p.first = std::max(p.first, lower);
+    p.last  = std::min(p.last, limit);
+    if (!p.contains(bno))
+        return false;
+
+    //
+    // Make room by dropping the least recently used page.
+    //
+    if (_pages.size() >= _max_pages) {
+        auto lru = std::min_element(_pages.begin(), _pages.end(),
+                [](page const &a, page const &b)
+                { return a.used < b.used; });
+        _pages.erase(lru);
+    }
+
+    i = std::upper_bound(_pages.begin(), _pages.end(), p.first,
+            [](uint64_t value, page const &x)
+            { return value < x.first; });
+
+    index = i - _pages.begin();
+    _pages.insert(i, std::move(p));
+    return true;
+}
+
+bool paged_extent_map::
+lookup(uint64_t bno, extent &e, loader_type const &loader)
+{
+    //
+    // Pages are loaded with the lock held, so that concurrent readers of
+    // the same file do not load the same page twice.
+    //
+    std::lock_guard<std::mutex> guard(_lock);
+
+    size_t index = find(bno);
+    if (index == _pages.size() && !load(bno, loader, index))
+        return false;
+
+    auto &p = _pages[index];
+    p.used = ++_clock;
+    _last  = index;
+
+    return p.extents.lookup(bno, e);
+}
@@ -22,12 +22,19 @@
 
 #include "apfs/internal/object.h"
 
+#include "nx/enumerator.h"
+#include "nx/readahead.h"
+#include "nx/volume.h"
+
+#include <algorithm>
 #include <cstring>
+#include <new>
 
 using apfs::internal::object;
 
 object::object()
-    : _oid(0)
+    : _oid      (0)
+    , _nx_volume(nullptr)
 {
     memset(&_dstream, 0, sizeof(_dstream));
 }
@@ -57,15 +64,76 @@ set_device_spec(uint32_t device)
 }
 
 void object::
-add_extent(void const *k, void const *v)
+set_nx_volume(nx::volume const *volume)
+{
+    _nx_volume = volume;
+}
+
+//
+// Loads up to count extents, starting from the one holding bno and
+// stopping before limit, with a range query on the file system tree.
+//
+bool object::
+load_extents(uint64_t bno, uint64_t limit, size_t count, extent_map &extents,
+        uint64_t &first, uint64_t &last) const
 {
-    auto fek = reinterpret_cast<apfs_file_extent_key_t const *>(k);
-    auto fev = reinterpret_cast<apfs_file_extent_value_t const *>(v);
+    if (_nx_volume == nullptr)
+        return false;
+
+    auto e = _nx_volume->open_file_extents(_oid, bno * NX_OBJECT_SIZE);
+    if (e == nullptr)
+        return false;
+
+    nx::object::sized_value_type key, value;
+    size_t n = 0;
+
+    first = bno;
+    last  = limit;
+
+    while (e->next(key, value)) {
+        auto obj_id = nx::swap(*reinterpret_cast<uint64_t const *>(key.first));
+
+        //
+        // The enumeration may start from a record preceding the extents.
+        //
+        if (APFS_OBJECT_ID_TYPE(obj_id) < APFS_OBJECT_TYPE_FILE_EXTENT)
+            continue;
+        if (APFS_OBJECT_ID_TYPE(obj_id) > APFS_OBJECT_TYPE_FILE_EXTENT)
+            break;
+
+        if (key.second < sizeof(apfs_file_extent_key_t) ||
+                value.second < sizeof(apfs_file_extent_value_t))
+            break;
+
+        auto fek = reinterpret_cast<apfs_file_extent_key_t const *>(key.first);
+        auto fev =
+            reinterpret_cast<apfs_file_extent_value_t const *>(value.first);
+
+        uint64_t offset = nx::swap(fek->offset) / NX_OBJECT_SIZE;
+        if (offset >= limit)
+            break;
+
+        //
+        // The page is full, it ends where the next extent begins.
+        //
+        if (n == count) {
+            last = offset;
+            break;
+        }
 
-    _extents.push_back(
-            extent(nx::swap(fek->offset) / NX_OBJECT_SIZE,
-                   nx::swap(fev->phys_block_num),
-                   APFS_FILE_EXTENT_VALUE_LENGTH(fev) / NX_OBJECT_SIZE));
+        if (n++ == 0) {
+            first = std::min(offset, bno);
+        }
+
+        extents.insert(
+                extent(offset,
+                       nx::swap(fev->phys_block_num),
+                       APFS_FILE_EXTENT_VALUE_LENGTH(fev) / NX_OBJECT_SIZE));
+    }
+
+    delete e;
+
+    return true;
 }
 
 bool object::
@@ -76,26 +144,174 @@ offset_to_extent(nx_off_t offset, uint64_t &lba, size_t &count,
         return false;
 
     uint64_t bno = offset / NX_OBJECT_SIZE;
+    extent   e;
+
+    if (!_extents.lookup(bno, e,
+                [this](uint64_t from, uint64_t limit, size_t max,
+                    extent_map &page, uint64_t &first, uint64_t &last)
+                {
+                    return load_extents(from, limit, max, page, first, last);
+                }))
+        return false;
+
+    lba = e.lba + (bno - e.offset);
+    count = e.count - (bno - e.offset);
+    loffset = offset % NX_OBJECT_SIZE;
+    return true;
+}
+
+ssize_t object::
+read(nx::device *device, void *buf, size_t size, nx_off_t offset) const
+{
+    static size_t const MAX_REQUESTS = 16;
+
+    struct bounce {
+        size_t   request;
+        size_t   loffset;
+        size_t   length;
+        uint8_t *bytes;
+    };
+
+    nx::device::read_request requests[MAX_REQUESTS];
+    bounce                   bounces[2];
+    uint8_t                 *blocks[2] = { nullptr, nullptr };
+    uint8_t                 *base      = reinterpret_cast<uint8_t *>(buf);
+    uint8_t                 *bytes     = base;
+
+    if (size == 0 || offset < 0 || offset >= get_size())
+        return 0;
+
+    if (size + offset >= get_size()) {
+        size = get_size() - offset;
+        if (size == 0)
+            return 0;
+    }
+
+    while (size > 0) {
+        size_t nrequests = 0;
+        size_t nbounces  = 0;
+        size_t planned   = 0;
+        bool   stalled   = false;
+        bool   nomem     = false;
+
+        //
+        // Plan one request per extent, the whole blocks of an extent are
+        // read straight into the caller buffer while an unaligned head or
+        // tail is bounced through a block; the requests are then issued
+        // as a single batch.
+        //
+        while (planned < size && nrequests < MAX_REQUESTS) {
+            uint64_t lba;
+            size_t   count;
+            size_t   loffset;
+            size_t   length;
+            size_t   left = size - planned;
+
+            if (!offset_to_extent(offset + planned, lba, count, loffset)) {
+                stalled = true;
+                break;
+            }
+
+            auto &r = requests[nrequests];
 
-    for (auto &e : _extents) {
-        if (bno >= e.offset && bno < e.offset + e.count) {
-            lba = e.lba + (bno - e.offset);
-            count = e.count;
-            loffset = offset % NX_OBJECT_SIZE;
-            return true;
+            if (loffset != 0 || left < NX_OBJECT_SIZE) {
+                auto &block = blocks[nbounces];
+                if (block == nullptr) {
+                    block = device->new_block<uint8_t>();
+                    if (block == nullptr) {
+                        stalled = nomem = true;
+                        break;
+                    }
+                }
+
+                length = std::min(left,
+                        static_cast<size_t>(NX_OBJECT_SIZE) - loffset);
+
+                r.lba    = lba;
+                r.count  = 1;
+                r.buffer = block;
+
+                bounces[nbounces].request = nrequests;
+                bounces[nbounces].loffset = loffset;
+                bounces[nbounces].length  = length;
+                bounces[nbounces].bytes   = bytes + planned;
+                nbounces++;
+            } else {
+                r.count  = std::min(count, left / NX_OBJECT_SIZE);
+                r.lba    = lba;
+                r.buffer = bytes + planned;
+
+                length = r.count * NX_OBJECT_SIZE;
+            }
+
+            nrequests++;
+            planned += length;
         }
+
+        if (nrequests == 0) {
+            if (nomem && bytes == base) {
+                nx::device::free_block(blocks[0]);
+                errno = ENOMEM;
+                return -1;
+            }
+            break;
+        }
+
+        device->read_batch(requests, nrequests);
+
+        //
+        // Only the requests read completely, up to the first failing one,
+        // are accounted.
+        //
+        size_t done     = 0;
+        bool   complete = true;
+        for (size_t n = 0, k = 0; n < nrequests && complete; n++) {
+            auto &r = requests[n];
+
+            if (k < nbounces && bounces[k].request == n) {
+                if (r.nread != 1) {
+                    complete = false;
+                    break;
+                }
+
+                memcpy(bounces[k].bytes, blocks[k] + bounces[k].loffset,
+                        bounces[k].length);
+                done += bounces[k].length;
+                k++;
+            } else {
+                done += r.nread * NX_OBJECT_SIZE;
+                complete = (r.nread == r.count);
+            }
+        }
+
+        bytes += done, offset += done, size -= done;
+
+        if (!complete || stalled)
+            break;
     }
 
-    return false;
+    nx::device::free_block(blocks[0]);
+    nx::device::free_block(blocks[1]);
+
+    return bytes - base;
+}
+
+nx::readahead *object::
+open_stream(nx::device *device) const
+{
+    return new (std::nothrow) nx::readahead(device,
+            [this](uint64_t block, uint64_t &lba, size_t &count)
+            {
+                size_t loffset;
+                return offset_to_extent(block * NX_OBJECT_SIZE, lba, count,
+                        loffset);
+            });
 }
 
 ssize_t object::
-read(nx::device *device, void *buf, size_t size, nx_off_t offset) const
+read(nx::readahead *stream, void *buf, size_t size, nx_off_t offset) const
 {
-    uint64_t lba;
-    size_t   count;
-    size_t   loffset;
-    uint8_t *block;
+    uint8_t *block = nullptr;
     uint8_t *base  = reinterpret_cast<uint8_t *>(buf);
     uint8_t *bytes = base;
 
@@ -108,26 +324,47 @@ read(nx::device *device, void *buf, size_t size, nx_off_t offset) const
             return 0;
     }
 
-    block = device->new_block<uint8_t>();
-    if (block == nullptr) {
-        errno = ENOMEM;
-        return -1;
-    }
-
+    //
+    // Whole blocks are read straight into the caller buffer, an unaligned
+    // head or tail is bounced through a block; the stream keeps track of
+    // the blocks read either way.
+    //
     while (size > 0) {
-        if (!offset_to_extent(offset, lba, count, loffset))
-            break;
+        uint64_t bno     = offset / NX_OBJECT_SIZE;
+        size_t   loffset = offset % NX_OBJECT_SIZE;
+        size_t   length;
+        size_t   nread;
 
-        while (size > 0 && count-- != 0) {
-            size_t len = std::min(size,
-                    static_cast<size_t>(NX_OBJECT_SIZE) - loffset);
+        if (loffset != 0 || size < NX_OBJECT_SIZE) {
+            if (block == nullptr) {
+                block = stream->get_device()->new_block<uint8_t>();
+                if (block == nullptr) {
+                    if (bytes == base) {
+                        errno = ENOMEM;
+                        return -1;
+                    }
+                    break;
+                }
+            }
 
-            if (!device->read(lba++, block, 1, nullptr))
+            if (!stream->read(bno, block, 1, &nread))
                 break;
 
-            memcpy(bytes, block + loffset, len);
-            bytes += len, offset += len, size -= len, loffset = 0;
+            length = std::min(size,
+                    static_cast<size_t>(NX_OBJECT_SIZE) - loffset);
+            memcpy(bytes, block + loffset, length);
+        } else {
+            size_t count = size / NX_OBJECT_SIZE;
+
+            stream->read(bno, bytes, count, &nread);
+            length = nread * NX_OBJECT_SIZE;
+            if (nread != count) {
+                bytes += length;
+                break;
+            }
         }
+
+        bytes += length, offset += length, size -= length;
     }
 
     nx::device::free_block(block);
@@ -23,10 +23,22 @@
 #include "apfs/internal/object_cache.h"
 #include "apfs/object.h"
 
-#include <ctime>
-
 using apfs::internal::object_cache;
 
+object_cache::object_cache()
+    : _budget(DEFAULT_BUDGET)
+    , _root  (nullptr)
+{
+    for (auto &s : _shards) {
+        s.bytes = 0;
+    }
+}
+
+object_cache::~object_cache()
+{
+    clear();
+}
+
 void object_cache::
 set_root(apfs::object *root)
 {
@@ -34,101 +46,208 @@ set_root(apfs::object *root)
 }
 
 void object_cache::
-add_unlocked(apfs::object *o)
+set_budget(size_t bytes)
 {
-    if (o == nullptr || o == _root)
-        return;
+    _budget.store(bytes, std::memory_order_relaxed);
 
-    auto i = _oids.find(o->get_file_id());
-    if (i != _oids.end()) {
-        i->second.refs++;
-        return;
-    }
+    for (auto &s : _shards) {
+        object_vector victims;
 
-    entry e;
-    e.refs   = 1;
-    e.object = o;
-    e.expire = 0;
+        {
+            std::lock_guard<std::mutex> _(s.lock);
+            evict_unlocked(s, victims);
+        }
 
-    _oids[o->get_file_id()] = e;
+        for (auto o : victims) {
+            delete o;
+        }
+    }
 }
 
-void object_cache::
-clear()
+object_cache::stats object_cache::
+get_stats() const
 {
-    std::lock_guard<std::mutex> _(_lock);
-
-    for (auto &i : _oids) {
-        delete i.second.object;
+    stats total;
+
+    for (auto &s : _shards) {
+        std::lock_guard<std::mutex> _(s.lock);
+
+        total.hits         += s.counters.hits;
+        total.misses       += s.counters.misses;
+        total.inserts      += s.counters.inserts;
+        total.evictions    += s.counters.evictions;
+        total.entries      += s.entries.size();
+        total.unreferenced += s.unreferenced.size();
+        total.bytes        += s.bytes;
     }
 
-    _oids.clear();
+    return total;
 }
 
 void object_cache::
-purge()
+link_unlocked(shard &s, entry *e)
 {
-    time_t now = time(nullptr);
-    for (auto i = _oids.begin(); i != _oids.end();) {
-        if (i->second.expire != 0 && now >= i->second.expire) {
-            delete i->second.object;
-            _oids.erase(i++);
-        } else {
-            ++i;
-        }
-    }
+    e->size = e->object->get_memory_size();
+    s.unreferenced.push_front(e);
+    e->position = s.unreferenced.begin();
+    e->linked = true;
+    s.bytes += e->size;
 }
 
 void object_cache::
-lock()
+unlink_unlocked(shard &s, entry *e)
 {
-    _lock.lock();
+    s.unreferenced.erase(e->position);
+    e->linked = false;
+    s.bytes -= e->size;
 }
 
 void object_cache::
-unlock()
+evict_unlocked(shard &s, object_vector &victims)
 {
-    _lock.unlock();
+    size_t budget = get_budget() / SHARDS;
+
+    while (s.bytes > budget && !s.unreferenced.empty()) {
+        auto e = s.unreferenced.back();
+
+        unlink_unlocked(s, e);
+        s.entries.erase(e->object->get_file_id());
+        s.counters.evictions++;
+
+        victims.push_back(e->object);
+        delete e;
+    }
+}
+
+void object_cache::
+clear()
+{
+    for (auto &s : _shards) {
+        std::lock_guard<std::mutex> _(s.lock);
+
+        for (auto &i : s.entries) {
+            delete i.second->object;
+            delete i.second;
+        }
+
+        s.entries.clear();
+        s.unreferenced.clear();
+        s.bytes = 0;
+    }
 }
 
 apfs::object *object_cache::
-reference_unlocked(uint64_t oid)
+reference(uint64_t oid)
 {
     if (oid == APFS_DREC_ROOT_FILE_ID)
         return _root;
     if (oid < APFS_DREC_ROOT_FILE_ID)
         return nullptr;
 
-    auto i = _oids.find(oid);
-    if (i == _oids.end())
+    auto &s = shard_of(oid);
+
+    std::lock_guard<std::mutex> _(s.lock);
+
+    auto i = s.entries.find(oid);
+    if (i == s.entries.end()) {
+        s.counters.misses++;
         return nullptr;
+    }
 
-    i->second.refs++;
-    i->second.expire = 0;
+    auto e = i->second;
+    e->object->_refs.fetch_add(1, std::memory_order_relaxed);
+    if (e->linked) {
+        unlink_unlocked(s, e);
+    }
 
-    // must be called locked
-    purge();
+    s.counters.hits++;
 
-    return i->second.object;
+    return e->object;
+}
+
+apfs::object *object_cache::
+insert(apfs::object *o)
+{
+    if (o == nullptr || o == _root)
+        return o;
+
+    auto &s = shard_of(o->get_file_id());
+
+    std::lock_guard<std::mutex> _(s.lock);
+
+    auto i = s.entries.find(o->get_file_id());
+    if (i != s.entries.end()) {
+        auto e = i->second;
+        e->object->_refs.fetch_add(1, std::memory_order_relaxed);
+        if (e->linked) {
+            unlink_unlocked(s, e);
+        }
+
+        return e->object;
+    }
+
+    auto e = new entry;
+    e->object = o;
+    e->size   = 0;
+    e->linked = false;
+
+    o->_refs.store(1, std::memory_order_relaxed);
+    s.entries[o->get_file_id()] = e;
+    s.counters.inserts++;
+
+    return o;
 }
 
 void object_cache::
-release(apfs::object *o)
+retain(apfs::object *o)
 {
     if (o == nullptr || o == _root)
         return;
 
-    std::lock_guard<std::mutex> _(_lock);
+    o->_refs.fetch_add(1, std::memory_order_relaxed);
+}
 
-    auto i = _oids.find(o->get_file_id());
-    if (i == _oids.end())
+void object_cache::
+release(apfs::object *o)
+{
+    if (o == nullptr || o == _root)
         return;
 
-    if (i->second.refs == 0)
+    //
+    // Only the last reference takes the lock. Once it is dropped, the
+    // object may be revived and evicted by other threads, it is not used
+    // again until found in the shard.
+    //
+    uint64_t oid  = o->get_file_id();
+    size_t   refs = o->_refs.load(std::memory_order_relaxed);
+    do {
+        if (refs == 0)
+            return;
+    } while (!o->_refs.compare_exchange_weak(refs, refs - 1,
+                std::memory_order_acq_rel, std::memory_order_relaxed));
+
+    if (refs != 1)
         return;
 
-    if (--i->second.refs == 0) {
-        // Will be deleted after some time, unless it's going to be used.
-        i->second.expire = time(nullptr) + 10*60;
+    auto          &s = shard_of(oid);
+    object_vector  victims;
+
+    {
+        std::lock_guard<std::mutex> _(s.lock);
+
+        auto i = s.entries.find(oid);
+        if (i == s.entries.end() || i->second->object != o)
+            return;
+
+        auto e = i->second;
+        if (o->_refs.load(std::memory_order_acquire) != 0 || e->linked)
+            return;
+
+        link_unlocked(s, e);
+        evict_unlocked(s, victims);
+    }
+
+    for (auto victim : victims) {
+        delete victim;
     }
 }
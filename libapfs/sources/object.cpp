@@ -43,7 +43,12 @@
 using apfs::object;
 
 object::object()
-    : _volume(nullptr)
+    : _volume     (nullptr)
+    , _inode_oid  (0)
+    , _loaded     (0)
+    , _refs       (0)
+    , _sized      (0)
+    , _loaded_size(0)
 {
 }
 
@@ -52,61 +57,134 @@ object::~object()
 }
 
 bool object::
-open(volume *volume, nx::enumerator *e)
+open(volume *volume, uint64_t oid)
 {
     //
-    // Collect the file information
+    // Only the inode is read here, it is all stat() needs; xattrs,
+    // extents and directory entries are loaded on demand.
     //
+    apfs_inode_key_t key;
+
+    key.obj_id = nx::swap(APFS_OBJECT_MAKE(INODE, oid));
+
+    if (!volume->get_nx_volume()->lookup_records(&key, sizeof(key),
+                [](void *opaque, nx::object::sized_value_type const &,
+                    nx::object::sized_value_type const &value)
+                {
+                    reinterpret_cast<object *>(opaque)->file::set_inode(
+                            value.first, value.second);
+                    return false;
+                }, this))
+        return false;
+
+    _inode_oid = oid;
+
+    file::set_nx_volume(volume->get_nx_volume());
+
+    _volume = volume;
+    return true;
+}
+
+void object::
+load(unsigned what) const
+{
+    if ((_loaded.load(std::memory_order_acquire) & what) == what)
+        return;
+
+    std::lock_guard<std::mutex> guard(_load_lock);
+    unsigned loaded = _loaded.load(std::memory_order_relaxed);
+    auto     self   = const_cast<object *>(this);
+
+    if ((what & LOADED_XATTRS) != 0 && (loaded & LOADED_XATTRS) == 0) {
+        auto e = _volume->get_nx_volume()->open_oid(_inode_oid);
+        if (e != nullptr) {
+            self->load_xattrs(e);
+            delete e;
+        }
+    }
+
+    if ((what & LOADED_ENTRIES) != 0 && (loaded & LOADED_ENTRIES) == 0) {
+        if (is_directory()) {
+            auto e = open_entries();
+            if (e != nullptr) {
+                self->load_entries(e);
+                delete e;
+            }
+        }
+    }
+
+    _loaded.store(loaded | what, std::memory_order_release);
+}
+
+void object::
+load_xattrs(nx::enumerator *e)
+{
     nx::object::sized_value_type key, value;
-    bool insensitive = !volume->is_case_sensitive();
 
+    //
+    // Xattrs follow the inode, nothing past them is needed.
+    //
     while (e->next(key, value)) {
         auto obj_id = nx::swap(*reinterpret_cast<uint64_t const *>(key.first));
 
-        switch (APFS_OBJECT_ID_TYPE(obj_id)) {
-            case APFS_OBJECT_TYPE_INODE:
-                file::set_inode(value.first, value.second);
-                break;
-
-            case APFS_OBJECT_TYPE_XATTR:
-                file::add_xattr(key.first, value.first);
-                break;
+        if (APFS_OBJECT_ID_TYPE(obj_id) > APFS_OBJECT_TYPE_XATTR)
+            break;
 
-            case APFS_OBJECT_TYPE_FILE_EXTENT:
-                file::add_extent(key.first, value.first);
-                break;
-
-            case APFS_OBJECT_TYPE_DREC:
-                directory::add_entry(key.first, value.first, insensitive);
-                break;
+        if (APFS_OBJECT_ID_TYPE(obj_id) == APFS_OBJECT_TYPE_XATTR) {
+            file::add_xattr(key.first, value.first);
         }
     }
 
     //
-    // For each indirect xattr, collect extents.
+    // Indirect xattrs read their extents through the volume.
     //
     for (auto &x : file::get_xattrs()) {
-        if (x.is_content_inlined())
-            continue;
+        if (!x.is_content_inlined()) {
+            x.set_nx_volume(_volume->get_nx_volume());
+        }
+    }
+}
 
-        auto e = volume->get_nx_volume()->open_oid(x.get_oid());
-        if (e != nullptr) {
-            while (e->next(key, value)) {
-                auto obj_id =
-                    nx::swap(*reinterpret_cast<uint64_t const *>(key.first));
-
-                switch (APFS_OBJECT_ID_TYPE(obj_id)) {
-                    case APFS_OBJECT_TYPE_FILE_EXTENT:
-                        x.add_extent(key.first, value.first);
-                        break;
-                }
-            }
-            delete e;
+void object::
+load_entries(nx::enumerator *e)
+{
+    nx::object::sized_value_type key, value;
+    bool insensitive = !_volume->is_case_sensitive();
+
+    while (e->next(key, value)) {
+        auto obj_id = nx::swap(*reinterpret_cast<uint64_t const *>(key.first));
+
+        if (APFS_OBJECT_ID_TYPE(obj_id) > APFS_OBJECT_TYPE_DREC)
+            break;
+
+        if (APFS_OBJECT_ID_TYPE(obj_id) == APFS_OBJECT_TYPE_DREC) {
+            directory::add_entry(key.first, value.first, insensitive);
         }
     }
+}
 
-    _volume = volume;
-    return true;
+nx::enumerator *object::
+open_entries() const
+{
+    return _volume->get_nx_volume()->open_directory(_inode_oid);
+}
+
+apfs::directory_cursor *object::
+open_directory() const
+{
+    if (!is_directory()) {
+        errno = ENOTDIR;
+        return nullptr;
+    }
+
+    auto cursor = new directory_cursor(this);
+    if (!cursor->rewind()) {
+        delete cursor;
+        errno = EIO;
+        return nullptr;
+    }
+
+    return cursor;
 }
 
 void object::
@@ -227,6 +305,8 @@ has_xattrs(unsigned flags) const
     if ((flags & HAS_XATTR_ANY) == 0)
         return false;
 
+    load(LOADED_XATTRS);
+
     if (flags & HAS_XATTR_THIS) {
         if (!file::get_xattrs().empty())
             return true;
@@ -235,15 +315,17 @@ has_xattrs(unsigned flags) const
     bool descendent_xattr = false;
 
     if (is_directory() && (flags & HAS_XATTR_DESCENDENT) != 0) {
-        for (auto const &i : directory::get_entries()) {
-            auto *o = _volume->open(i.second.oid);
-            if (o != nullptr) {
-                descendent_xattr = o->has_xattrs();
-                o->release();
+        auto cursor = open_directory();
+        if (cursor != nullptr) {
+            directory_entry entry;
+            while (!descendent_xattr && cursor->next(entry)) {
+                auto *o = _volume->open(entry.oid);
+                if (o != nullptr) {
+                    descendent_xattr = o->has_xattrs();
+                    o->release();
+                }
             }
-
-            if (descendent_xattr)
-                break;
+            delete cursor;
         }
     }
 
@@ -255,6 +337,8 @@ get_xattr_count() const
 {
     size_t count = 0;
 
+    load(LOADED_XATTRS);
+
     for (auto &x : file::get_xattrs()) {
         if (is_symbolic_link() && x.get_name() == APFS_XATTR_NAME_SYMLINK)
             continue;
@@ -268,6 +352,8 @@ get_xattr_count() const
 void object::
 get_xattrs(string_vector &xattrs) const
 {
+    load(LOADED_XATTRS);
+
     xattrs.clear();
     for (auto &x : file::get_xattrs()) {
         //
@@ -297,6 +383,8 @@ has_xattr(std::string const &name) const
     if (is_symbolic_link() && name == APFS_XATTR_NAME_SYMLINK)
         return false;
 
+    load(LOADED_XATTRS);
+
     for (auto &x : file::get_xattrs()) {
         if (x.get_name() == name)
             return true;
@@ -317,6 +405,8 @@ get_xattr_size(std::string const &name) const
         return -1;
     }
 
+    load(LOADED_XATTRS);
+
     for (auto &x : file::get_xattrs()) {
         if (x.get_name() == name)
             return x.get_size();
@@ -338,6 +428,8 @@ read_xattr(std::string const &name, void *buf, size_t size,
         return -1;
     }
 
+    load(LOADED_XATTRS);
+
     for (auto &x : file::get_xattrs()) {
         if (x.get_name() == name)
             return x.read(_volume->get_session()->get_main_device(),
@@ -354,6 +446,8 @@ read_symbolic_link(std::string &target) const
     if (!is_symbolic_link())
         return false;
 
+    load(LOADED_XATTRS);
+
     target = file::get_symbolic_link();
     return true;
 }
@@ -370,6 +464,106 @@ read(void *buf, size_t size, nx_off_t offset) const
             offset);
 }
 
+nx::readahead *object::
+open_stream() const
+{
+    if (!is_regular()) {
+        errno = is_directory() ? EISDIR : EINVAL;
+        return nullptr;
+    }
+
+    return file::open_stream(_volume->get_session()->get_main_device());
+}
+
+ssize_t object::
+read(nx::readahead *stream, void *buf, size_t size, nx_off_t offset) const
+{
+    if (!is_regular()) {
+        errno = is_directory() ? EISDIR : EINVAL;
+        return -1;
+    }
+
+    return file::read(stream, buf, size, offset);
+}
+
+//
+// Pure ASCII names hash the same after APFS normalization, so their
+// record can be found with a single descent of the file system tree;
+// other names are looked up in the directory name map.
+//
+static bool
+is_ascii(std::string const &name)
+{
+    for (auto c : name) {
+        if (static_cast<unsigned char>(c) >= 0x80)
+            return false;
+    }
+    return true;
+}
+
+bool object::
+lookup(std::string const &name, directory_entry &entry) const
+{
+    if (!is_directory()) {
+        errno = ENOTDIR;
+        return false;
+    }
+
+    bool insensitive = !_volume->is_case_sensitive();
+    auto key = insensitive ? nxtools::to_lower(name) : name;
+
+    if ((_loaded.load(std::memory_order_acquire) & LOADED_ENTRIES) == 0 &&
+            is_ascii(key)) {
+        uint32_t hash = ::apfs_hash_name(key.c_str(), key.length(),
+                insensitive);
+
+        apfs_drec_key_t dkey;
+
+        dkey.obj_id               = nx::swap(APFS_OBJECT_MAKE(DREC, _inode_oid));
+        dkey.hashed.name_len_hash = nx::swap(static_cast<uint32_t>(hash << 10));
+
+        struct match {
+            std::string const *key;
+            bool               insensitive;
+            directory_entry   *entry;
+            bool               found;
+        } m = { &key, insensitive, &entry, false };
+
+        //
+        // Only the records of the name hash are visited.
+        //
+        _volume->get_nx_volume()->lookup_records(&dkey,
+                sizeof(dkey.obj_id) + sizeof(dkey.hashed.name_len_hash),
+                [](void *opaque, nx::object::sized_value_type const &k,
+                    nx::object::sized_value_type const &v)
+                {
+                    auto m = reinterpret_cast<match *>(opaque);
+
+                    *m->entry = directory::make_entry(k.first, v.first);
+                    m->found  = (m->insensitive ?
+                            nxtools::to_lower(m->entry->name) :
+                            m->entry->name) == *m->key;
+                    return !m->found;
+                }, &m);
+
+        if (!m.found) {
+            errno = ENOENT;
+        }
+        return m.found;
+    }
+
+    load(LOADED_ENTRIES);
+
+    auto i = directory::get_entries().find(key);
+    if (i == directory::get_entries().end()) {
+        errno = ENOENT;
+        return false;
+    }
+
+    entry = i->second;
+    return true;
+}
+
 object *object::
 traverse(std::string const &path) const
 {
@@ -397,13 +591,11 @@ traverse(vector_view<std::string> const &names) const
     if (names.empty())
         return reference(this);
 
-    auto i = directory::get_entries().find(names[0]);
-    if (i == directory::get_entries().end()) {
-        errno = ENOENT;
+    directory_entry entry;
+    if (!lookup(names[0], entry))
         return nullptr;
-    }
 
-    auto o = _volume->open(i->second.oid);
+    auto o = _volume->open(entry.oid);
     if (o == nullptr)
         return nullptr;
 
@@ -419,11 +611,35 @@ traverse(vector_view<std::string> const &names) const
 object *object::
 reference(object const *o) const
 {
-    auto &cache = _volume->get_cache();
-
-    cache.lock();
-    cache.add_unlocked(const_cast<object *>(o));
-    cache.unlock();
+    _volume->get_cache().retain(const_cast<object *>(o));
 
     return const_cast<object *>(o);
 }
+
+size_t object::
+get_memory_size()
+{
+    //
+    // Xattrs and directory entries only change when loaded, their size
+    // is computed once per load.
+    //
+    unsigned loaded = _loaded.load(std::memory_order_acquire);
+    if (loaded != _sized) {
+        _loaded_size = 0;
+
+        for (auto const &x : file::get_xattrs()) {
+            _loaded_size += sizeof(x) + x.get_name().capacity() +
+                x.get_inline_content().capacity();
+        }
+
+        for (auto const &e : directory::get_entries()) {
+            _loaded_size += sizeof(e) + e.first.capacity() +
+                e.second.name.capacity();
+        }
+
+        _sized = loaded;
+    }
+
+    return (sizeof(*this) + get_name().capacity() + _loaded_size +
+            _extents.get_extent_count() * sizeof(internal::extent));
+}
@@ -29,8 +29,9 @@ using apfs::session;
 using apfs::volume;
 
 session::session(nx::context *context)
-    : _context  (context)
-    , _container(nullptr)
+    : _context     (context)
+    , _container   (nullptr)
+    , _flatten_omap(false)
 {
     if (_context == nullptr) {
         _context = new nx::context;
@@ -57,6 +58,7 @@ start_at(uint64_t xid)
     }
 
     auto container = new nx::container(_context);
+    container->set_flatten_omap(_flatten_omap);
     if (!container->open_at(xid)) {
         delete container;
         errno = ENOENT;
@@ -76,6 +78,7 @@ start(bool last_xid)
     }
 
     auto container = new nx::container(_context);
+    container->set_flatten_omap(_flatten_omap);
     if (!container->open(last_xid)) {
         delete container;
         errno = ENOENT;
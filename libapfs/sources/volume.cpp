@@ -77,16 +77,8 @@ open(session *session, size_t volid)
         return false;
     }
 
-    auto root = _volume->open_root();
-    if (root == nullptr) {
-        close();
-        errno = EINVAL;
-        return false;
-    }
-
     _root = new object;
-    bool success = _root->open(this, root);
-    delete root;
+    bool success = _root->open(this, APFS_DREC_ROOT_FILE_ID);
 
     if (!success) {
         close();
@@ -101,6 +93,7 @@ open(session *session, size_t volid)
 void volume::
 close()
 {
+    _cache.clear();
     delete _root;
     delete _volume;
     _root = nullptr;
@@ -221,24 +214,27 @@ open(uint64_t oid)
     if (oid == APFS_DREC_ROOT_FILE_ID)
         return open_root();
 
-    _cache.lock();
-    auto o = _cache.reference_unlocked(oid);
-    if (o == nullptr) {
-        auto e = _volume->open_oid(oid);
-        if (e != nullptr) {
-            o = new object;
-            if (!o->open(this, e)) {
-                delete o;
-                o = nullptr;
-            } else {
-                _cache.add_unlocked(o);
-            }
-            delete e;
-        }
+    auto o = _cache.reference(oid);
+    if (o != nullptr)
+        return o;
+
+    //
+    // Objects are opened without holding the cache, should another thread
+    // open the same object meanwhile, the first one cached is kept.
+    //
+    o = new object;
+    if (!o->open(this, oid)) {
+        delete o;
+        errno = ENOENT;
+        return nullptr;
+    }
+
+    auto cached = _cache.insert(o);
+    if (cached != o) {
+        delete o;
     }
-    _cache.unlock();
 
-    return o;
+    return cached;
 }
 
 apfs::object *volume::
@@ -0,0 +1,474 @@
+/*
+ * Copyright (c) 2017-present Orlando Bassotto
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __nx_basic_enumerator_h
+#define __nx_basic_enumerator_h
+
+#include "nx/btn_view.h"
+#include "nx/device.h"
+#include "nx/object.h"
+
+namespace nx {
+
+//
+// The mapper of trees whose child nodes are addressed physically, such as
+// object maps.
+//
+struct physical_mapper {
+    inline bool operator()(uint64_t, uint64_t &) const
+    { return true; }
+};
+
+//
+// An enumerator of the records within a key range that does not allocate
+// once the nodes it visits are cached: the path from the root is kept on
+// a fixed stack, nodes are pinned from the device cache, or read into
+// buffers kept by the enumerator when the cache is disabled, and the
+// mapper and comparer are template parameters.
+//
+// The mapper is called as bool(uint64_t oid, uint64_t &lba), and turns
+// the oid of a child node into its lba. The comparer is called as
+// int(void const *key, size_t key_size), and returns a negative value for
+// keys preceding the range, zero for keys within it and a positive value
+// for keys following it; it must be copy assignable.
+//
+// Each node is accessed through the btn_view of its layout, chosen when
+// the node is loaded, and searched with btn_lower_bound(), which has a
+// vectorized kernel for btn_u64_comparer over fixed size slots.
+//
+template <typename Mapper, typename Compare, size_t MaxDepth = 8>
+class basic_enumerator {
+private:
+    struct node_type {
+        nx_btn_t        *node;
+        size_t           index;
+        bool             pooled;
+        bool             fixed;
+        btn_view<true>   fixed_view;
+        btn_view<false>  variable_view;
+    };
+
+private:
+    context   *_context;
+    device    *_device;
+    uint64_t   _root_lba;
+    uint32_t   _tree_type;
+    Mapper     _mapper;
+    Compare    _compare;
+    node_type  _stack[MaxDepth];
+    nx_btn_t  *_pool[MaxDepth];
+    size_t     _depth;
+    bool       _end;
+
+public:
+    basic_enumerator(context *context, device *device, uint64_t root_lba,
+            uint32_t tree_type, Mapper const &mapper,
+            Compare const &compare = Compare())
+        : _context  (context)
+        , _device   (device)
+        , _root_lba (root_lba)
+        , _tree_type(tree_type)
+        , _mapper   (mapper)
+        , _compare  (compare)
+        , _depth    (0)
+        , _end      (true)
+    {
+        for (size_t n = 0; n < MaxDepth; n++) {
+            _stack[n].node   = nullptr;
+            _stack[n].index  = 0;
+            _stack[n].pooled = false;
+            _stack[n].fixed  = false;
+            _pool[n]         = nullptr;
+        }
+    }
+
+    ~basic_enumerator()
+    {
+        clear();
+        for (size_t n = 0; n < MaxDepth; n++) {
+            device::free_block(_pool[n]);
+        }
+    }
+
+    basic_enumerator(basic_enumerator const &) = delete;
+    basic_enumerator &operator=(basic_enumerator const &) = delete;
+
+public:
+    bool seek(Compare const &compare);
+    bool next(object::sized_value_type &key, object::sized_value_type &value);
+
+private:
+    void clear();
+    void release(size_t level);
+    bool load(size_t level, uint64_t lba);
+    bool fetch(size_t level, size_t index, btn_kvinfo_t &kvi,
+            void const *&key, void const *&value) const;
+    bool lower_bound(size_t level, size_t first, uint32_t &index) const;
+    bool descend(size_t level, void const *value, size_t value_size);
+    bool advance();
+};
+
+template <typename Mapper, typename Compare, size_t MaxDepth>
+void basic_enumerator<Mapper, Compare, MaxDepth>::
+clear()
+{
+    for (size_t n = 0; n < MaxDepth; n++) {
+        release(n);
+    }
+    _depth = 0;
+    _end   = true;
+}
+
+template <typename Mapper, typename Compare, size_t MaxDepth>
+void basic_enumerator<Mapper, Compare, MaxDepth>::
+release(size_t level)
+{
+    //
+    // Pooled buffers are kept for the next node read at this level.
+    //
+    if (!_stack[level].pooled) {
+        _device->release_block(_stack[level].node);
+    }
+    _stack[level].node   = nullptr;
+    _stack[level].index  = 0;
+    _stack[level].pooled = false;
+}
+
+template <typename Mapper, typename Compare, size_t MaxDepth>
+bool basic_enumerator<Mapper, Compare, MaxDepth>::
+load(size_t level, uint64_t lba)
+{
+    release(level);
+
+    auto btn    = _device->template map_block <nx_btn_t> (lba);
+    bool pooled = false;
+
+    if (btn != nullptr) {
+        //
+        // Mapped nodes are used in place.
+        //
+        if (!_device->verify_block(lba, &btn->btn_o)) {
+            _context->log(severity::error, "cannot read btree node at lba "
+                    "%" PRIu64, lba);
+            return false;
+        }
+    } else if ((btn = _device->template lookup_block <nx_btn_t> (lba)) ==
+            nullptr) {
+        //
+        // Read nodes go to the cache, which then owns them; without a
+        // cache they are read into the buffer of this level.
+        //
+        pooled = (_device->get_cache_size() == 0);
+        if (pooled) {
+            if (_pool[level] == nullptr) {
+                _pool[level] = _device->template new_block <nx_btn_t> ();
+            }
+            btn = _pool[level];
+        } else {
+            btn = _device->template new_block <nx_btn_t> ();
+        }
+
+        if (btn == nullptr) {
+            _context->log(severity::fatal, "not enough memory to allocate "
+                    "btree node");
+            return false;
+        }
+
+        if (!_device->read(lba, btn, false) ||
+                !_device->verify_block(lba, &btn->btn_o)) {
+            _context->log(severity::error, "cannot read btree node at lba "
+                    "%" PRIu64, lba);
+            if (!pooled) {
+                device::free_block(btn);
+            }
+            return false;
+        }
+
+        if (!pooled) {
+            _device->cache_block(lba, btn);
+        }
+    }
+
+    _stack[level].node   = btn;
+    _stack[level].pooled = pooled;
+    _stack[level].fixed  = ((nx::swap(btn->btn_flags) &
+                NX_BTN_FLAG_COMPRESSED) != 0);
+
+    //
+    // Ensure it's matching the specs.
+    //
+    auto root      = _stack[0].node;
+    auto tree_type = (level == 0 ? _tree_type : NX_OBJECT_TYPE_BTREE_NODE);
+
+    if (tree_type != 0 &&
+            !(nx::swap(btn->btn_o.o_type) == tree_type ||
+              NX_OBJECT_GET_TYPE(nx::swap(btn->btn_o.o_type)) == tree_type)) {
+        _context->log(severity::error,
+                "expected btree node of type %#" PRIx32 ", "
+                "got a btree node of type %#" PRIx32,
+                tree_type, nx::swap(btn->btn_o.o_type));
+        return false;
+    }
+    if (level != 0 && nx::swap(btn->btn_level) >= nx::swap(root->btn_level)) {
+        _context->log(severity::error,
+                "btree node level #%u is not less than btree root node "
+                "level #%u", nx::swap(btn->btn_level),
+                nx::swap(root->btn_level));
+        return false;
+    }
+
+    if (_stack[level].fixed) {
+        _stack[level].fixed_view = btn_view<true>(btn, root);
+    } else {
+        _stack[level].variable_view = btn_view<false>(btn, root);
+    }
+
+    return true;
+}
+
+template <typename Mapper, typename Compare, size_t MaxDepth>
+bool basic_enumerator<Mapper, Compare, MaxDepth>::
+fetch(size_t level, size_t index, btn_kvinfo_t &kvi, void const *&key,
+        void const *&value) const
+{
+    auto const &slot = _stack[level];
+    auto        n    = static_cast<uint32_t>(index);
+
+    if (!(slot.fixed ? slot.fixed_view.get(n, kvi, key, value) :
+                slot.variable_view.get(n, kvi, key, value))) {
+        _context->log(severity::error,
+                "failed retrieving key/value in btree node slot #%" PRIu64,
+                static_cast<uint64_t>(index));
+        return false;
+    }
+
+    return true;
+}
+
+template <typename Mapper, typename Compare, size_t MaxDepth>
+bool basic_enumerator<Mapper, Compare, MaxDepth>::
+lower_bound(size_t level, size_t first, uint32_t &index) const
+{
+    auto const &slot = _stack[level];
+    auto        n    = static_cast<uint32_t>(first);
+
+    if (!(slot.fixed ? btn_lower_bound(slot.fixed_view, n, _compare, index) :
+                btn_lower_bound(slot.variable_view, n, _compare, index))) {
+        _context->log(severity::error, "failed searching btree node, "
+                "invalid table of contents");
+        return false;
+    }
+
+    return true;
+}
+
+template <typename Mapper, typename Compare, size_t MaxDepth>
+bool basic_enumerator<Mapper, Compare, MaxDepth>::
+descend(size_t level, void const *value, size_t value_size)
+{
+    if (value_size != sizeof(uint64_t)) {
+        _context->log(severity::error,
+                "expected value to be of length %" PRIu64 ", "
+                "got a value of length %" PRIu64,
+                static_cast<uint64_t>(sizeof(uint64_t)),
+                static_cast<uint64_t>(value_size));
+        return false;
+    }
+
+    if (level + 1 >= MaxDepth) {
+        _context->log(severity::error,
+                "btree is deeper than %" PRIu64 " levels",
+                static_cast<uint64_t>(MaxDepth));
+        return false;
+    }
+
+    uint64_t lba = nx::swap(*reinterpret_cast<uint64_t const *>(value));
+    if (!_mapper(lba, lba))
+        return false;
+
+    return load(level + 1, lba);
+}
+
+//
+// Positions the enumerator at the first record within the range of
+// compare, the nodes of a previous enumeration are released first.
+//
+template <typename Mapper, typename Compare, size_t MaxDepth>
+bool basic_enumerator<Mapper, Compare, MaxDepth>::
+seek(Compare const &compare)
+{
+    clear();
+
+    _compare = compare;
+
+    if (!load(0, _root_lba)) {
+        clear();
+        return false;
+    }
+
+    size_t level = 0;
+    size_t first = 0;
+    for (;;) {
+        auto         node  = _stack[level].node;
+        size_t       nkeys = nx::swap(node->btn_nkeys);
+        btn_kvinfo_t kvi;
+        void const  *key;
+        void const  *val;
+        uint32_t     n;
+
+        //
+        // Find the first key not preceding the range.
+        //
+        if (!lower_bound(level, first, n))
+            break;
+
+        if (node->btn_level == 0) {
+            if (n < nkeys) {
+                if (!fetch(level, n, kvi, key, val) ||
+                        _compare(key, kvi.key_size) != 0)
+                    break;
+
+                _stack[level].index = n;
+                _depth = level + 1;
+                _end   = false;
+                return true;
+            }
+        } else if (n > first || n < nkeys) {
+            //
+            // The range may begin in the subtree preceding the lower
+            // bound, unless the first key searched is already within it.
+            //
+            bool preceding = (n > first);
+            if (preceding) {
+                n--;
+            }
+
+            if (!fetch(level, n, kvi, key, val))
+                break;
+
+            if (!preceding && _compare(key, kvi.key_size) != 0)
+                break;
+
+            _stack[level].index = n;
+            if (!descend(level, val, kvi.val_size))
+                break;
+
+            level++;
+            first = 0;
+            continue;
+        }
+
+        //
+        // Retry from the parent, from the next entry.
+        //
+        if (level == 0)
+            break;
+
+        release(level);
+        level--;
+        first = _stack[level].index + 1;
+    }
+
+    clear();
+    return false;
+}
+
+template <typename Mapper, typename Compare, size_t MaxDepth>
+bool basic_enumerator<Mapper, Compare, MaxDepth>::
+advance()
+{
+    size_t level = _depth - 1;
+
+    for (;;) {
+        if (level == 0)
+            return false;
+
+        //
+        // Move to the next entry of the parent, or further upward when
+        // the parent is exhausted too.
+        //
+        level--;
+        if (++_stack[level].index >= nx::swap(_stack[level].node->btn_nkeys))
+            continue;
+
+        btn_kvinfo_t kvi;
+        void const  *key;
+        void const  *val;
+
+        if (!fetch(level, _stack[level].index, kvi, key, val) ||
+                _compare(key, kvi.key_size) != 0)
+            return false;
+
+        //
+        // A continuation always starts at the first entry of each node
+        // down to the leaf.
+        //
+        while (_stack[level].node->btn_level != 0) {
+            if (!descend(level, val, kvi.val_size))
+                return false;
+
+            level++;
+            if (!fetch(level, 0, kvi, key, val) ||
+                    _compare(key, kvi.key_size) != 0)
+                return false;
+        }
+
+        _depth = level + 1;
+        return true;
+    }
+}
+
+template <typename Mapper, typename Compare, size_t MaxDepth>
+bool basic_enumerator<Mapper, Compare, MaxDepth>::
+next(object::sized_value_type &key, object::sized_value_type &value)
+{
+    if (_end)
+        return false;
+
+    auto top = &_stack[_depth - 1];
+    if (top->index >= nx::swap(top->node->btn_nkeys)) {
+        if (!advance()) {
+            _end = true;
+            return false;
+        }
+
+        top = &_stack[_depth - 1];
+    }
+
+    btn_kvinfo_t kvi;
+    if (!fetch(_depth - 1, top->index, kvi, key.first, value.first) ||
+            _compare(key.first, kvi.key_size) != 0) {
+        _end = true;
+        return false;
+    }
+
+    key.second   = kvi.key_size;
+    value.second = kvi.val_size;
+
+    top->index++;
+
+    return true;
+}
+
+}
+
+#endif  // !__nx_basic_enumerator_h
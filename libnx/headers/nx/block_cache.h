@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2017-present Orlando Bassotto
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __nx_block_cache_h
+#define __nx_block_cache_h
+
+#include <cstddef>
+#include <cstdint>
+
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+namespace nx {
+
+//
+// Memory bounded cache of verified metadata blocks keyed by physical
+// address.
+//
+// Replacement follows the 2Q policy: blocks seen once live in a FIFO
+// (A1in), evicted addresses are remembered in a ghost queue (A1out) and
+// only a block referenced again after falling off A1in is promoted to the
+// LRU (Am). Large sequential scans thus cycle through A1in without
+// flushing the hot index nodes kept in Am.
+//
+// Blocks handed out by the cache are pinned, they are released with
+// device::free_block() like any other block.
+//
+class block_cache {
+public:
+    struct alignas(16) header {
+        block_cache *cache;
+        void        *entry;
+    };
+
+    struct stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t inserts;
+        uint64_t evictions;
+        size_t   resident;
+        size_t   pinned;
+
+        stats()
+        {
+            hits = 0;
+            misses = 0;
+            inserts = 0;
+            evictions = 0;
+            resident = 0;
+            pinned = 0;
+        }
+    };
+
+private:
+    enum queue_type { A1IN, AM };
+
+    struct entry;
+    typedef std::list<entry *>                           queue_type_list;
+    typedef std::list<uint64_t>                          ghost_list;
+    typedef std::unordered_map<uint64_t, entry *>        entry_map;
+    typedef std::unordered_map<uint64_t,
+            ghost_list::iterator>                        ghost_map;
+
+    struct entry {
+        uint64_t                  lba;
+        header                   *block;
+        size_t                    refs;
+        queue_type                queue;
+        queue_type_list::iterator position;
+    };
+
+private:
+    mutable std::mutex _lock;
+    size_t             _block_size;
+    size_t             _capacity;
+    size_t             _a1in_capacity;
+    size_t             _a1out_capacity;
+    entry_map          _entries;
+    queue_type_list    _a1in;
+    queue_type_list    _am;
+    ghost_list         _a1out;
+    ghost_map          _ghosts;
+    stats              _stats;
+
+public:
+    block_cache();
+    ~block_cache();
+
+public:
+    void configure(size_t block_size, size_t size);
+    void clear();
+
+public:
+    inline size_t get_size() const
+    { return _capacity * _block_size; }
+    stats get_stats() const;
+
+public:
+    void *lookup(uint64_t lba);
+    bool insert(uint64_t lba, void *block);
+
+public:
+    static inline header *get_header(void const *block)
+    { return reinterpret_cast<header *>(const_cast<void *>(block)) - 1; }
+
+protected:
+    friend class device;
+    void release(header *h);
+
+private:
+    void evict_unlocked();
+    bool evict_one_unlocked(queue_type_list &queue);
+    void remember_unlocked(uint64_t lba);
+    void drop_unlocked(entry *e);
+};
+
+}
+
+#endif  // !__nx_block_cache_h
@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2017-present Orlando Bassotto
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __nx_btn_view_h
+#define __nx_btn_view_h
+
+#include "nx/base.h"
+#include "nx/swap.h"
+
+#include <cstddef>
+#include <type_traits>
+
+namespace nx {
+
+//
+// A view of a btree node whose slot layout is known at compile time: fixed
+// size (compressed) slots, as in object maps, or variable size slots, as
+// in file system trees. The node header is decoded once, when the view is
+// made, instead of on every slot access.
+//
+template <bool Fixed>
+class btn_view {
+public:
+    typedef typename std::conditional<Fixed, btn_cslot_t,
+            btn_slot_t>::type slot_type;
+
+private:
+    nx_btn_t const  *_btn;
+    nx_btn_t const  *_top;
+    slot_type const *_slots;
+    uint8_t const   *_keys;
+    uint8_t const   *_values;
+    uint8_t const   *_limit;
+    uint32_t         _nkeys;
+    uint16_t         _key_size;
+    uint16_t         _val_size;
+    bool             _valid;
+
+public:
+    btn_view()
+        : _btn     (nullptr)
+        , _top     (nullptr)
+        , _slots   (nullptr)
+        , _keys    (nullptr)
+        , _values  (nullptr)
+        , _limit   (nullptr)
+        , _nkeys   (0)
+        , _key_size(0)
+        , _val_size(0)
+        , _valid   (false)
+    { }
+
+    btn_view(nx_btn_t const *btn, nx_btn_t const *btntop)
+    {
+        auto   bt        = NX_BTN_FIXED(btntop);
+        auto   flags     = nx::swap(btn->btn_flags);
+        size_t table_len = nx::swap(btn->btn_table_space.len);
+
+        _btn      = btn;
+        _top      = btntop;
+        _slots    = reinterpret_cast<slot_type const *>(NX_BTN_DATA(btn));
+        _keys     = reinterpret_cast<uint8_t const *>(NX_BTN_DATA(btn)) +
+            table_len;
+        _limit    = reinterpret_cast<uint8_t const *>(btn) +
+            nx::swap(bt->bt_node_size);
+        _values   = _limit -
+            ((flags & NX_BTN_FLAG_FIXED) ? sizeof(bt_fixed_t) : 0);
+        _nkeys    = nx::swap(btn->btn_nkeys);
+        _key_size = static_cast<uint16_t>(nx::swap(bt->bt_key_size));
+        _val_size = static_cast<uint16_t>((flags & NX_BTN_FLAG_LEAF) ?
+                nx::swap(bt->bt_val_size) : sizeof(uint64_t));
+        _valid    = (((flags & NX_BTN_FLAG_COMPRESSED) != 0) == Fixed &&
+                _nkeys * sizeof(slot_type) <= table_len);
+    }
+
+public:
+    //
+    // Whether the node has the layout of this view.
+    //
+    inline bool is_valid() const
+    { return _valid; }
+
+    inline uint32_t size() const
+    { return _nkeys; }
+
+public:
+    inline bool get(uint32_t n, btn_kvinfo_t &kvi, void const *&key,
+            void const *&value) const
+    {
+        if (n >= _nkeys)
+            return false;
+
+        decode(_slots[n], kvi);
+
+        key = (kvi.key_offset == NX_BTN_NONE) ? nullptr :
+            _keys + kvi.key_offset;
+        value = (kvi.val_offset == NX_BTN_NONE ||
+                kvi.val_offset == NX_BTN_NODE) ? nullptr :
+            _values - kvi.val_offset;
+
+        return true;
+    }
+
+    //
+    // Same as nx_btn_lower_bound(), with the comparer called inline.
+    //
+    template <typename Compare>
+    inline bool lower_bound(uint32_t first, Compare const &compare,
+            uint32_t &index) const
+    {
+        uint32_t lo = first;
+        uint32_t hi = _nkeys;
+
+        if (!_valid)
+            return false;
+
+        while (lo < hi) {
+            uint32_t     mid = lo + (hi - lo) / 2;
+            btn_kvinfo_t kvi;
+
+            decode(_slots[mid], kvi);
+
+            if (kvi.key_offset == NX_BTN_NONE ||
+                    _keys + kvi.key_offset + kvi.key_size > _limit)
+                return false;
+
+            if (compare(_keys + kvi.key_offset, kvi.key_size) < 0) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+
+        index = lo;
+        return true;
+    }
+
+    //
+    // Searches keys by their leading 64-bit word, fixed size slots only.
+    //
+    inline bool lower_bound_u64(uint32_t first, uint64_t value,
+            uint32_t &index) const
+    {
+        static_assert(Fixed, "only fixed size slots can be searched by word");
+        return _valid && ::nx_btn_lower_bound_u64(_btn, _top, first, value,
+                &index);
+    }
+
+private:
+    inline void decode(btn_cslot_t const &slot, btn_kvinfo_t &kvi) const
+    {
+        kvi.key_offset = nx::swap(slot.key_offset);
+        kvi.key_size   = (kvi.key_offset == NX_BTN_NONE) ? 0 : _key_size;
+        kvi.val_offset = nx::swap(slot.val_offset);
+        kvi.val_size   = (kvi.val_offset == NX_BTN_NONE) ? 0 :
+            (kvi.val_offset == NX_BTN_NODE) ? NX_BTN_NODE : _val_size;
+    }
+
+    inline void decode(btn_slot_t const &slot, btn_kvinfo_t &kvi) const
+    {
+        kvi.key_offset = nx::swap(slot.key_offset);
+        kvi.key_size   = nx::swap(slot.key_size);
+        kvi.val_offset = nx::swap(slot.val_offset);
+        kvi.val_size   = nx::swap(slot.val_size);
+    }
+};
+
+//
+// Orders keys by their leading 64-bit word, as object map keys by oid.
+//
+struct btn_u64_comparer {
+    uint64_t value;
+
+    inline int operator()(void const *key, size_t key_size) const
+    {
+        if (key_size < sizeof(uint64_t))
+            return -1;
+
+        uint64_t word = nx::swap(*reinterpret_cast<uint64_t const *>(key));
+        return (word > value) ? 1 : (word < value) ? -1 : 0;
+    }
+};
+
+//
+// Searches a node with the kernel best suited to its layout and comparer.
+//
+template <bool Fixed, typename Compare>
+inline bool
+btn_lower_bound(btn_view<Fixed> const &view, uint32_t first,
+        Compare const &compare, uint32_t &index)
+{
+    return view.lower_bound(first, compare, index);
+}
+
+inline bool
+btn_lower_bound(btn_view<true> const &view, uint32_t first,
+        btn_u64_comparer const &compare, uint32_t &index)
+{
+    return view.lower_bound_u64(first, compare.value, index);
+}
+
+}
+
+#endif  // !__nx_btn_view_h
@@ -24,6 +24,13 @@
 #define __nx_container_h
 
 #include "nx/object.h"
+#include "nx/omap_cache.h"
+#include "nx/omap_index.h"
+#include "nx/space_map.h"
+
+#include <map>
+#include <memory>
+#include <vector>
 
 namespace nx {
 
@@ -31,8 +38,32 @@ class volume;
 
 class container : public object {
 private:
-    nx_super_t *_main_super;
-    nx_super_t *_tier2_super;
+    //
+    // An object of a checkpoint map, the maps of a checkpoint are sorted
+    // by object id and type.
+    //
+    struct checkpoint_object {
+        uint64_t oid;
+        uint32_t type;
+        uint64_t paddr;
+        uint64_t size;
+
+        inline bool operator<(checkpoint_object const &other) const
+        {
+            return (oid < other.oid ||
+                    (oid == other.oid && type < other.type));
+        }
+    };
+
+    typedef std::vector<checkpoint_object> checkpoint_map;
+
+private:
+    nx_super_t                         *_main_super;
+    nx_super_t                         *_tier2_super;
+    mutable omap_cache                  _omap_cache;
+    omap_index                          _omap_index;
+    bool                                _flatten_omap;
+    std::map<uint64_t, checkpoint_map>  _checkpoint_maps;
 
 public:
     struct info {
@@ -64,6 +95,17 @@ public:
     inline bool is_open() const
     { return (_main_super != nullptr); }
 
+public:
+    //
+    // When enabled, the object maps of the container and of the volumes
+    // opened afterwards are loaded in memory once at open time, and
+    // object map lookups no longer read the btree.
+    //
+    inline void set_flatten_omap(bool flatten)
+    { _flatten_omap = flatten; }
+    inline bool get_flatten_omap() const
+    { return _flatten_omap; }
+
 public:
     inline nx_super_t const *get_main_super() const
     { return _main_super; }
@@ -72,6 +114,12 @@ public:
 
 public:
     bool get_info(info &info) const;
+
+    //
+    // Decodes the space manager chunks and bitmaps of the main device into
+    // its allocated and free extents.
+    //
+    bool load_space_map(space_map &map) const;
     inline size_t get_block_size() const
     { return nx::swap(get_super()->nx_block_size); }
     inline uint64_t get_block_count() const
@@ -89,6 +137,9 @@ private:
             bool quiet = false);
     bool find_tier2_super(device *device, uint64_t xid, bool equal,
             nx_super_t *&super);
+    bool read_checkpoints(device *device, std::unique_ptr<uint8_t[]> &ring,
+            std::map<uint64_t, uint64_t> &supers);
+    void build_omap_index();
 
 private:
     bool read_cpm(device *device, uint64_t lba, nx_cpm_t *&cpm) const;
@@ -96,12 +147,18 @@ private:
 private:
     bool lookup_checkpoint_oid(device *device, nx_super_t const *sb,
             uint64_t oid, uint32_t type, uint64_t &paddr, uint64_t &size) const;
-    inline bool lookup_omap_oid(device *device, nx_super_t const *sb,
-            uint64_t oid, uint32_t type, uint64_t &paddr, uint64_t &size) const
-    {
-        return object::lookup_omap_oid(device, nx::swap(sb->nx_omap_oid), oid,
-                type, paddr, size);
-    }
+    bool lookup_omap_oid(device *device, nx_super_t const *sb,
+            uint64_t oid, uint32_t type, uint64_t &paddr, uint64_t &size) const;
+
+private:
+    bool load_cib(device *device, uint64_t paddr, uint32_t blocks_per_chunk,
+            space_map &map) const;
+
+public:
+    inline omap_cache::stats get_omap_cache_stats() const
+    { return _omap_cache.get_stats(); }
+    inline size_t get_omap_index_size() const
+    { return _omap_index.size(); }
 
 public:
     void traverse_omap(omap_traverser_type const &callback);
@@ -118,6 +175,10 @@ public:
                         value); });
     }
 
+    //
+    // Scans the whole device for valid objects, or from the given block
+    // up to the first one.
+    //
     void scavenge(std::function<bool(uint64_t,
                 nx_object_t const *)> const &callback,
             uint64_t blockno = static_cast<uint64_t>(-1)) const;
@@ -130,6 +191,15 @@ public:
         scavenge([=](uint64_t bno, nx_object_t const *object)
                 { return (*callback)(opaque, bno, object); }, blockno);
     }
+
+    //
+    // Scans only the given extents of the device, e.g. the free ones of
+    // the space map to carve deleted objects, or the allocated ones to
+    // recover metadata.
+    //
+    void scavenge(std::function<bool(uint64_t,
+                nx_object_t const *)> const &callback,
+            space_map::extent_vector const &extents) const;
 };
 
 }
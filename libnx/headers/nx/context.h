@@ -28,6 +28,9 @@
 
 namespace nx {
 
+template <typename, typename, size_t>
+class basic_enumerator;
+
 class context {
 private:
     logger *_logger;
@@ -60,6 +63,8 @@ public:
     { return _tier2_device; }
 
 protected:
+    template <typename, typename, size_t>
+    friend class basic_enumerator;
     friend class btree_traverser;
     friend class container;
     friend class enumerator;
@@ -23,6 +23,8 @@
 #ifndef __nx_device_h
 #define __nx_device_h
 
+#include "nx/block_cache.h"
+#include "nx/io_queue.h"
 #include "nx/format/nx.h"
 
 #include <cerrno>
@@ -30,15 +32,120 @@
 #include <cstdint>
 
 #include <algorithm>
+#include <atomic>
 #include <memory>
+#include <mutex>
 
 namespace nx {
 
 class device {
+public:
+    static size_t const DEFAULT_CACHE_SIZE = 32 * 1024 * 1024;
+    static size_t const DEFAULT_COALESCE_GAP = 0;
+    static size_t const DEFAULT_READAHEAD = 256;
+
+    //
+    // Object checksums are verified on every read by default; as images are
+    // only read, a block can instead be verified the first time it is read
+    // since the device was opened, or not at all.
+    //
+    enum verify_policy {
+        VERIFY_ALWAYS,
+        VERIFY_ONCE,
+        VERIFY_TRUST
+    };
+
+    //
+    // Access pattern hints for mapped devices.
+    //
+    enum access_pattern {
+        ACCESS_NORMAL,
+        ACCESS_SEQUENTIAL,
+        ACCESS_RANDOM
+    };
+
+    struct verify_stats {
+        uint64_t verified;
+        uint64_t skipped;
+        uint64_t failed;
+
+        verify_stats()
+        {
+            verified = 0;
+            skipped = 0;
+            failed = 0;
+        }
+    };
+
+    //
+    // A request of a batch read, nread is set to the number of blocks
+    // read into buffer.
+    //
+    struct read_request {
+        uint64_t lba;
+        size_t   count;
+        void    *buffer;
+        size_t   nread;
+    };
+
+    struct read_stats {
+        uint64_t requests;
+        uint64_t calls;
+        uint64_t blocks;
+
+        read_stats()
+        {
+            requests = 0;
+            calls = 0;
+            blocks = 0;
+        }
+    };
+
 private:
-    int      _fd;
-    size_t   _block_size;
-    uint64_t _block_count;
+    typedef std::atomic<uint64_t> counter_type;
+
+    //
+    // Counts the requests of a batch in flight on the queue of the device,
+    // the requests point to it through opaque.
+    //
+    struct io_tracker {
+        std::atomic<size_t> pending;
+
+        io_tracker()
+            : pending(0)
+        { }
+    };
+
+    int                  _fd;
+    size_t               _block_size;
+    uint64_t             _block_count;
+    size_t               _cache_size;
+    mutable block_cache  _cache;
+    bool                 _map_enabled;
+    uint8_t             *_map;
+    size_t               _map_size;
+    verify_policy        _verify_policy;
+    std::unique_ptr<counter_type[]>
+                         _verified_map;
+    mutable counter_type _verified;
+    mutable counter_type _skipped;
+    mutable counter_type _failed;
+    size_t               _coalesce_gap;
+    std::unique_ptr<uint8_t[]>
+                         _gap_buffer;
+    mutable counter_type _read_requests;
+    mutable counter_type _read_calls;
+    mutable counter_type _read_blocks;
+    io_queue::backend_type
+                         _io_backend;
+    size_t               _io_depth;
+    mutable std::mutex   _io_lock;
+    mutable io_queue     _io_queue;
+    mutable bool         _io_failed;
+    size_t               _readahead;
+
+    friend class io_queue::backend;
+    friend class readahead;
 
 public:
     device();
@@ -54,9 +161,95 @@ public:
     inline uint64_t get_block_count() const
     { return _block_count; }
 
+public:
+    void set_cache_size(size_t size);
+    inline size_t get_cache_size() const
+    { return _cache_size; }
+    inline block_cache::stats get_cache_stats() const
+    { return _cache.get_stats(); }
+
+public:
+    //
+    // Image files can be mapped in memory when the device is opened, reads
+    // are then served from the mapping and map_block() hands out blocks
+    // without copying them.
+    //
+    void set_mapping_enabled(bool enabled);
+    inline bool is_mapping_enabled() const
+    { return _map_enabled; }
+    inline bool is_mapped() const
+    { return _map != nullptr; }
+    void advise(access_pattern pattern) const;
+
+public:
+    //
+    // The policy must not be changed while blocks are being read.
+    //
+    void set_verify_policy(verify_policy policy);
+    inline verify_policy get_verify_policy() const
+    { return _verify_policy; }
+    verify_stats get_verify_stats() const;
+
+    //
+    // Verifies the checksum of an object read from the given block,
+    // according to the verification policy.
+    //
+    bool verify_block(uint64_t lba, nx_object_t const *object) const;
+
+private:
+    void reset_verified_map();
+    bool map(int fd, uint64_t size);
+    void unmap();
+
 public:
     bool read(uint64_t lba, void *blocks, size_t count, size_t *nread) const;
 
+    //
+    // Reads a batch of requests in block order, requests separated by at
+    // most the coalescing gap are merged into a single vectored read, the
+    // blocks in between being discarded. Only adjacent requests are merged
+    // by default, reading over gaps pays off on slow storage only. Returns
+    // false if any request could not be read completely.
+    //
+    bool read_batch(read_request *requests, size_t count) const;
+
+    //
+    // With an asynchronous backend, the requests of a batch are all kept
+    // in flight at once instead; batches from different threads share the
+    // queue and complete each other's requests. The queue is opened by the
+    // first batch, so that its threads are started by the process that
+    // reads.
+    //
+    void set_io_backend(io_queue::backend_type type,
+            size_t depth = io_queue::DEFAULT_DEPTH);
+    inline io_queue::backend_type get_io_backend() const
+    { return _io_backend; }
+
+    void set_coalesce_gap(size_t blocks);
+    inline size_t get_coalesce_gap() const
+    { return _coalesce_gap; }
+    read_stats get_read_stats() const;
+
+    //
+    // Streams opened on the device read ahead up to the given number of
+    // blocks, zero disables readahead. Only asynchronous backends read
+    // ahead, streams read synchronously otherwise.
+    //
+    inline void set_readahead(size_t blocks)
+    { _readahead = blocks; }
+    inline size_t get_readahead() const
+    { return _readahead; }
+
+private:
+    void reset_gap_buffer();
+    void reset_io_queue();
+    bool open_io_queue() const;
+    bool read_queued(read_request *requests, size_t count) const;
+    size_t submit_queued(io_queue::request *requests, size_t count,
+            io_tracker &tracker) const;
+    size_t reap_queued(bool wait) const;
+    bool wait_queued(io_tracker const &tracker) const;
+
 public:
     template <typename T>
     inline T *new_block() const
@@ -65,15 +258,73 @@ public:
         if (block_size == 0)
             return nullptr;
 
-        return reinterpret_cast <T *> (new (std::nothrow) uint8_t[block_size]);
+        auto h = reinterpret_cast <block_cache::header *> (new (std::nothrow)
+                uint8_t[sizeof(block_cache::header) + block_size]);
+        if (h == nullptr)
+            return nullptr;
+
+        h->cache = nullptr;
+        h->entry = nullptr;
+
+        return reinterpret_cast <T *> (h + 1);
     }
 
     template <typename T>
     static inline void free_block(T *&ptr)
     {
         if (ptr != nullptr) {
-            delete[] reinterpret_cast<uint8_t *> (ptr);
+            auto h = block_cache::get_header(ptr);
+            if (h->cache != nullptr) {
+                h->cache->release(h);
+            } else {
+                delete[] reinterpret_cast<uint8_t *> (h);
+            }
+            ptr = nullptr;
+        }
+    }
+
+public:
+    //
+    // Cached blocks are returned pinned and must be treated as read-only,
+    // only blocks that have been verified should be inserted.
+    //
+    template <typename T>
+    inline T *lookup_block(uint64_t lba) const
+    { return reinterpret_cast <T *> (_cache.lookup(lba)); }
+
+    template <typename T>
+    inline void cache_block(uint64_t lba, T *block) const
+    { _cache.insert(lba, block); }
+
+public:
+    //
+    // Mapped blocks are read-only, valid until the device is closed, and
+    // must be verified by the caller; blocks that may come from the mapping
+    // are released with release_block() rather than free_block().
+    //
+    template <typename T>
+    inline T *map_block(uint64_t lba) const
+    {
+        if (_map == nullptr || lba >= _block_count)
+            return nullptr;
+
+        return reinterpret_cast <T *> (_map + lba * _block_size);
+    }
+
+    template <typename T>
+    inline bool is_mapped_block(T const *block) const
+    {
+        auto p = reinterpret_cast <uint8_t const *> (block);
+        return (_map != nullptr && p >= _map && p < _map + _map_size);
+    }
+
+    template <typename T>
+    inline void release_block(T *&ptr) const
+    {
+        if (is_mapped_block(ptr)) {
             ptr = nullptr;
+        } else {
+            free_block(ptr);
         }
     }
 
@@ -84,7 +335,7 @@ public:
         if (!read(lba, object, 1, nullptr))
             return false;
 
-        if (validate && !::nx_object_verify(reinterpret_cast <nx_object_t *> (object))) {
+        if (validate && !verify_block(lba, reinterpret_cast <nx_object_t *> (object))) {
             errno = ENOTBLK;
             return false;
         }
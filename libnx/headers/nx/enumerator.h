@@ -34,6 +34,7 @@ class enumerator {
 public:
     typedef std::function<bool(uint64_t, uint64_t &)> oid_mapper_type;
     typedef std::function<int(uint64_t, uint64_t)> oid_comparer_type;
+    typedef std::function<int(void const *, size_t)> key_comparer_type;
 
 private:
     typedef std::pair<nx_btn_t *, size_t> node_type;
@@ -48,6 +49,8 @@ private:
     stack<node_type>   _stack;
     oid_mapper_type    _mapper;
     oid_comparer_type  _compare;
+    key_comparer_type  _seek;
+    bool               _floor;
     bool               _end;
 
 protected:
@@ -64,6 +67,7 @@ public:
 
 public:
     bool reset();
+    bool seek(key_comparer_type const &seek, bool floor = false);
     bool next(object::sized_value_type &key, object::sized_value_type &value);
 
 private:
@@ -72,6 +76,10 @@ private:
     bool fetch_node_kv(nx_btn_t const *node, size_t index, btn_kvinfo_t *kvi,
             void const **key, void const **value) const;
     bool is_index_node_valid(btn_kvinfo_t const &kvi) const;
+    bool lower_bound(nx_btn_t const *node, size_t first, size_t &index) const;
+
+private:
+    static int compare_key(void *opaque, void const *key, size_t key_size);
 };
 
 }
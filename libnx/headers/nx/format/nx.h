@@ -151,6 +151,15 @@ typedef struct _nx_cib {
     nx_cib_entry_t cib_map[1];
 } nx_cib_t;
 
+#define NX_CIB_SIZE_MASK 0x000fffff /* high bits are reserved */
+
+typedef struct _nx_cab {
+    nx_object_t cab_o;
+    uint32_t    cab_index;
+    uint32_t    cab_count;
+    uint64_t    cab_map[1];
+} nx_cab_t;
+
 typedef struct _nx_cpm_entry {
     uint32_t cpm_type;
     uint32_t cpm_subtype;
@@ -323,6 +332,10 @@ typedef bool (*nx_btn_traverse_callback_t)(void *opaque,
         void const *key, size_t key_size,
         void const *val, size_t val_size);
 
+/* Returns <0, 0 or >0 if key is less, equal or greater than the searched one. */
+typedef int (*nx_btn_compare_callback_t)(void *opaque,
+        void const *key, size_t key_size);
+
 #define NX_OBJECT(x) ((nx_object_t const *)(x))
 
 #ifdef __cplusplus
@@ -339,6 +352,8 @@ char const *nx_object_name(nx_object_t const *object);
 char const *nx_uuid_format(nx_uuid_t const *uuid, char *buf, size_t bufsiz);
 
 uint64_t nx_checksum_make(void const *data, size_t length);
+bool nx_checksum_set_impl(char const *name);
+char const *nx_checksum_get_impl(void);
 uint64_t nx_object_checksum(nx_object_t const *object);
 
 bool nx_checksum_verify(void const *data, size_t length);
@@ -351,6 +366,11 @@ bool nx_btn_get_kvptrs(nx_btn_t const *btn, nx_btn_t const *btntop,
 
 bool nx_btn_traverse(nx_btn_t const *btn, nx_btn_t const *btntop,
         nx_btn_traverse_callback_t callback, void *opaque);
+bool nx_btn_lower_bound(nx_btn_t const *btn, nx_btn_t const *btntop,
+        uint32_t first, nx_btn_compare_callback_t compare, void *opaque,
+        uint32_t *index);
+bool nx_btn_lower_bound_u64(nx_btn_t const *btn, nx_btn_t const *btntop,
+        uint32_t first, uint64_t value, uint32_t *index);
 
 void nx_object_dump(nx_dumper_t *dumper, nx_object_t const *object);
 void nx_super_dump(nx_dumper_t *dumper, nx_super_t const *sb);
@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2017-present Orlando Bassotto
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef __nx_io_queue_h
+#define __nx_io_queue_h
+
+#include <cstddef>
+#include <cstdint>
+
+#include <memory>
+
+namespace nx {
+
+class device;
+
+//
+// Asynchronous reads from a device: requests are submitted and later
+// reaped as they complete, in any order, with at most depth requests in
+// flight.
+//
+// Reads are issued through io_uring where the kernel supports it, by a
+// pool of threads doing synchronous reads otherwise; the synchronous
+// backend reads at submission and is the reference.
+//
+// A queue must be used by one thread at a time.
+//
+class io_queue {
+public:
+    static size_t const DEFAULT_DEPTH = 64;
+
+    enum backend_type {
+        BACKEND_DEFAULT,
+        BACKEND_SYNC,
+        BACKEND_THREADS,
+        BACKEND_URING
+    };
+
+    //
+    // nread is set to the number of blocks read into buffer and error to
+    // the errno of a failed read, opaque is left to the caller.
+    //
+    struct request {
+        uint64_t lba;
+        size_t   count;
+        void    *buffer;
+        size_t   nread;
+        int      error;
+        void    *opaque;
+    };
+
+    class backend;
+
+private:
+    device const            *_device;
+    std::unique_ptr<backend> _backend;
+    backend_type             _type;
+    size_t                   _depth;
+    size_t                   _in_flight;
+
+public:
+    io_queue();
+    ~io_queue();
+
+    io_queue(io_queue const &) = delete;
+    io_queue &operator=(io_queue const &) = delete;
+
+public:
+    bool open(device const *device, backend_type type = BACKEND_DEFAULT,
+            size_t depth = DEFAULT_DEPTH);
+    void close();
+
+public:
+    inline backend_type get_backend() const
+    { return _type; }
+    inline size_t get_depth() const
+    { return _depth; }
+    inline size_t get_in_flight() const
+    { return _in_flight; }
+
+    static bool is_supported(backend_type type);
+    static char const *get_backend_name(backend_type type);
+    static bool parse_backend_name(char const *name, backend_type &type);
+
+public:
+    //
+    // Fails with EAGAIN when depth requests are in flight. Submitted
+    // requests may be held until flush() or complete() is called.
+    //
+    bool submit(request *request);
+    void flush();
+
+    //
+    // Reaps up to count completed requests, waiting for at least one when
+    // wait is set and requests are in flight. Should the backend fail,
+    // requests in flight come back with error set, and only once their
+    // buffers are no longer written to; further submissions fail.
+    //
+    size_t complete(request **requests, size_t count, bool wait);
+};
+
+}
+
+#endif  // !__nx_io_queue_h
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2017-present Orlando Bassotto
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __nx_omap_cache_h
+#define __nx_omap_cache_h
+
+#include <cstddef>
+#include <cstdint>
+
+#include <mutex>
+#include <vector>
+
+namespace nx {
+
+//
+// Translation cache for object map lookups, maps (oid, xid) to the
+// physical address and size of the object.
+//
+// The table is direct mapped: a colliding insert simply replaces the
+// previous translation, which keeps memory bounded and lookups O(1).
+//
+class omap_cache {
+public:
+    static size_t const DEFAULT_SIZE = 8192;
+
+public:
+    struct stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t inserts;
+        size_t   entries;
+
+        stats()
+        {
+            hits = 0;
+            misses = 0;
+            inserts = 0;
+            entries = 0;
+        }
+    };
+
+private:
+    struct slot {
+        uint64_t oid;
+        uint64_t xid;
+        uint64_t paddr;
+        uint64_t size;
+    };
+
+private:
+    mutable std::mutex _lock;
+    std::vector<slot>  _slots;
+    mutable stats      _stats;
+
+public:
+    omap_cache(size_t size = DEFAULT_SIZE);
+
+public:
+    void resize(size_t size);
+    void clear();
+
+public:
+    inline size_t get_size() const
+    { return _slots.size(); }
+    stats get_stats() const;
+
+public:
+    bool lookup(uint64_t oid, uint64_t xid, uint64_t &paddr,
+            uint64_t &size) const;
+    void insert(uint64_t oid, uint64_t xid, uint64_t paddr, uint64_t size);
+
+private:
+    inline size_t index_of(uint64_t oid, uint64_t xid) const
+    { return static_cast<size_t>(((oid ^ (xid << 32) ^ (xid >> 32)) *
+                UINT64_C(0x9e3779b97f4a7c15)) >> 32) % _slots.size(); }
+};
+
+}
+
+#endif  // !__nx_omap_cache_h
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2017-present Orlando Bassotto
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __nx_omap_index_h
+#define __nx_omap_index_h
+
+#include <cstddef>
+#include <cstdint>
+
+#include <vector>
+
+namespace nx {
+
+//
+// Flattened, read-only copy of an object map.
+//
+// The leaf entries are collected once with add() while traversing the
+// object map btree, finish() then lays the object ids out in Eytzinger
+// (BFS) order so that a lookup is a branch-light descent touching one
+// cache line per level instead of reading btree nodes.
+//
+// Like the btree lookup, the first translation found for an object id
+// (the one with the lowest xid) is the one retained.
+//
+class omap_index {
+private:
+    struct staged {
+        uint64_t oid;
+        uint64_t paddr;
+    };
+
+private:
+    std::vector<staged>   _staging;
+    std::vector<uint64_t> _oids;
+    std::vector<uint64_t> _paddrs;
+    bool                  _sorted;
+
+public:
+    omap_index();
+
+public:
+    void add(uint64_t oid, uint64_t paddr);
+    void finish();
+    void clear();
+
+public:
+    inline size_t size() const
+    { return _oids.empty() ? 0 : _oids.size() - 1; }
+    inline bool empty() const
+    { return size() == 0; }
+    inline size_t get_memory_size() const
+    { return (_oids.capacity() + _paddrs.capacity()) * sizeof(uint64_t); }
+
+public:
+    bool lookup(uint64_t oid, uint64_t &paddr) const;
+
+private:
+    size_t layout(size_t i, size_t k);
+};
+
+}
+
+#endif  // !__nx_omap_index_h
@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2017-present Orlando Bassotto
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef __nx_readahead_h
+#define __nx_readahead_h
+
+#include "nx/device.h"
+
+#include <cstddef>
+#include <cstdint>
+
+#include <functional>
+#include <memory>
+#include <mutex>
+
+namespace nx {
+
+//
+// Sequential readahead for a stream of reads, such as an open file or a
+// scan cursor.
+//
+// Blocks are addressed in the logical space of the stream and translated
+// to device runs by a mapper, or map one to one without. When the stream
+// is read sequentially the following blocks are fetched asynchronously,
+// through the I/O queue of the device, into a window that doubles each
+// time up to the readahead of the device; a read out of sequence shrinks
+// it back. A stream keeps at most depth runs in flight on the queue, which
+// is shared by all streams and batch reads of the device. Streams read
+// in-place data, so windows are private to the stream and never enter the
+// block cache, which holds verified metadata only.
+//
+// Mapped devices, and devices with the synchronous backend, are read
+// directly.
+//
+class readahead {
+public:
+    static size_t const MIN_WINDOW = 4;
+    static size_t const DEFAULT_DEPTH = 4;
+
+    //
+    // Maps a logical block to the device run starting with it, returns
+    // false past the end of the stream.
+    //
+    using mapper_type = std::function<bool(uint64_t block, uint64_t &lba,
+            size_t &count)>;
+
+    struct stats {
+        uint64_t reads;
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t windows;
+        uint64_t prefetched;
+        uint64_t wasted;
+
+        stats()
+        {
+            reads = 0;
+            hits = 0;
+            misses = 0;
+            windows = 0;
+            prefetched = 0;
+            wasted = 0;
+        }
+
+        inline double get_hit_rate() const
+        {
+            return (hits + misses) != 0
+                ? static_cast<double>(hits) / (hits + misses) : 0.0;
+        }
+    };
+
+private:
+    static size_t const MAX_RUNS = 16;
+
+    struct window {
+        uint64_t                   start;
+        size_t                     count;
+        size_t                     valid;
+        size_t                     used;
+        size_t                     nruns;
+        size_t                     submitted;
+        size_t                     capacity;
+        device::io_tracker         tracker;
+        std::unique_ptr<uint8_t[]> buffer;
+        io_queue::request          runs[MAX_RUNS];
+    };
+
+    device const      *_device;
+    mapper_type        _mapper;
+    size_t             _max_window;
+    size_t             _depth;
+    size_t             _window;
+    uint64_t           _next;
+    window             _windows[2];
+    bool               _queue_failed;
+    stats              _stats;
+    mutable std::mutex _lock;
+
+public:
+    readahead(device const *device, mapper_type const &mapper = nullptr,
+            size_t depth = DEFAULT_DEPTH);
+    ~readahead();
+
+    readahead(readahead const &) = delete;
+    readahead &operator=(readahead const &) = delete;
+
+public:
+    inline device const *get_device() const
+    { return _device; }
+    inline size_t get_max_window() const
+    { return _max_window; }
+
+    stats get_stats() const;
+
+public:
+    //
+    // Reads count blocks of the stream starting with block, nread is set
+    // to the number of blocks read. Returns false if not all blocks could
+    // be read.
+    //
+    bool read(uint64_t block, void *blocks, size_t count, size_t *nread);
+
+    //
+    // Drops the windows, waiting for their reads.
+    //
+    void reset();
+
+private:
+    bool map(uint64_t block, uint64_t &lba, size_t &count) const;
+    size_t read_direct(uint64_t block, uint8_t *blocks, size_t count);
+
+    window *find_window(uint64_t block);
+    window *free_window();
+    void prefetch();
+    void fetch(window &w, uint64_t start, size_t count);
+    void drop(window &w);
+    void wait(window &w);
+    void submit_pending();
+    void reap();
+    void fail();
+    void finish(window &w);
+
+    static inline size_t get_in_flight(window const &w)
+    { return w.tracker.pending.load(std::memory_order_acquire); }
+};
+
+}
+
+#endif  // !__nx_readahead_h
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2017-present Orlando Bassotto
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef __nx_scavenge_index_h
+#define __nx_scavenge_index_h
+
+#include "nx/format/nx.h"
+
+#include <cstddef>
+#include <cstdint>
+
+#include <functional>
+#include <vector>
+
+namespace nx {
+
+class device;
+
+//
+// An index of the objects found by a scan, saved next to an image so
+// that later queries need not read it again.
+//
+// Entries are kept in block order, along with two orders of the entries
+// by type and subtype, then by object id and transaction id, or by
+// transaction id and object id; all can be binary searched. A saved
+// index is mapped in memory when opened.
+//
+// Indexes are saved in host byte order. They record the identifier and
+// transaction of the superblock in block zero, so that an index of
+// another container, or of one written since, is refused.
+//
+class scavenge_index {
+public:
+    struct entry {
+        uint64_t paddr;
+        uint64_t oid;
+        uint64_t xid;
+        uint32_t type;
+        uint32_t subtype;
+        uint16_t flags;
+        uint16_t level;
+        uint32_t nkeys;
+    };
+
+    typedef std::function<bool(entry const &)> visitor_type;
+
+private:
+    struct header;
+
+    uint32_t              _block_size;
+    uint64_t              _block_count;
+    uint64_t              _start;
+    uint64_t              _end;
+    nx_uuid_t             _uuid;
+    uint64_t              _xid;
+    std::vector<entry>    _built;
+    std::vector<uint32_t> _built_orders;
+    std::vector<uint8_t>  _loaded;
+    void                 *_map;
+    size_t                _map_size;
+    entry const          *_entries;
+    uint32_t const       *_by_oid;
+    uint32_t const       *_by_xid;
+    size_t                _count;
+
+public:
+    scavenge_index();
+    ~scavenge_index();
+
+    scavenge_index(scavenge_index const &) = delete;
+    scavenge_index &operator=(scavenge_index const &) = delete;
+
+public:
+    //
+    // Starts a new index of the range of blocks of a device, objects are
+    // then added as they are found, in any order, and the index is saved
+    // once the scan ends.
+    //
+    void reset(device const *device, uint64_t start, uint64_t end);
+    bool add(uint64_t paddr, nx_object_t const *object);
+    bool save(char const *path);
+
+public:
+    //
+    // Opens a saved index, checking it against the device when given.
+    //
+    bool open(char const *path, device const *device = nullptr);
+    void close();
+
+public:
+    inline size_t size() const
+    { return _count; }
+    inline entry const &operator[](size_t index) const
+    { return _entries[index]; }
+    inline uint64_t get_start() const
+    { return _start; }
+    inline uint64_t get_end() const
+    { return _end; }
+
+public:
+    entry const *lookup(uint64_t paddr) const;
+
+    //
+    // Visits the objects of the given type, without storage flags, and
+    // subtype, with the given object id by increasing transaction id, or
+    // within a range of transaction ids by increasing transaction id.
+    //
+    void find_oid(uint32_t type, uint32_t subtype, uint64_t oid,
+            visitor_type const &visitor) const;
+    void find_xid(uint32_t type, uint32_t subtype, uint64_t min_xid,
+            uint64_t max_xid, visitor_type const &visitor) const;
+
+private:
+    bool identify(device const *device, nx_uuid_t &uuid,
+            uint64_t &xid) const;
+    void sort();
+    bool attach(uint8_t const *data, size_t size);
+};
+
+}
+
+#endif  // !__nx_scavenge_index_h
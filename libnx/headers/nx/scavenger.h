@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2017-present Orlando Bassotto
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef __nx_scavenger_h
+#define __nx_scavenger_h
+
+#include "nx/format/nx.h"
+#include "nx/space_map.h"
+
+#include <cstddef>
+#include <cstdint>
+
+#include <functional>
+
+namespace nx {
+
+class device;
+
+//
+// Scans a range of blocks of a device for valid objects.
+//
+// The range is read sequentially in large chunks, through the I/O backend
+// of the device, while a pool of threads verifies the chunks already
+// read. Objects found are passed to the callback on the calling thread,
+// in block order or, when the scan is unordered, a chunk at a time in
+// the order chunks are verified.
+//
+class scavenger {
+public:
+    static size_t const DEFAULT_CHUNK_SIZE = 256;
+
+    typedef std::function<bool(uint64_t, nx_object_t const *)> callback_type;
+
+    //
+    // Blocks scanned, out of the blocks to scan, and objects found so far,
+    // in elapsed seconds.
+    //
+    struct progress {
+        uint64_t start;
+        uint64_t end;
+        uint64_t blocks;
+        uint64_t scanned;
+        uint64_t objects;
+        double   elapsed;
+
+        progress()
+        {
+            start = 0;
+            end = 0;
+            blocks = 0;
+            scanned = 0;
+            objects = 0;
+            elapsed = 0;
+        }
+    };
+
+    typedef std::function<bool(progress const &)> progress_type;
+
+private:
+    device const             *_device;
+    uint64_t                  _start;
+    uint64_t                  _end;
+    size_t                    _threads;
+    size_t                    _chunk_size;
+    bool                      _ordered;
+    bool                      _filtered;
+    space_map::extent_vector  _extents;
+    progress_type             _progress;
+    double                    _progress_interval;
+
+public:
+    scavenger(device const *device);
+
+public:
+    //
+    // Blocks from start up to, but excluding, end are scanned; the whole
+    // device by default.
+    //
+    void set_range(uint64_t start, uint64_t end = static_cast<uint64_t>(-1));
+
+    //
+    // Only the blocks of the given extents, sorted by block, that lie in
+    // the range are scanned, e.g. the free extents of a space map when
+    // carving deleted objects.
+    //
+    void set_extents(space_map::extent_vector const &extents);
+    void clear_extents();
+
+    //
+    // Zero threads verify with one thread per processor.
+    //
+    void set_threads(size_t threads);
+    void set_chunk_size(size_t blocks);
+    inline void set_ordered(bool ordered)
+    { _ordered = ordered; }
+
+    //
+    // The progress callback is called on the calling thread at most once
+    // per interval and when the scan ends; returning false stops the scan.
+    //
+    void set_progress(progress_type const &callback, double interval = 1.0);
+
+public:
+    //
+    // Returns false if the range could not be read completely; a scan
+    // stopped by a callback succeeds.
+    //
+    bool run(callback_type const &callback) const;
+};
+
+}
+
+#endif  // !__nx_scavenger_h
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2017-present Orlando Bassotto
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __nx_space_map_h
+#define __nx_space_map_h
+
+#include <cstddef>
+#include <cstdint>
+
+#include <vector>
+
+namespace nx {
+
+//
+// Allocation state of the blocks of a container, as recorded by the
+// space manager bitmaps of a checkpoint.
+//
+// Runs of blocks are added in block order while the chunks are decoded,
+// runs adjacent to the previous one of the same state are merged, so the
+// map ends up as two sorted lists of maximal extents, the allocated and
+// the free ones, that together cover the blocks added.
+//
+class space_map {
+public:
+    struct extent {
+        uint64_t start;
+        uint64_t count;
+    };
+
+    typedef std::vector<extent> extent_vector;
+
+private:
+    extent_vector _allocated;
+    extent_vector _free;
+    uint64_t      _allocated_count;
+    uint64_t      _free_count;
+    uint64_t      _end;
+
+public:
+    space_map();
+
+public:
+    //
+    // Returns false if the run starts before the end of the previous one.
+    //
+    bool add(uint64_t start, uint64_t count, bool allocated);
+    void clear();
+
+public:
+    inline extent_vector const &get_allocated() const
+    { return _allocated; }
+    inline extent_vector const &get_free() const
+    { return _free; }
+    inline extent_vector const &get_extents(bool allocated) const
+    { return allocated ? _allocated : _free; }
+
+    inline uint64_t get_allocated_count() const
+    { return _allocated_count; }
+    inline uint64_t get_free_count() const
+    { return _free_count; }
+    inline uint64_t get_end() const
+    { return _end; }
+
+public:
+    //
+    // Blocks past the end of the map are reported as allocated.
+    //
+    bool is_allocated(uint64_t block) const;
+};
+
+}
+
+#endif  // !__nx_space_map_h
@@ -32,8 +32,10 @@ class enumerator;
 
 class volume : public object {
 private:
-    container *_owner;
-    apfs_fs_t *_super;
+    container          *_owner;
+    apfs_fs_t          *_super;
+    mutable omap_cache  _omap_cache;
+    omap_index          _omap_index;
 
 protected:
     friend class container;
@@ -74,18 +76,47 @@ public:
 
 public:
     enumerator *open_oid(uint64_t oid) const;
+    enumerator *open_oid(uint64_t oid, void const *key, size_t key_size,
+            bool floor = false) const;
     enumerator *open_root() const;
+    enumerator *open_file_extents(uint64_t oid, uint64_t offset) const;
+    enumerator *open_directory(uint64_t oid, uint32_t hash = 0) const;
+
+public:
+    typedef bool (*record_visitor_type)(void *, sized_value_type const &,
+            sized_value_type const &);
+
+    bool lookup_records(void const *key, size_t key_size,
+            record_visitor_type callback, void *opaque) const;
+
+public:
+    static int compare_keys(void const *a, size_t a_size, void const *b,
+            size_t b_size);
+    static std::function<int(void const *, size_t)> make_key_comparer(
+            void const *key, size_t key_size);
+
+private:
+    enumerator *open_oid(uint64_t oid,
+            std::function<int(void const *, size_t)> const &seek,
+            bool floor) const;
+
+private:
+    struct oid_mapper;
+    struct key_prefix_comparer;
 
 private:
     bool read_super(device *device, uint64_t lba, apfs_fs_t *&super);
+    void build_omap_index();
 
 private:
-    inline bool lookup_omap_oid(device *device, uint64_t oid, uint32_t type,
-            uint64_t &paddr, uint64_t &size) const
-    {
-        return object::lookup_omap_oid(device, nx::swap(_super->apfs_omap_oid),
-                oid, type, paddr, size);
-    }
+    bool lookup_omap_oid(device *device, uint64_t oid, uint32_t type,
+            uint64_t &paddr, uint64_t &size) const;
+
+public:
+    inline omap_cache::stats get_omap_cache_stats() const
+    { return _omap_cache.get_stats(); }
+    inline size_t get_omap_index_size() const
+    { return _omap_index.size(); }
 
 public:
     void traverse_omap(omap_traverser_type const &callback) const;
@@ -55,6 +55,11 @@ public:
 private:
     static bool static_callback(void *opaque, void const *key, size_t key_size,
             void const *val, size_t val_size);
+    static bool collect_callback(void *opaque, void const *key,
+            size_t key_size, void const *val, size_t val_size);
+
+private:
+    void prefetch(nx_btn_t const *btn);
 
 private:
     inline bool iterate(object::sized_value_type const &key,
@@ -0,0 +1,268 @@
+/*
+ * Copyright (c) 2017-present Orlando Bassotto
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "nx/block_cache.h"
+
+#include <algorithm>
+#include <new>
+
+using nx::block_cache;
+
+block_cache::block_cache()
+    : _block_size    (0)
+    , _capacity      (0)
+    , _a1in_capacity (0)
+    , _a1out_capacity(0)
+{
+}
+
+block_cache::~block_cache()
+{
+    clear();
+}
+
+void block_cache::
+configure(size_t block_size, size_t size)
+{
+    clear();
+
+    std::lock_guard<std::mutex> _(_lock);
+
+    _block_size = block_size;
+    _capacity   = (block_size != 0) ? size / block_size : 0;
+
+    //
+    // The 2Q paper suggests A1in to hold a quarter of the blocks and the
+    // ghost queue to remember as many addresses as half of the blocks.
+    //
+    _a1in_capacity  = std::max<size_t>(_capacity / 4, 1);
+    _a1out_capacity = _capacity / 2;
+}
+
+void block_cache::
+clear()
+{
+    std::lock_guard<std::mutex> _(_lock);
+
+    for (auto &i : _entries) {
+        auto e = i.second;
+        if (e->refs != 0) {
+            //
+            // Still pinned, detach the block so that the owner will free it.
+            //
+            e->block->cache = nullptr;
+            e->block->entry = nullptr;
+        } else {
+            delete[] reinterpret_cast<uint8_t *>(e->block);
+        }
+        delete e;
+    }
+
+    _entries.clear();
+    _a1in.clear();
+    _am.clear();
+    _a1out.clear();
+    _ghosts.clear();
+    _stats.resident = 0;
+    _stats.pinned = 0;
+}
+
+block_cache::stats block_cache::
+get_stats() const
+{
+    std::lock_guard<std::mutex> _(_lock);
+    return _stats;
+}
+
+void *block_cache::
+lookup(uint64_t lba)
+{
+    std::lock_guard<std::mutex> _(_lock);
+
+    if (_capacity == 0)
+        return nullptr;
+
+    auto i = _entries.find(lba);
+    if (i == _entries.end()) {
+        _stats.misses++;
+        return nullptr;
+    }
+
+    auto e = i->second;
+    if (e->refs++ == 0) {
+        _stats.pinned++;
+    }
+
+    //
+    // Hits in A1in are not promoted, a block must survive its time in the
+    // FIFO and be referenced again to enter Am.
+    //
+    if (e->queue == AM) {
+        _am.splice(_am.begin(), _am, e->position);
+    }
+
+    _stats.hits++;
+
+    return e->block + 1;
+}
+
+bool block_cache::
+insert(uint64_t lba, void *block)
+{
+    std::lock_guard<std::mutex> _(_lock);
+
+    if (_capacity == 0)
+        return false;
+
+    auto h = get_header(block);
+    if (h->cache != nullptr)
+        return false;
+
+    //
+    // Another reader may have inserted the same block meanwhile, in such
+    // case the block stays private to the caller.
+    //
+    if (_entries.find(lba) != _entries.end())
+        return false;
+
+    auto e = new (std::nothrow) entry;
+    if (e == nullptr)
+        return false;
+
+    e->lba   = lba;
+    e->block = h;
+    e->refs  = 1;
+
+    auto g = _ghosts.find(lba);
+    if (g != _ghosts.end()) {
+        _a1out.erase(g->second);
+        _ghosts.erase(g);
+
+        e->queue    = AM;
+        e->position = _am.insert(_am.begin(), e);
+    } else {
+        e->queue    = A1IN;
+        e->position = _a1in.insert(_a1in.begin(), e);
+    }
+
+    h->cache = this;
+    h->entry = e;
+
+    _entries[lba] = e;
+    _stats.inserts++;
+    _stats.resident++;
+    _stats.pinned++;
+
+    evict_unlocked();
+
+    return true;
+}
+
+void block_cache::
+release(header *h)
+{
+    std::lock_guard<std::mutex> _(_lock);
+
+    auto e = reinterpret_cast<entry *>(h->entry);
+    if (e == nullptr || e->refs == 0)
+        return;
+
+    if (--e->refs == 0) {
+        _stats.pinned--;
+        evict_unlocked();
+    }
+}
+
+void block_cache::
+evict_unlocked()
+{
+    while (_entries.size() > _capacity) {
+        bool evicted = false;
+
+        if (_a1in.size() > _a1in_capacity) {
+            evicted = evict_one_unlocked(_a1in);
+        }
+        if (!evicted) {
+            evicted = evict_one_unlocked(_am);
+        }
+        if (!evicted) {
+            evicted = evict_one_unlocked(_a1in);
+        }
+
+        //
+        // Everything is pinned, allow the cache to grow past its limit
+        // until the blocks are released.
+        //
+        if (!evicted)
+            break;
+    }
+}
+
+bool block_cache::
+evict_one_unlocked(queue_type_list &queue)
+{
+    for (auto i = queue.rbegin(); i != queue.rend(); ++i) {
+        auto e = *i;
+        if (e->refs != 0)
+            continue;
+
+        if (e->queue == A1IN) {
+            remember_unlocked(e->lba);
+        }
+
+        drop_unlocked(e);
+        _stats.evictions++;
+        return true;
+    }
+
+    return false;
+}
+
+void block_cache::
+remember_unlocked(uint64_t lba)
+{
+    if (_a1out_capacity == 0)
+        return;
+
+    while (_a1out.size() >= _a1out_capacity) {
+        _ghosts.erase(_a1out.back());
+        _a1out.pop_back();
+    }
+
+    _ghosts[lba] = _a1out.insert(_a1out.begin(), lba);
+}
+
+void block_cache::
+drop_unlocked(entry *e)
+{
+    if (e->queue == A1IN) {
+        _a1in.erase(e->position);
+    } else {
+        _am.erase(e->position);
+    }
+
+    _entries.erase(e->lba);
+    _stats.resident--;
+
+    delete[] reinterpret_cast<uint8_t *>(e->block);
+    delete e;
+}
@@ -24,6 +24,8 @@
 
 #include "nxcompat/nxcompat.h"
 
+#include <vector>
+
 using nx::btree_traverser;
 
 btree_traverser::btree_traverser(object *owner, device *device, nx_btn_t *root,
@@ -32,7 +34,7 @@ btree_traverser::btree_traverser(object *owner, device *device, nx_btn_t *root,
     : _owner    (owner)
     , _device   (device)
     , _root     (root)
-    , _stack    ([](btn_chidx &x) { device::free_block(x.first); })
+    , _stack    ([device](btn_chidx &x) { device->release_block(x.first); })
     , _callback (callback)
     , _mapper   (mapper)
     , _tree_type(tree_type)
@@ -46,6 +48,7 @@ traverse()
     // Starting from the root, call nx.c utility function.
     //
     _stack.push(std::make_pair(_root, 0));
+    prefetch(_root);
     ::nx_btn_traverse(_root, _root, static_callback, this);
     _stack.clear();
 }
@@ -112,6 +115,7 @@ iterate(object::sized_value_type const &key,
             return false;
 
         _stack.push(std::make_pair(btn, 0));
+        prefetch(btn);
         result = ::nx_btn_traverse(btn, _root, static_callback, this);
         _stack.pop();
     }
@@ -120,3 +124,76 @@ iterate(object::sized_value_type const &key,
 
     return result;
 }
+
+bool btree_traverser::
+collect_callback(void *opaque, void const *, size_t, void const *val,
+        size_t val_size)
+{
+    auto oids = reinterpret_cast<std::vector<uint64_t> *>(opaque);
+
+    if (val_size == sizeof(uint64_t)) {
+        oids->push_back(nx::swap(*reinterpret_cast<uint64_t const *>(val)));
+    }
+
+    return true;
+}
+
+void btree_traverser::
+prefetch(nx_btn_t const *btn)
+{
+    //
+    // The children of an index node are read in a single batch into the
+    // block cache before they are visited, so that an asynchronous backend
+    // keeps them all in flight. Nodes of mapped devices are used in place,
+    // and the synchronous backend would read them one by one anyway.
+    //
+    if (nx::swap(btn->btn_level) == 0 || _device->is_mapped() ||
+            _device->get_cache_size() == 0 ||
+            _device->get_io_backend() == io_queue::BACKEND_SYNC)
+        return;
+
+    std::vector<uint64_t> oids;
+    ::nx_btn_traverse(btn, _root, collect_callback, &oids);
+
+    std::vector<device::read_request> requests;
+    for (auto oid : oids) {
+        uint64_t lba = oid;
+        if (_mapper && !_mapper(oid, lba))
+            continue;
+
+        //
+        // Children already cached are not read again.
+        //
+        auto cached = _device->lookup_block<nx_btn_t>(lba);
+        if (cached != nullptr) {
+            _device->release_block(cached);
+            continue;
+        }
+
+        auto block = _device->new_block<nx_btn_t>();
+        if (block == nullptr)
+            break;
+
+        requests.push_back({ lba, 1, block, 0 });
+    }
+
+    if (requests.empty())
+        return;
+
+    _device->read_batch(requests.data(), requests.size());
+
+    //
+    // Children failing verification are left for the traversal to read
+    // and report.
+    //
+    for (auto &r : requests) {
+        auto block = reinterpret_cast<nx_btn_t *>(r.buffer);
+
+        if (r.nread == r.count &&
+                _device->verify_block(r.lba, &block->btn_o)) {
+            _device->cache_block(r.lba, block);
+        }
+
+        device::free_block(block);
+    }
+}
@@ -23,18 +23,28 @@
 #include "nx/container.h"
 #include "nx/volume.h"
 #include "nx/btree_traverser.h"
+#include "nx/scavenger.h"
 
 #include "nxcompat/nxcompat.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <map>
+#include <memory>
+#include <new>
+#include <thread>
+#include <vector>
 
 using nx::container;
 using nx::volume;
+using nx::space_map;
 
 container::container(nx::context *context)
     : object      (context)
-    , _main_super (nullptr)
-    , _tier2_super(nullptr)
+    , _main_super  (nullptr)
+    , _tier2_super (nullptr)
+    , _flatten_omap(false)
 {
 }
 
@@ -67,6 +77,10 @@ open(bool last_xid)
         return false;
     }
 
+    if (_flatten_omap) {
+        build_omap_index();
+    }
+
     return true;
 }
 
@@ -93,36 +107,48 @@ open_at(uint64_t xid)
         return false;
     }
 
+    if (_flatten_omap) {
+        build_omap_index();
+    }
+
     return true;
 }
 
 void container::
 close()
 {
-    if (_tier2_super != _main_super) {
-        nx::device::free_block(_tier2_super);
-    } else {
-        _tier2_super = nullptr;
-    }
-
+    //
+    // Each super holds its own reference, even when the block cache
+    // returned the same block for both.
+    //
+    nx::device::free_block(_tier2_super);
     nx::device::free_block(_main_super);
+
+    _omap_cache.clear();
+    _omap_index.clear();
+    _checkpoint_maps.clear();
 }
 
 bool container::
 read_super(device *device, uint64_t lba, nx_super_t *&super, bool quiet)
 {
-    super = device->new_block <nx_super_t> ();
-    if (super == nullptr) {
-        _context->log(severity::fatal, "not enough memory to allocate "
-                "nx super");
-        return false;
-    }
+    super = device->lookup_block <nx_super_t> (lba);
+
+    bool cached = (super != nullptr);
+    if (!cached) {
+        super = device->new_block <nx_super_t> ();
+        if (super == nullptr) {
+            _context->log(severity::fatal, "not enough memory to allocate "
+                    "nx super");
+            return false;
+        }
 
-    if (!device->read(lba, super, false)) {
-        _context->log(severity::fatal, "cannot read nx super at lba "
-                "%" PRIu64 ": %s", lba, ::strerror(errno));
-        nx::device::free_block(super);
-        return false;
+        if (!device->read(lba, super, false)) {
+            _context->log(severity::fatal, "cannot read nx super at lba "
+                    "%" PRIu64 ": %s", lba, ::strerror(errno));
+            nx::device::free_block(super);
+            return false;
+        }
     }
 
     if (nx::swap(super->nx_o.o_type) != NX_OBJECT_CPMAP_TYPE(CONTAINER)) {
@@ -143,6 +169,13 @@ read_super(device *device, uint64_t lba, nx_super_t *&super, bool quiet)
         return false;
     }
 
+    if (cached)
+        return true;
+
+    //
+    // Checkpoints are told apart by their checksums, so superblocks are
+    // always verified regardless of the device verification policy.
+    //
     if (!::nx_object_verify(&super->nx_o)) {
         if (!quiet) {
             _context->log(severity::error, "nx super verification failed, "
@@ -154,6 +187,8 @@ read_super(device *device, uint64_t lba, nx_super_t *&super, bool quiet)
         return false;
     }
 
+    device->cache_block(lba, super);
+
     return true;
 }
 
@@ -189,66 +224,166 @@ find_nearest(std::map<T,U> &map, T const &key)
         ? itlow : itprev;
 }
 
+//
+// Descriptor areas are verified by several threads when each can be given
+// at least this many blocks, smaller ones take less time to verify than
+// threads take to start.
+//
+static size_t const VERIFY_BLOCKS_PER_THREAD = 256;
+
+static void
+verify_blocks(uint8_t const *blocks, size_t block_size, size_t first,
+        size_t last, std::vector<uint8_t> &valid)
+{
+    for (size_t n = first; n < last; n++) {
+        auto object = reinterpret_cast<nx_object_t const *>(blocks +
+                n * block_size);
+
+        valid[n] = (object->o_checksum != 0 &&
+                object->o_checksum != UINT64_MAX &&
+                ::nx_object_verify(object));
+    }
+}
+
 bool container::
-find_tier2_super(device *device, uint64_t xid, bool equal, nx_super_t *&super)
+read_checkpoints(device *device, std::unique_ptr<uint8_t[]> &ring,
+        std::map<uint64_t, uint64_t> &supers)
 {
+    uint64_t main_xid = nx::swap(_main_super->nx_o.o_xid);
+    uint64_t first    = nx::swap(_main_super->nx_xp_desc_first);
+    uint32_t blocks   = nx::swap(_main_super->nx_xp_desc_blocks);
+
+    _checkpoint_maps.clear();
+
     //
-    // Read all super, we do so to allow broken apfs to be read from
-    // any checkpoint.
+    // nx_super.nx_xp_desc_blocks is a 31-bits value, if this value has
+    // the highest bit set, then the descriptors are fragmented, only the
+    // main super is a candidate then.
     //
-    uint64_t lba;
-    uint64_t main_xid  = nx::swap(_main_super->nx_o.o_xid);
-    uint64_t tier2_xid = main_xid;
-
-    std::map<uint64_t, uint64_t> tier2_super;
+    if ((blocks & 0x80000000) != 0) {
+        _context->log(severity::warning, "fragmented checkpoint descriptors "
+                "not supported");
+        return true;
+    }
 
-    // Initially the tier2 super is the same to main.
-    super = _main_super;
+    //
+    // Damaged super blocks may describe an area past the end of the
+    // device.
+    //
+    uint64_t count = device->get_block_count();
+    if (first >= count) {
+        blocks = 0;
+    } else if (blocks > count - first) {
+        blocks = static_cast<uint32_t>(count - first);
+    }
 
-    // Insert the main super.
-    tier2_super[nx::swap(super->nx_o.o_xid)] = 0;
+    size_t block_size = device->get_block_size();
 
-    for (; nx::swap(super->nx_xp_desc_next) != 0;) {
-        nx_super_t *new_super;
+    ring.reset(new (std::nothrow) uint8_t[static_cast<size_t>(blocks) *
+            block_size]);
+    if (!ring) {
+        _context->log(severity::fatal, "not enough memory to read the "
+                "checkpoint descriptors");
+        return false;
+    }
 
-        //
-        // Compute the next super in the checkpoint descriptors
-        //
-        if (super->nx_xp_desc_next == 0)
-            break;
+    //
+    // The whole descriptor area is read at once.
+    //
+    size_t nread = 0;
+    if (!device->read(first, ring.get(), blocks, &nread) || nread != blocks) {
+        _context->log(severity::warning, "cannot read checkpoint descriptors "
+                "at lba %" PRIu64 ", %" PRIuSIZE " of %" PRIu32 " blocks "
+                "read", first, nread, blocks);
+    }
 
-        uint32_t bidx = (nx::swap(super->nx_xp_desc_next) +
-                nx::swap(super->nx_xp_desc_len) - 1);
+    std::vector<uint8_t> valid(nread);
 
-        if (bidx >= nx::swap(super->nx_xp_desc_blocks))
-            break;
+    size_t threads = nread / VERIFY_BLOCKS_PER_THREAD;
+    if (threads > 1) {
+        threads = std::min<size_t>(threads,
+                std::thread::hardware_concurrency());
+    }
 
-        lba = nx::swap(super->nx_xp_desc_first) + bidx;
+    if (threads > 1) {
+        std::vector<std::thread> workers;
+        size_t                   share = (nread + threads - 1) / threads;
 
-        if (!read_super(device, lba, new_super, true))
-            break;
+        for (size_t n = 1; n < threads; n++) {
+            workers.emplace_back(verify_blocks, ring.get(), block_size,
+                    n * share, std::min(nread, (n + 1) * share),
+                    std::ref(valid));
+        }
+        verify_blocks(ring.get(), block_size, 0, share, valid);
 
-        // Release old super, if it's not the main.
-        if (super != _main_super) {
-            nx::device::free_block(super);
+        for (auto &worker : workers) {
+            worker.join();
         }
+    } else {
+        verify_blocks(ring.get(), block_size, 0, nread, valid);
+    }
+
+    for (size_t n = 0; n < nread; n++) {
+        if (!valid[n])
+            continue;
 
-        super = new_super;
+        auto     object = reinterpret_cast<nx_object_t const *>(ring.get() +
+                n * block_size);
+        uint64_t xid    = nx::swap(object->o_xid);
 
-        tier2_xid = nx::swap(super->nx_o.o_xid);
-        if (tier2_xid >= main_xid) {
-            _context->log(severity::warning, "found main xid %" PRIu64
-                    " inferior to tier2 xid %" PRIu64 ", ignoring",
-                    main_xid, tier2_xid);
-        }
+        if (nx::swap(object->o_type) == NX_OBJECT_CPMAP_TYPE(CONTAINER)) {
+            auto sb = reinterpret_cast<nx_super_t const *>(object);
+            if (nx::swap(sb->nx_signature) != NX_SUPER_SIGNATURE)
+                continue;
+
+            if (xid > main_xid) {
+                _context->log(severity::warning, "found main xid %" PRIu64
+                        " inferior to tier2 xid %" PRIu64, main_xid, xid);
+            }
 
-        tier2_super[tier2_xid] = lba;
+            supers[xid] = first + n;
+        } else if (nx::swap(object->o_type) ==
+                NX_OBJECT_DIRECT_TYPE(CHECKPOINT_MAP)) {
+            auto   cpm   = reinterpret_cast<nx_cpm_t const *>(object);
+            auto  &map   = _checkpoint_maps[xid];
+            size_t count = std::min<size_t>(nx::swap(cpm->cpm_count),
+                    (block_size - offsetof(nx_cpm_t, cpm_map)) /
+                    sizeof(nx_cpm_entry_t));
+
+            for (size_t i = 0; i < count; i++) {
+                nx_cpm_entry_t const *entry = &cpm->cpm_map[i];
+
+                map.push_back({ nx::swap(entry->cpm_oid),
+                        nx::swap(entry->cpm_type),
+                        nx::swap(entry->cpm_paddr),
+                        nx::swap(entry->cpm_size) });
+            }
+        }
     }
 
-    if (super != _main_super) {
-        nx::device::free_block(super);
+    for (auto &i : _checkpoint_maps) {
+        std::sort(i.second.begin(), i.second.end());
     }
 
+    return true;
+}
+
+bool container::
+find_tier2_super(device *device, uint64_t xid, bool equal, nx_super_t *&super)
+{
+    //
+    // Read all super, we do so to allow broken apfs to be read from
+    // any checkpoint.
+    //
+    std::map<uint64_t, uint64_t> tier2_super;
+    std::unique_ptr<uint8_t[]>   ring;
+
+    // Insert the main super.
+    tier2_super[nx::swap(_main_super->nx_o.o_xid)] = 0;
+
+    if (!read_checkpoints(device, ring, tier2_super))
+        return false;
+
     //
     // Find the tier2 super.
     //
@@ -265,12 +400,36 @@ find_tier2_super(device *device, uint64_t xid, bool equal, nx_super_t *&super)
         return false;
     }
 
-    tier2_xid = i->first;
-    if (!read_super(device, i->second, super, true))
-        return false;
+    uint64_t lba = i->second;
+
+    if (lba == 0) {
+        if (!read_super(device, lba, super, true))
+            return false;
+    } else {
+        //
+        // Super blocks of the descriptor area have been verified already,
+        // they are not read again.
+        //
+        super = device->lookup_block <nx_super_t> (lba);
+        if (super == nullptr) {
+            super = device->new_block <nx_super_t> ();
+            if (super == nullptr) {
+                _context->log(severity::fatal, "not enough memory to "
+                        "allocate nx super");
+                return false;
+            }
+
+            size_t block_size = device->get_block_size();
+            ::memcpy(super, ring.get() + (lba - nx::swap(
+                            _main_super->nx_xp_desc_first)) * block_size,
+                    block_size);
+
+            device->cache_block(lba, super);
+        }
+    }
 
     _context->log(severity::info, "selected checkpoint xid %" PRIu64,
-            tier2_xid);
+            i->first);
 
     return true;
 }
@@ -278,17 +437,22 @@ find_tier2_super(device *device, uint64_t xid, bool equal, nx_super_t *&super)
 bool container::
 read_cpm(device *device, uint64_t lba, nx_cpm_t *&cpm) const
 {
-    cpm = device->new_block <nx_cpm_t> ();
-    if (cpm == nullptr) {
-        _context->log(severity::fatal, "not enough memory to allocate cpm");
-        return false;
-    }
+    cpm = device->lookup_block <nx_cpm_t> (lba);
 
-    if (!device->read(lba, cpm, false)) {
-        _context->log(severity::fatal, "cannot read cpm at lba "
-                "%" PRIu64 ": %s", lba, ::strerror(errno));
-        nx::device::free_block(cpm);
-        return false;
+    bool cached = (cpm != nullptr);
+    if (!cached) {
+        cpm = device->new_block <nx_cpm_t> ();
+        if (cpm == nullptr) {
+            _context->log(severity::fatal, "not enough memory to allocate cpm");
+            return false;
+        }
+
+        if (!device->read(lba, cpm, false)) {
+            _context->log(severity::fatal, "cannot read cpm at lba "
+                    "%" PRIu64 ": %s", lba, ::strerror(errno));
+            nx::device::free_block(cpm);
+            return false;
+        }
     }
 
     if (nx::swap(cpm->cpm_o.o_type) != NX_OBJECT_DIRECT_TYPE(CHECKPOINT_MAP)) {
@@ -298,7 +462,10 @@ read_cpm(device *device, uint64_t lba, nx_cpm_t *&cpm) const
         return false;
     }
 
-    if (!::nx_object_verify(&cpm->cpm_o)) {
+    if (cached)
+        return true;
+
+    if (!device->verify_block(lba, &cpm->cpm_o)) {
         _context->log(severity::error, "cpm verification failed, "
                 "checksum mismatch (expected %#" PRIx64 ", got %#"
                 PRIx64 ")", nx::swap(cpm->cpm_o.o_checksum),
@@ -307,6 +474,8 @@ read_cpm(device *device, uint64_t lba, nx_cpm_t *&cpm) const
         return false;
     }
 
+    device->cache_block(lba, cpm);
+
     return true;
 }
 
@@ -328,6 +497,25 @@ lookup_checkpoint_oid(device *device, nx_super_t const *sb,
         return false;
     }
 
+    //
+    // The checkpoint maps read with the descriptor area at open time are
+    // looked up in memory, the descriptors are walked otherwise.
+    //
+    auto map = _checkpoint_maps.find(nx::swap(sb->nx_o.o_xid));
+    if (map != _checkpoint_maps.end()) {
+        auto i = std::lower_bound(map->second.begin(), map->second.end(),
+                checkpoint_object{ oid, type, 0, 0 });
+        if (i != map->second.end() && i->oid == oid && i->type == type) {
+            paddr = i->paddr;
+            size  = i->size;
+            return true;
+        }
+
+        _context->log(severity::warning, "cannot find oid %# " PRIx64
+                " type %#" PRIx32 " in checkpoint map", oid, type);
+        return false;
+    }
+
     for (size_t index = 0; index < nx::swap(sb->nx_xp_desc_len) - 1; index++) {
         uint64_t  lba;
 
@@ -372,6 +560,33 @@ lookup_checkpoint_oid(device *device, nx_super_t const *sb,
     return false;
 }
 
+bool container::
+lookup_omap_oid(device *device, nx_super_t const *sb, uint64_t oid,
+        uint32_t type, uint64_t &paddr, uint64_t &size) const
+{
+    uint64_t xid = nx::swap(sb->nx_o.o_xid);
+
+    //
+    // The index only holds the object map of the selected checkpoint,
+    // misses fall back to the btree.
+    //
+    if (sb == get_super() && _omap_index.lookup(oid, paddr)) {
+        size = get_block_size();
+        return true;
+    }
+
+    if (_omap_cache.lookup(oid, xid, paddr, size))
+        return true;
+
+    if (!object::lookup_omap_oid(device, nx::swap(sb->nx_omap_oid), oid,
+                type, paddr, size))
+        return false;
+
+    _omap_cache.insert(oid, xid, paddr, size);
+
+    return true;
+}
+
 volume *container::
 open_volume(size_t index) const
 {
@@ -441,46 +656,69 @@ traverse_omap(omap_traverser_type const &callback)
     device::free_block(omap);
 }
 
+void container::
+build_omap_index()
+{
+    auto start = std::chrono::steady_clock::now();
+
+    _omap_index.clear();
+    traverse_omap([this](uint32_t, uint32_t level, uint32_t,
+                nx_omap_key_t const &key, nx_omap_value_t const &value)
+            {
+                if (level == 0) {
+                    _omap_index.add(nx::swap(key.ok_oid),
+                            nx::swap(value.ov_oid));
+                }
+                return true;
+            });
+    _omap_index.finish();
+
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    _context->log(severity::info, "container object map index loaded, "
+            "%" PRIuSIZE " entries (%" PRIuSIZE " bytes) in %.3f ms",
+            _omap_index.size(), _omap_index.get_memory_size(),
+            elapsed.count());
+}
+
 void container::
 scavenge(std::function<bool(uint64_t, nx_object_t const *)> const &callback,
         uint64_t blockno) const
 {
-    bool stop = false;
-
     if (!callback)
         return;
 
-    auto device = _context->get_main_device();
-
-    auto object = device->new_block<nx_object_t>();
-    if (object == nullptr)
-        return;
+    scavenger scan(_context->get_main_device());
 
     if (blockno == static_cast<uint64_t>(-1)) {
-        blockno = 0;
-    } else {
-        stop = true;
+        scan.run(callback);
+        return;
     }
 
-    for (;; blockno++) {
-        if (!device->read(blockno, object, false))
-            break;
-
-        //
-        // Skip invalid objects.
-        //
-        if (object->o_checksum == 0 || object->o_checksum == UINT64_MAX)
-            continue;
+    //
+    // From a given block, only the first object found is passed.
+    //
+    scan.set_range(blockno);
+    scan.set_threads(1);
+    scan.run([&callback](uint64_t bno, nx_object_t const *object)
+            {
+                callback(bno, object);
+                return false;
+            });
+}
 
-        if (!::nx_object_verify(object))
-            continue;
+void container::
+scavenge(std::function<bool(uint64_t, nx_object_t const *)> const &callback,
+        space_map::extent_vector const &extents) const
+{
+    if (!callback)
+        return;
 
-        if (!callback(blockno, object))
-            break;
+    scavenger scan(_context->get_main_device());
 
-        if (stop)
-            break;
-    }
+    scan.set_extents(extents);
+    scan.run(callback);
 }
 
 bool container::
@@ -494,12 +732,19 @@ get_info(info &info) const
                 NX_OBJECT_TYPE_SPACEMAN, paddr, size))
         return false;
 
-    auto sm = device->new_block<nx_spaceman_t>();
-    if (sm == nullptr)
-        return false;
+    auto sm = device->lookup_block<nx_spaceman_t>(paddr);
+    if (sm == nullptr) {
+        sm = device->new_block<nx_spaceman_t>();
+        if (sm == nullptr)
+            return false;
 
-    if (!device->read(paddr, sm))
-        return false;
+        if (!device->read(paddr, sm)) {
+            device::free_block(sm);
+            return false;
+        }
+
+        device->cache_block(paddr, sm);
+    }
 
     info.blksize = get_block_size();
     info.blocks  = get_block_count();
@@ -519,3 +764,256 @@ get_info(info &info) const
 
     return true;
 }
+
+//
+// Adds the runs of a chunk bitmap, where a set bit marks an allocated
+// block, to the map.
+//
+static void
+add_bitmap_runs(space_map &map, uint64_t first, uint32_t count,
+        uint8_t const *bitmap)
+{
+    bool     allocated = (bitmap[0] & 1) != 0;
+    uint32_t start     = 0;
+    uint32_t n         = 0;
+
+    while (n < count) {
+        uint64_t word;
+
+        memcpy(&word, bitmap + (n / 64) * sizeof(word), sizeof(word));
+        word = nx::swap(word);
+
+        //
+        // Look for the first bit of the other state, whole words of the
+        // same state are skipped at once.
+        //
+        if (allocated) {
+            word = ~word;
+        }
+        word >>= n % 64;
+
+        if (word == 0) {
+            n += 64 - n % 64;
+            continue;
+        }
+
+        n += __builtin_ctzll(word);
+        if (n >= count)
+            break;
+
+        map.add(first + start, n - start, allocated);
+        start     = n;
+        allocated = !allocated;
+    }
+
+    map.add(first + start, count - start, allocated);
+}
+
+bool container::
+load_cib(device *device, uint64_t paddr, uint32_t blocks_per_chunk,
+        space_map &map) const
+{
+    size_t block_size = device->get_block_size();
+
+    auto cib = device->new_block<nx_cib_t>();
+    if (cib == nullptr)
+        return false;
+
+    if (!device->read(paddr, cib) ||
+            NX_OBJECT_GET_TYPE(nx::swap(cib->cib_o.o_type)) !=
+            NX_OBJECT_TYPE_CIB) {
+        _context->log(severity::error, "cannot read chunk information "
+                "block at %#" PRIx64, paddr);
+        device::free_block(cib);
+        return false;
+    }
+
+    uint32_t count = nx::swap(cib->cib_count);
+    if (count > (block_size - offsetof(nx_cib_t, cib_map)) /
+            sizeof(nx_cib_entry_t)) {
+        _context->log(severity::error, "chunk information block at %#"
+                PRIx64 " has too many entries (%" PRIu32 ")", paddr, count);
+        device::free_block(cib);
+        return false;
+    }
+
+    //
+    // Chunks entirely free or entirely allocated are known from their
+    // counts, the bitmaps of the others are read in a single batch.
+    //
+    std::vector<device::read_request> requests;
+    for (uint32_t n = 0; n < count; n++) {
+        nx_cib_entry_t const *entry = &cib->cib_map[n];
+        uint32_t blocks = nx::swap(entry->cib_size) & NX_CIB_SIZE_MASK;
+        uint32_t bfree  = nx::swap(entry->cib_unknown_x10);
+
+        if (entry->cib_chunk != 0 && bfree != 0 && bfree < blocks) {
+            requests.push_back({ nx::swap(entry->cib_chunk), 1, nullptr, 0 });
+        }
+    }
+
+    std::unique_ptr<uint8_t[]> bitmaps;
+    if (!requests.empty()) {
+        bitmaps.reset(new (std::nothrow) uint8_t[requests.size() *
+                block_size]);
+        if (!bitmaps) {
+            device::free_block(cib);
+            return false;
+        }
+
+        for (size_t n = 0; n < requests.size(); n++) {
+            requests[n].buffer = bitmaps.get() + n * block_size;
+        }
+
+        if (!device->read_batch(requests.data(), requests.size())) {
+            _context->log(severity::error, "cannot read the chunk bitmaps "
+                    "of chunk information block at %#" PRIx64, paddr);
+            device::free_block(cib);
+            return false;
+        }
+    }
+
+    bool   ok     = true;
+    size_t bitmap = 0;
+    for (uint32_t n = 0; n < count && ok; n++) {
+        nx_cib_entry_t const *entry = &cib->cib_map[n];
+        uint64_t first  = nx::swap(entry->cib_paddr);
+        uint32_t blocks = nx::swap(entry->cib_size) & NX_CIB_SIZE_MASK;
+        uint32_t bfree  = nx::swap(entry->cib_unknown_x10);
+
+        if (first != map.get_end() || blocks > blocks_per_chunk ||
+                bfree > blocks) {
+            _context->log(severity::error, "chunk %" PRIu32 " of chunk "
+                    "information block at %#" PRIx64 " is inconsistent",
+                    n, paddr);
+            ok = false;
+        } else if (entry->cib_chunk == 0 || bfree == blocks) {
+            ok = map.add(first, blocks, false);
+        } else if (bfree == 0) {
+            ok = map.add(first, blocks, true);
+        } else {
+            add_bitmap_runs(map, first, blocks,
+                    bitmaps.get() + bitmap++ * block_size);
+        }
+    }
+
+    device::free_block(cib);
+
+    return ok;
+}
+
+bool container::
+load_space_map(space_map &map) const
+{
+    uint64_t paddr, size;
+    auto     device = get_main_device();
+    auto     super  = get_main_super();
+
+    map.clear();
+
+    if (!lookup_checkpoint_oid(device, super, nx::swap(super->nx_spaceman_oid),
+                NX_OBJECT_TYPE_SPACEMAN, paddr, size))
+        return false;
+
+    //
+    // The space manager may span several blocks, the addresses of its
+    // chunk information (or allocation) blocks follow the fixed part.
+    //
+    size_t block_size = device->get_block_size();
+    size_t nblocks    = std::max<uint64_t>((size + block_size - 1) /
+            block_size, 1);
+
+    std::unique_ptr<uint8_t[]> buffer(new (std::nothrow) uint8_t[nblocks *
+            block_size]);
+    if (!buffer)
+        return false;
+
+    size_t nread = 0;
+    if (!device->read(paddr, buffer.get(), nblocks, &nread) ||
+            nread != nblocks || size < sizeof(nx_spaceman_t) ||
+            !::nx_checksum_verify(buffer.get(), size)) {
+        _context->log(severity::error, "cannot read space manager at %#"
+                PRIx64, paddr);
+        return false;
+    }
+
+    auto sm = reinterpret_cast<nx_spaceman_t const *>(buffer.get());
+
+    uint32_t blocks_per_chunk = nx::swap(sm->sm_blocks_per_chunk);
+    uint32_t cib_count        = nx::swap(sm->sm_cib_count);
+    uint32_t cab_count        = nx::swap(sm->sm_cab_count);
+    uint32_t addr_offset      = static_cast<uint32_t>(
+            nx::swap(sm->sm_unknown_x50));
+    uint32_t addr_count       = (cab_count != 0) ? cab_count : cib_count;
+
+    if (blocks_per_chunk == 0 || blocks_per_chunk > block_size * 8 ||
+            addr_offset > size ||
+            addr_count > (size - addr_offset) / sizeof(uint64_t)) {
+        _context->log(severity::error, "space manager at %#" PRIx64
+                " is inconsistent", paddr);
+        return false;
+    }
+
+    auto addrs = reinterpret_cast<uint64_t const *>(buffer.get() +
+            addr_offset);
+
+    //
+    // Large containers have one more level, allocation blocks listing
+    // the chunk information blocks.
+    //
+    bool ok = true;
+    if (cab_count == 0) {
+        for (uint32_t n = 0; n < cib_count && ok; n++) {
+            ok = load_cib(device, nx::swap(addrs[n]), blocks_per_chunk, map);
+        }
+    } else {
+        auto cab = device->new_block<nx_cab_t>();
+        if (cab == nullptr)
+            return false;
+
+        size_t max_cibs = (block_size - offsetof(nx_cab_t, cab_map)) /
+            sizeof(uint64_t);
+
+        for (uint32_t n = 0; n < cab_count && ok; n++) {
+            uint64_t cab_paddr = nx::swap(addrs[n]);
+
+            if (!device->read(cab_paddr, cab) ||
+                    NX_OBJECT_GET_TYPE(nx::swap(cab->cab_o.o_type)) !=
+                    NX_OBJECT_TYPE_CAB ||
+                    nx::swap(cab->cab_count) > max_cibs) {
+                _context->log(severity::error, "cannot read chunk "
+                        "allocation block at %#" PRIx64, cab_paddr);
+                ok = false;
+                break;
+            }
+
+            for (uint32_t i = 0; i < nx::swap(cab->cab_count) && ok; i++) {
+                ok = load_cib(device, nx::swap(cab->cab_map[i]),
+                        blocks_per_chunk, map);
+            }
+        }
+
+        device::free_block(cab);
+    }
+
+    if (!ok) {
+        map.clear();
+        return false;
+    }
+
+    if (map.get_end() != nx::swap(sm->sm_block_count)) {
+        _context->log(severity::error, "space manager chunks cover %"
+                PRIu64 " of %" PRIu64 " blocks", map.get_end(),
+                nx::swap(sm->sm_block_count));
+        map.clear();
+        return false;
+    }
+
+    if (map.get_free_count() != nx::swap(sm->sm_free_count)) {
+        _context->log(severity::warning, "space manager bitmaps have %"
+                PRIu64 " free blocks, %" PRIu64 " expected",
+                map.get_free_count(), nx::swap(sm->sm_free_count));
+    }
+
+    return true;
+}
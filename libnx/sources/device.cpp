@@ -29,9 +29,25 @@
 using nx::device;
 
 device::device()
-    : _fd         (-1)
-    , _block_size (0)
-    , _block_count(0)
+    : _fd           (-1)
+    , _block_size   (0)
+    , _block_count  (0)
+    , _cache_size   (DEFAULT_CACHE_SIZE)
+    , _map_enabled  (false)
+    , _map          (nullptr)
+    , _map_size     (0)
+    , _verify_policy(VERIFY_ALWAYS)
+    , _verified     (0)
+    , _skipped      (0)
+    , _failed       (0)
+    , _coalesce_gap (DEFAULT_COALESCE_GAP)
+    , _read_requests(0)
+    , _read_calls   (0)
+    , _read_blocks  (0)
+    , _io_backend   (io_queue::BACKEND_SYNC)
+    , _io_depth     (io_queue::DEFAULT_DEPTH)
+    , _io_failed    (false)
+    , _readahead    (DEFAULT_READAHEAD)
 {
 }
 
@@ -87,6 +103,18 @@ open(char const *device, size_t block_size)
     _block_size = block_size;
     _fd = fd;
 
+    //
+    // Only image files are mapped, devices are always read.
+    //
+    if (_map_enabled && S_ISREG(stbuf.st_mode)) {
+        map(fd, stbuf.st_size);
+    }
+
+    _cache.configure(_block_size, _cache_size);
+    reset_verified_map();
+    reset_gap_buffer();
+    reset_io_queue();
+
     return true;
 }
 
@@ -96,12 +124,167 @@ close()
     if (_fd < 0)
         return;
 
+    _io_queue.close();
+    _cache.clear();
+    _verified_map.reset();
+    _gap_buffer.reset();
+    unmap();
+
     ::close(_fd);
     _fd = -1;
     _block_size = 0;
     _block_count = 0;
 }
 
+void device::
+set_cache_size(size_t size)
+{
+    _cache_size = size;
+    if (_fd >= 0) {
+        _cache.configure(_block_size, _cache_size);
+    }
+}
+
+void device::
+set_mapping_enabled(bool enabled)
+{
+    _map_enabled = enabled;
+}
+
+bool device::
+map(int fd, uint64_t size)
+{
+#ifdef HAVE_SYS_MMAN_H
+    if (size == 0 || size > SIZE_MAX)
+        return false;
+
+    void *map = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        return false;
+
+    _map      = reinterpret_cast<uint8_t *>(map);
+    _map_size = size;
+
+    //
+    // Metadata is mostly looked up at random.
+    //
+    advise(ACCESS_RANDOM);
+
+    return true;
+#else
+    (void)fd;
+    (void)size;
+    return false;
+#endif
+}
+
+void device::
+unmap()
+{
+#ifdef HAVE_SYS_MMAN_H
+    if (_map != nullptr) {
+        ::munmap(_map, _map_size);
+    }
+#endif
+    _map      = nullptr;
+    _map_size = 0;
+}
+
+void device::
+advise(access_pattern pattern) const
+{
+#ifdef HAVE_SYS_MMAN_H
+    int advice;
+
+    if (_map == nullptr)
+        return;
+
+    switch (pattern) {
+        case ACCESS_SEQUENTIAL:
+            advice = POSIX_MADV_SEQUENTIAL;
+            break;
+        case ACCESS_RANDOM:
+            advice = POSIX_MADV_RANDOM;
+            break;
+        default:
+            advice = POSIX_MADV_NORMAL;
+            break;
+    }
+
+    ::posix_madvise(_map, _map_size, advice);
+#else
+    (void)pattern;
+#endif
+}
+
+void device::
+set_verify_policy(verify_policy policy)
+{
+    _verify_policy = policy;
+    if (_fd >= 0) {
+        reset_verified_map();
+    }
+}
+
+device::verify_stats device::
+get_verify_stats() const
+{
+    verify_stats stats;
+
+    stats.verified = _verified.load(std::memory_order_relaxed);
+    stats.skipped  = _skipped.load(std::memory_order_relaxed);
+    stats.failed   = _failed.load(std::memory_order_relaxed);
+
+    return stats;
+}
+
+void device::
+reset_verified_map()
+{
+    //
+    // One bit per block, 32 MiB for a 1 TiB container of 4 KiB blocks.
+    //
+    if (_verify_policy == VERIFY_ONCE) {
+        _verified_map.reset(new (std::nothrow)
+                counter_type[(_block_count + 63) / 64]());
+    } else {
+        _verified_map.reset();
+    }
+}
+
+bool device::
+verify_block(uint64_t lba, nx_object_t const *object) const
+{
+    counter_type *word = nullptr;
+    uint64_t      bit  = 0;
+
+    if (_verify_policy == VERIFY_TRUST) {
+        _skipped.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    if (_verified_map && lba < _block_count) {
+        word = &_verified_map[lba / 64];
+        bit  = 1ULL << (lba % 64);
+        if (word->load(std::memory_order_relaxed) & bit) {
+            _skipped.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    if (!::nx_object_verify(object)) {
+        _failed.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    _verified.fetch_add(1, std::memory_order_relaxed);
+    if (word != nullptr) {
+        word->fetch_or(bit, std::memory_order_relaxed);
+    }
+
+    return true;
+}
+
 bool device::
 read(uint64_t lba, void *blocks, size_t count, size_t *nread) const
 {
@@ -133,10 +316,21 @@ read(uint64_t lba, void *blocks, size_t count, size_t *nread) const
         return false;
     }
 
-    read_count = ::pread(_fd, blocks, count * (uint64_t)_block_size,
-            lba * (uint64_t)_block_size);
-    if (read_count < 0)
-        return false;
+    _read_requests.fetch_add(1, std::memory_order_relaxed);
+
+    if (_map != nullptr) {
+        read_count = count * (uint64_t)_block_size;
+        ::memcpy(blocks, _map + lba * (uint64_t)_block_size, read_count);
+    } else {
+        _read_calls.fetch_add(1, std::memory_order_relaxed);
+        read_count = ::pread(_fd, blocks, count * (uint64_t)_block_size,
+                lba * (uint64_t)_block_size);
+        if (read_count < 0)
+            return false;
+    }
+
+    _read_blocks.fetch_add(read_count / _block_size,
+            std::memory_order_relaxed);
 
     if (nread == nullptr) {
         if (read_count != (ssize_t)(count * (uint64_t)_block_size)) {
@@ -149,3 +343,390 @@ read(uint64_t lba, void *blocks, size_t count, size_t *nread) const
 
     return true;
 }
+
+void device::
+set_coalesce_gap(size_t blocks)
+{
+    _coalesce_gap = blocks;
+    if (_fd >= 0) {
+        reset_gap_buffer();
+    }
+}
+
+void device::
+reset_gap_buffer()
+{
+    //
+    // Blocks between coalesced requests are all read here and discarded.
+    //
+    if (_coalesce_gap != 0) {
+        _gap_buffer.reset(new (std::nothrow)
+                uint8_t[_coalesce_gap * _block_size]);
+    } else {
+        _gap_buffer.reset();
+    }
+}
+
+device::read_stats device::
+get_read_stats() const
+{
+    read_stats stats;
+
+    stats.requests = _read_requests.load(std::memory_order_relaxed);
+    stats.calls    = _read_calls.load(std::memory_order_relaxed);
+    stats.blocks   = _read_blocks.load(std::memory_order_relaxed);
+
+    return stats;
+}
+
+bool device::
+read_batch(read_request *requests, size_t count) const
+{
+    if (_fd < 0) {
+        errno = EBADF;
+        return false;
+    }
+
+    for (size_t n = 0; n < count; n++) {
+        auto &r = requests[n];
+
+        r.nread = 0;
+        if (r.count == 0)
+            continue;
+
+        if (r.buffer == nullptr) {
+            errno = EFAULT;
+            return false;
+        }
+
+        if (r.lba >= _block_count || r.count > _block_count - r.lba) {
+            errno = E2BIG;
+            return false;
+        }
+    }
+
+    if (count > 1 && open_io_queue())
+        return read_queued(requests, count);
+
+#ifdef HAVE_PREADV
+    static size_t const MAX_IOVECS = 64;
+    static size_t const MAX_INLINE = 32;
+
+    if (_map == nullptr && count > 1) {
+        //
+        // Order the requests by block, most batches are small enough to be
+        // ordered on the stack.
+        //
+        read_request                    *inline_order[MAX_INLINE];
+        std::unique_ptr<read_request *[]> heap_order;
+        read_request                   **order = inline_order;
+
+        if (count > MAX_INLINE) {
+            heap_order.reset(new (std::nothrow) read_request *[count]);
+            if (!heap_order) {
+                errno = ENOMEM;
+                return false;
+            }
+            order = heap_order.get();
+        }
+
+        for (size_t n = 0; n < count; n++) {
+            order[n] = &requests[n];
+        }
+
+        std::sort(order, order + count,
+                [](read_request const *a, read_request const *b)
+                { return a->lba < b->lba; });
+
+        bool result = true;
+
+        for (size_t n = 0; n < count; ) {
+            struct iovec iov[MAX_IOVECS];
+            size_t       niov  = 0;
+            size_t       first = n;
+            uint64_t     lba   = 0;
+            uint64_t     end   = 0;
+
+            //
+            // Gather the requests that follow without overlapping and
+            // within the coalescing gap.
+            //
+            for (; n < count && niov + 2 <= MAX_IOVECS; n++) {
+                auto r = order[n];
+                if (r->count == 0)
+                    continue;
+
+                if (niov == 0) {
+                    lba = r->lba;
+                } else {
+                    if (r->lba < end || r->lba - end > _coalesce_gap)
+                        break;
+
+                    if (r->lba > end) {
+                        if (!_gap_buffer)
+                            break;
+
+                        iov[niov].iov_base = _gap_buffer.get();
+                        iov[niov].iov_len  = (r->lba - end) * _block_size;
+                        niov++;
+                    }
+                }
+
+                iov[niov].iov_base = r->buffer;
+                iov[niov].iov_len  = r->count * _block_size;
+                niov++;
+
+                end = r->lba + r->count;
+            }
+
+            if (niov == 0)
+                continue;
+
+            _read_requests.fetch_add(n - first, std::memory_order_relaxed);
+            _read_calls.fetch_add(1, std::memory_order_relaxed);
+
+            ssize_t length = (end - lba) * _block_size;
+            if (::preadv(_fd, iov, niov, lba * _block_size) == length) {
+                _read_blocks.fetch_add(end - lba, std::memory_order_relaxed);
+                for (size_t k = first; k < n; k++) {
+                    order[k]->nread = order[k]->count;
+                }
+                continue;
+            }
+
+            //
+            // Short or failed read, retry request by request.
+            //
+            for (size_t k = first; k < n; k++) {
+                auto r = order[k];
+                if (r->count != 0 &&
+                        (!read(r->lba, r->buffer, r->count, &r->nread) ||
+                         r->nread != r->count)) {
+                    result = false;
+                }
+            }
+        }
+
+        return result;
+    }
+#endif
+
+    bool result = true;
+
+    for (size_t n = 0; n < count; n++) {
+        auto &r = requests[n];
+        if (r.count != 0 &&
+                (!read(r.lba, r.buffer, r.count, &r.nread) ||
+                 r.nread != r.count)) {
+            result = false;
+        }
+    }
+
+    return result;
+}
+
+void device::
+set_io_backend(io_queue::backend_type type, size_t depth)
+{
+    _io_backend = type;
+    _io_depth   = depth;
+    if (_fd >= 0) {
+        reset_io_queue();
+    }
+}
+
+void device::
+reset_io_queue()
+{
+    std::lock_guard<std::mutex> _(_io_lock);
+
+    _io_queue.close();
+    _io_failed = false;
+}
+
+//
+// Opens the queue on first use rather than with the device: the mount
+// tools open the device before daemonizing, and the threads of the queue
+// would not survive the fork.
+//
+bool device::
+open_io_queue() const
+{
+    //
+    // Synchronous reads need no queue, mapped devices are not read.
+    //
+    if (_io_backend == io_queue::BACKEND_SYNC || _map != nullptr)
+        return false;
+
+    std::lock_guard<std::mutex> _(_io_lock);
+
+    if (_io_queue.get_depth() == 0 && !_io_failed) {
+        _io_failed = !_io_queue.open(this, _io_backend, _io_depth);
+    }
+
+    return (_io_queue.get_depth() != 0 && !_io_failed);
+}
+
+bool device::
+read_queued(read_request *requests, size_t count) const
+{
+    static size_t const MAX_INLINE = 32;
+
+    io_queue::request                    inline_queued[MAX_INLINE];
+    std::unique_ptr<io_queue::request[]> heap_queued;
+    io_queue::request                   *queued = inline_queued;
+
+    if (count > MAX_INLINE) {
+        heap_queued.reset(new (std::nothrow) io_queue::request[count]);
+        if (!heap_queued) {
+            errno = ENOMEM;
+            return false;
+        }
+        queued = heap_queued.get();
+    }
+
+    size_t nqueued = 0;
+    for (size_t n = 0; n < count; n++) {
+        auto &r = requests[n];
+        if (r.count == 0)
+            continue;
+
+        auto &q = queued[nqueued++];
+        q.lba    = r.lba;
+        q.count  = r.count;
+        q.buffer = r.buffer;
+        q.nread  = 0;
+        q.error  = 0;
+    }
+
+    io_tracker tracker;
+    size_t     next = 0;
+
+    //
+    // Keep as many requests in flight as the queue takes, reaping any as
+    // it fills up.
+    //
+    while (next < nqueued) {
+        next += submit_queued(queued + next, nqueued - next, tracker);
+        if (next == nqueued || errno != EAGAIN)
+            break;
+
+        reap_queued(true);
+    }
+
+    wait_queued(tracker);
+
+    //
+    // Requests not submitted, and short reads, are read synchronously.
+    //
+    bool   result = true;
+    size_t m      = 0;
+
+    for (size_t n = 0; n < count; n++) {
+        auto &r = requests[n];
+        if (r.count == 0)
+            continue;
+
+        r.nread = (m < next) ? queued[m].nread : 0;
+        m++;
+
+        if (r.nread != r.count &&
+                (!read(r.lba, r.buffer, r.count, &r.nread) ||
+                 r.nread != r.count)) {
+            result = false;
+        }
+    }
+
+    return result;
+}
+
+//
+// Submits up to count requests, returns the number submitted with errno
+// set when not all of them were.
+//
+size_t device::
+submit_queued(io_queue::request *requests, size_t count,
+        io_tracker &tracker) const
+{
+    std::lock_guard<std::mutex> _(_io_lock);
+
+    size_t n     = 0;
+    int    error = 0;
+
+    if (_io_failed) {
+        errno = EIO;
+        return 0;
+    }
+
+    for (; n < count; n++) {
+        auto &r = requests[n];
+
+        r.opaque = &tracker;
+        tracker.pending.fetch_add(1, std::memory_order_relaxed);
+        if (!_io_queue.submit(&r)) {
+            tracker.pending.fetch_sub(1, std::memory_order_relaxed);
+            error = errno;
+
+            //
+            // A queue refusing a request while none is in flight failed,
+            // later batches are read synchronously.
+            //
+            if (error != EAGAIN || _io_queue.get_in_flight() == 0) {
+                _io_failed = true;
+            }
+            break;
+        }
+    }
+
+    _io_queue.flush();
+
+    errno = error;
+    return n;
+}
+
+//
+// Reaps completed requests of any batch, crediting them to their tracker.
+//
+size_t device::
+reap_queued(bool wait) const
+{
+    std::lock_guard<std::mutex> _(_io_lock);
+
+    if (_io_queue.get_in_flight() == 0)
+        return 0;
+
+    io_queue::request *done[16];
+    size_t             ndone = _io_queue.complete(done, 16, wait);
+
+    for (size_t n = 0; n < ndone; n++) {
+        auto tracker = reinterpret_cast<io_tracker *>(done[n]->opaque);
+        tracker->pending.fetch_sub(1, std::memory_order_release);
+    }
+
+    //
+    // A queue that cannot reap would be waited on forever.
+    //
+    if (ndone == 0 && wait) {
+        _io_failed = true;
+    }
+
+    return ndone;
+}
+
+//
+// Waits for the requests of a batch, completing those of other batches
+// meanwhile. Returns false if the queue failed before they were reaped.
+//
+bool device::
+wait_queued(io_tracker const &tracker) const
+{
+    while (tracker.pending.load(std::memory_order_acquire) != 0) {
+        if (reap_queued(true) == 0 &&
+                tracker.pending.load(std::memory_order_acquire) != 0) {
+            errno = EIO;
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -36,9 +36,11 @@ enumerator::enumerator(object *owner, device *device, uint64_t root_lba,
     , _owner    (owner)
     , _device   (device)
     , _root     (nullptr)
-    , _stack    ([](node_type &node) { device::free_block(node.first); })
+    , _stack    ([device](node_type &node)
+                 { device->release_block(node.first); })
     , _mapper   (mapper)
     , _compare  (comparer)
+    , _floor    (false)
     , _end      (false)
 {
     if (!_compare) {
@@ -114,6 +116,37 @@ is_index_node_valid(btn_kvinfo_t const &kvi) const
     return true;
 }
 
+int enumerator::
+compare_key(void *opaque, void const *key, size_t key_size)
+{
+    auto self = reinterpret_cast<enumerator const *>(opaque);
+
+    if (self->_seek)
+        return self->_seek(key, key_size);
+
+    if (key_size < sizeof(uint64_t))
+        return -1;
+
+    return self->_compare(nx::swap(*reinterpret_cast<uint64_t const *>(key)),
+            self->_oid);
+}
+
+bool enumerator::
+lower_bound(nx_btn_t const *node, size_t first, size_t &index) const
+{
+    uint32_t n;
+
+    if (!::nx_btn_lower_bound(node, _root, static_cast<uint32_t>(first),
+                compare_key, const_cast<enumerator *>(this), &n)) {
+        _owner->get_context()->log(severity::error,
+                "failed searching btree node, invalid table of contents");
+        return false;
+    }
+
+    index = n;
+    return true;
+}
+
 bool enumerator::
 reset()
 {
@@ -128,99 +161,140 @@ reset()
         return false;
 
     //
-    // Now traverse the tree to the first leaf matching oid.
+    // Now traverse the tree to the first leaf matching oid, or, when
+    // seeking, to the first key not less than the seek key (the last
+    // key not greater than it, for a floor seek).
+    //
+    // The node being searched is never on the stack, its parents are.
     //
 
-    nx_btn_t *node;
-    nx_btn_t *next_node;
+    nx_btn_t *node  = _root;
     size_t    index = 0;
-    for (node = _root;;) {
+    bool      leaf  = false;
+    for (;;) {
         //
         // Ensure it's maching the specs.
         //
         if (!check_node(node))
             goto fail;
 
+        btn_kvinfo_t    kvi;
         uint64_t const *key;
         uint64_t const *val;
-        uint64_t const *next_key;
-        uint64_t const *next_val;
+        size_t          nkeys = nx::swap(node->btn_nkeys);
+        size_t          n;
 
-        for (size_t n = index; n < nx::swap(node->btn_nkeys); n++) {
-            btn_kvinfo_t kvi;
-            uint64_t     oid;
-            uint64_t     next_oid = INT64_MAX;
-            bool         at_eot   = (n + 1 >= nx::swap(node->btn_nkeys));
+        leaf = (node->btn_level == 0);
+
+        //
+        // Find the first key not less than oid.
+        //
+        if (!lower_bound(node, index, n))
+            goto fail;
 
+        //
+        // When seeking, keys are unique: an exact match is where to go,
+        // anything else is preceded by the key we are looking for.
+        //
+        bool exact = false;
+        if (_seek && n < nkeys) {
             if (!fetch_node_kv(node, n, &kvi,
                         reinterpret_cast<void const **>(&key),
                         reinterpret_cast<void const **>(&val)))
                 goto fail;
 
-            oid = nx::swap(*key);
+            exact = (_seek(key, kvi.key_size) == 0);
+        }
 
+        if (leaf) {
             //
-            // Quick reject.
+            // A floor seek lands on the preceding key, as long as it
+            // still belongs to oid.
             //
-            if (_compare(oid, _oid) > 0)
-                goto fail;
-
-            if (!at_eot) {
-                if (!fetch_node_kv(node, n + 1, &kvi,
-                            reinterpret_cast<void const **>(&next_key),
-                            reinterpret_cast<void const **>(&next_val)))
+            if (_floor && !exact && n > index) {
+                if (!fetch_node_kv(node, n - 1, &kvi,
+                            reinterpret_cast<void const **>(&key),
+                            reinterpret_cast<void const **>(&val)))
                     goto fail;
 
-                next_oid = nx::swap(*next_key);
-            }
-
-            if (node->btn_level == 0) {
-                //
-                // If the node level is zero, we have leaves, as such we
-                // need to find the value.
-                //
-
                 if (_compare(nx::swap(*key), _oid) == 0) {
-                    //
-                    // This node is the TOS.
-                    //
-                    _stack.push(std::make_pair(node, n));
-                    goto success;
+                    n--;
                 }
-            } else {
-                uint64_t lba;
+            }
+
+            //
+            // If the node level is zero, we have leaves, as such we
+            // need to find the value.
+            //
+            if (n < nkeys) {
+                if (!fetch_node_kv(node, n, &kvi,
+                            reinterpret_cast<void const **>(&key),
+                            reinterpret_cast<void const **>(&val)))
+                    goto fail;
 
                 //
-                // Ensure it's a valid index node.
+                // Quick reject.
                 //
-                if (!is_index_node_valid(kvi))
+                if (_compare(nx::swap(*key), _oid) != 0)
                     goto fail;
 
                 //
-                // The key must be oid <= key <= next_oid.
+                // This node is the TOS.
                 //
-                if (_compare(oid, _oid) <= 0 && _compare(_oid, next_oid) <= 0) {
-                    //
-                    // Save the node and the index.
-                    //
-                    _stack.push(std::make_pair(node, n));
-
-                    //
-                    // Fetch this node.
-                    //
-                    lba = nx::swap(*val);
-                    if (_mapper && !_mapper(lba, lba))
-                        goto fail;
-
-                    if (!_owner->read_btn(_device, lba, node))
-                        goto fail;
-
-                    //
-                    // We must reset index.
-                    //
-                    n = -1;
-                }
+                _stack.push(std::make_pair(node, n));
+                goto success;
             }
+        } else if (n > index || n < nkeys) {
+            uint64_t lba;
+
+            //
+            // The subtree holding oid is the one with key <= oid <= next_key,
+            // that is the one preceding the lower bound, unless the first
+            // key searched is already equal to oid.
+            //
+            bool preceding = (n > index && !exact);
+            if (preceding) {
+                n--;
+            }
+
+            if (!fetch_node_kv(node, n, &kvi,
+                        reinterpret_cast<void const **>(&key),
+                        reinterpret_cast<void const **>(&val)))
+                goto fail;
+
+            //
+            // Quick reject.
+            //
+            if (!preceding && _compare(nx::swap(*key), _oid) != 0)
+                goto fail;
+
+            //
+            // Ensure it's a valid index node.
+            //
+            if (!is_index_node_valid(kvi))
+                goto fail;
+
+            //
+            // Save the node and the index.
+            //
+            _stack.push(std::make_pair(node, n));
+            node = nullptr;
+
+            //
+            // Fetch this node.
+            //
+            lba = nx::swap(*val);
+            if (_mapper && !_mapper(lba, lba))
+                goto fail;
+
+            if (!_owner->read_btn(_device, lba, node))
+                goto fail;
+
+            //
+            // We must reset index.
+            //
+            index = 0;
+            continue;
         }
 
         //
@@ -229,6 +303,11 @@ reset()
         if (_stack.empty())
             goto fail;
 
+        //
+        // The current node is not on the stack, release it.
+        //
+        _device->release_block(node);
+
         node  = _stack.top().first;
         index = _stack.top().second + 1;
         _stack.pop(false);
@@ -239,7 +318,7 @@ success:
     return true;
 
 fail:
-    if (node->btn_level == 0) {
+    if (leaf) {
         context->log(severity::error, "cannot find oid %" PRIu64 " in btree",
                 _oid);
     } else {
@@ -247,16 +326,76 @@ fail:
                 "smallest key in btree", _oid);
     }
 
-    if (_stack.empty()) {
-        device::free_block(_root);
-        _root = nullptr;
-    }
+    //
+    // The root is either the node being searched or at the bottom of the
+    // stack.
+    //
+    _device->release_block(node);
     _stack.clear();
+    _root = nullptr;
 
     _end = true;
     return false;
 }
 
+//
+// Repositions the enumeration of oid at the first key not less than the
+// seek key, or at the last key not greater than it when floor is set.
+// The current leaf is searched first, the tree is descended again from
+// the root only when the position is not within it.
+//
+bool enumerator::
+seek(key_comparer_type const &seek, bool floor)
+{
+    _seek  = seek;
+    _floor = floor;
+
+    if (!_stack.empty() && _stack.top().first->btn_level == 0) {
+        auto            node  = _stack.top().first;
+        size_t          nkeys = nx::swap(node->btn_nkeys);
+        btn_kvinfo_t    kvi;
+        uint64_t const *key;
+        uint64_t const *val;
+        size_t          n;
+
+        if (nkeys != 0 && lower_bound(node, 0, n) && n < nkeys &&
+                fetch_node_kv(node, n, &kvi,
+                    reinterpret_cast<void const **>(&key),
+                    reinterpret_cast<void const **>(&val))) {
+            bool exact = (_seek(key, kvi.key_size) == 0);
+
+            //
+            // Unless the key is found, the lower bound must have a
+            // predecessor in this leaf for the leaf to hold the position.
+            //
+            if (exact || n > 0) {
+                if (_floor && !exact && fetch_node_kv(node, n - 1, &kvi,
+                            reinterpret_cast<void const **>(&key),
+                            reinterpret_cast<void const **>(&val)) &&
+                        _compare(nx::swap(*key), _oid) == 0) {
+                    n--;
+                } else if (!fetch_node_kv(node, n, &kvi,
+                            reinterpret_cast<void const **>(&key),
+                            reinterpret_cast<void const **>(&val))) {
+                    _end = true;
+                    return false;
+                }
+
+                if (_compare(nx::swap(*key), _oid) != 0) {
+                    _end = true;
+                    return false;
+                }
+
+                _stack.top().second = n;
+                _end = false;
+                return true;
+            }
+        }
+    }
+
+    return reset();
+}
+
 bool enumerator::
 advance()
 {
@@ -278,14 +417,14 @@ advance()
         //
         // Now increment the index.
         //
-        auto  node  = _stack.top().first;
-        auto &index = _stack.top().second;
+        auto  parent = _stack.top().first;
+        auto &index  = _stack.top().second;
 
         //
         // If the index is past the number of keys of this node, we must read
         // the following, or traverse upward to the next.
         //
-        if (++index >= nx::swap(node->btn_nkeys))
+        if (++index >= nx::swap(parent->btn_nkeys))
             continue;
 
         //
@@ -295,7 +434,7 @@ advance()
         uint64_t const *key;
         uint64_t const *val;
 
-        if (!fetch_node_kv(node, index, &kvi,
+        if (!fetch_node_kv(parent, index, &kvi,
                     reinterpret_cast<void const **>(&key),
                     reinterpret_cast<void const **>(&val)))
             return false;
@@ -312,7 +451,7 @@ advance()
         // easy because a continuation must always start at zero, so we
         // don't have to iterate through each key.
         //
-        if (node->btn_level != 0) {
+        if (parent->btn_level != 0) {
             do {
                 //
                 // Ensure it's a valid index node.
@@ -348,7 +487,7 @@ advance()
                 // Let's ensure that the first key matches the oid we need.
                 //
                 if (_compare(nx::swap(*key), _oid) != 0)
-                    return false;
+                    goto fail;
 
                 //
                 // Save this node onto the stack.
@@ -370,7 +509,7 @@ fail:
     // Release this node because we're not pushing it onto
     // the stack.
     //
-    device::free_block(node);
+    _device->release_block(node);
     return false;
 }
 
@@ -24,8 +24,11 @@
 
 #include "nxcompat/nxcompat.h"
 
-#include <ctype.h>
-#include <stdlib.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sched.h>
+#endif
 
 char *
 apfs_format_time(uint64_t timestamp, char *buf, size_t bufsiz, bool iso)
@@ -50,75 +53,213 @@ apfs_format_time(uint64_t timestamp, char *buf, size_t bufsiz, bool iso)
     return buf;
 }
 
-/* hacker's delight */
+/*
+ * CRC32-C, bit reflected, computed with the SSE4.2 crc32 instruction where
+ * available, with slicing-by-8 tables otherwise.
+ */
 #define CRC32C_POLY 0x82F63B78U /* CRC32-C */
 
-static uint32_t *
-utf8_to_utf32(char const *s, size_t len, size_t *ulen)
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define APFS_HAVE_SSE42 1
+#endif
+
+static uint32_t crc32c_table[8][256];
+static int      crc32c_impl = -1;
+
+enum {
+    CRC32C_IMPL_BUSY = -2,
+    CRC32C_IMPL_TABLE = 0,
+    CRC32C_IMPL_SSE42
+};
+
+/*
+ * Names are hashed from many threads at once: the first caller selects
+ * the implementation and fills the table, the others wait for it to be
+ * published.
+ */
+static int
+crc32c_init(void)
 {
-    UTF8 const *source;
-    UTF8 const *sourceEnd;
-    UTF32      *target;
-    UTF32      *targetEnd;
-    UTF32      *result;
-
-    result = (UTF32 *)calloc((len + 1), sizeof(UTF32));
-    if (result == NULL)
-        return NULL;
-
-    source    = (UTF8 const *)s;
-    sourceEnd = (UTF8 const *)(s + len);
-    target    = result;
-    targetEnd = result + len;
-
-    if (ConvertUTF8toUTF32(&source, sourceEnd, &target, targetEnd,
-                lenientConversion) != conversionOK) {
-        free(result);
-        result = NULL;
-    } else {
-        *ulen = target - result;
+    uint32_t n, k;
+    int      impl;
+
+    impl = __atomic_load_n(&crc32c_impl, __ATOMIC_ACQUIRE);
+    if (impl >= 0)
+        return impl;
+
+    impl = -1;
+    if (!__atomic_compare_exchange_n(&crc32c_impl, &impl, CRC32C_IMPL_BUSY,
+                false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+        while ((impl = __atomic_load_n(&crc32c_impl, __ATOMIC_ACQUIRE)) < 0) {
+#ifdef _WIN32
+            SwitchToThread();
+#else
+            sched_yield();
+#endif
+        }
+        return impl;
     }
 
-    return (uint32_t *)result;
+#ifdef APFS_HAVE_SSE42
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        __atomic_store_n(&crc32c_impl, CRC32C_IMPL_SSE42, __ATOMIC_RELEASE);
+        return CRC32C_IMPL_SSE42;
+    }
+#endif
+
+    for (n = 0; n < 256; n++) {
+        uint32_t crc = n;
+
+        for (k = 0; k < 8; k++) {
+            crc = (crc >> 1) ^ (CRC32C_POLY & -(crc & 1));
+        }
+
+        crc32c_table[0][n] = crc;
+    }
+
+    for (n = 0; n < 256; n++) {
+        for (k = 1; k < 8; k++) {
+            crc32c_table[k][n] = (crc32c_table[k - 1][n] >> 8) ^
+                crc32c_table[0][crc32c_table[k - 1][n] & 0xff];
+        }
+    }
+
+    __atomic_store_n(&crc32c_impl, CRC32C_IMPL_TABLE, __ATOMIC_RELEASE);
+    return CRC32C_IMPL_TABLE;
 }
 
-static inline int
-tolower_if_insensitive(int c, bool insensitive)
+/*
+ * Lowers the bytes between 'A' and 'Z' of a word, as tolower() does in
+ * the C locale, each byte of the UTF-32 name being lowered on its own.
+ */
+static inline uint64_t
+ascii_tolower64(uint64_t v)
+{
+    uint64_t const high  = 0x8080808080808080ULL;
+    uint64_t const ones  = 0x0101010101010101ULL;
+    uint64_t       low7  = v & ~high;
+    uint64_t       ge_a  = low7 + (0x80 - 'A') * ones;
+    uint64_t       gt_z  = low7 + (0x80 - 'Z' - 1) * ones;
+
+    return v | (((ge_a & ~gt_z & ~v) & high) >> 2);
+}
+
+static uint32_t
+crc32c_units_table(uint32_t crc, UTF32 const *units, size_t count,
+        bool insensitive)
 {
-    return insensitive ? tolower(c) : c;
+    size_t n;
+
+    for (n = 0; n + 2 <= count; n += 2) {
+        uint64_t v = (uint64_t)units[n] | ((uint64_t)units[n + 1] << 32);
+        uint32_t hi;
+
+        if (insensitive) {
+            v = ascii_tolower64(v);
+        }
+
+        crc ^= (uint32_t)v;
+        hi   = (uint32_t)(v >> 32);
+        crc  = crc32c_table[7][crc & 0xff] ^
+            crc32c_table[6][(crc >> 8) & 0xff] ^
+            crc32c_table[5][(crc >> 16) & 0xff] ^
+            crc32c_table[4][crc >> 24] ^
+            crc32c_table[3][hi & 0xff] ^
+            crc32c_table[2][(hi >> 8) & 0xff] ^
+            crc32c_table[1][(hi >> 16) & 0xff] ^
+            crc32c_table[0][hi >> 24];
+    }
+
+    if (n < count) {
+        uint32_t v = units[n];
+
+        if (insensitive) {
+            v = (uint32_t)ascii_tolower64(v);
+        }
+
+        crc ^= v;
+        crc  = crc32c_table[3][crc & 0xff] ^
+            crc32c_table[2][(crc >> 8) & 0xff] ^
+            crc32c_table[1][(crc >> 16) & 0xff] ^
+            crc32c_table[0][crc >> 24];
+    }
+
+    return crc;
 }
 
+#ifdef APFS_HAVE_SSE42
+__attribute__((target("sse4.2")))
 static uint32_t
-crc32c(uint32_t crc, void const *data, size_t length, bool insensitive)
+crc32c_units_sse42(uint32_t crc, UTF32 const *units, size_t count,
+        bool insensitive)
 {
-    uint8_t const *bytes = (uint8_t const *)data;
+    size_t n;
 
-    while (length-- != 0) {
-        size_t   bits = 8;
-        uint32_t byte = tolower_if_insensitive(*bytes++, insensitive);
+    for (n = 0; n + 2 <= count; n += 2) {
+        uint64_t v = (uint64_t)units[n] | ((uint64_t)units[n + 1] << 32);
 
-        crc = crc ^ byte;
+        if (insensitive) {
+            v = ascii_tolower64(v);
+        }
 
-        while (bits-- != 0) {
-            uint32_t mask = -(crc & 1);
-            crc = (crc >> 1) ^ (CRC32C_POLY & mask);
+        crc = (uint32_t)_mm_crc32_u64(crc, v);
+    }
+
+    if (n < count) {
+        uint32_t v = units[n];
+
+        if (insensitive) {
+            v = (uint32_t)ascii_tolower64(v);
         }
+
+        crc = _mm_crc32_u32(crc, v);
     }
 
     return crc;
 }
+#endif
+
+/*
+ * Hashes the UTF-32 (little endian) form of the name, converted in chunks
+ * on the stack; pure ASCII runs are widened directly.
+ */
+#define APFS_HASH_NAME_CHUNK 64
 
 uint32_t
 apfs_hash_name(char const *name, size_t namelen, bool insensitive)
 {
-    size_t    utf32_length;
-    uint32_t *utf32_name = utf8_to_utf32(name, namelen, &utf32_length);
-    uint32_t  hash       = ~0U;
-
-    if (utf32_name != NULL) {
-        hash = crc32c(hash, utf32_name, utf32_length * sizeof(uint32_t),
-                insensitive);
-        free(utf32_name);
+    UTF8 const *source    = (UTF8 const *)name;
+    UTF8 const *sourceEnd = (UTF8 const *)(name + namelen);
+    UTF32       units[APFS_HASH_NAME_CHUNK];
+    UTF32      *unitsEnd  = units + APFS_HASH_NAME_CHUNK;
+    uint32_t    hash      = ~0U;
+    int         impl      = crc32c_init();
+
+    while (source < sourceEnd) {
+        UTF32 *target = units;
+
+        while (target < unitsEnd && source < sourceEnd && *source < 0x80) {
+            *target++ = *source++;
+        }
+
+        if (target < unitsEnd && source < sourceEnd) {
+            ConversionResult result = ConvertUTF8toUTF32(&source, sourceEnd,
+                    &target, unitsEnd, lenientConversion);
+            if (result != conversionOK && result != targetExhausted)
+                return ~0U & 0x3fffff;
+        }
+
+#ifdef APFS_HAVE_SSE42
+        if (impl == CRC32C_IMPL_SSE42) {
+            hash = crc32c_units_sse42(hash, units, target - units,
+                    insensitive);
+            continue;
+        }
+#endif
+        (void)impl;
+        hash = crc32c_units_table(hash, units, target - units, insensitive);
     }
 
     return hash & 0x3fffff;
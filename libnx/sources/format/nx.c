@@ -22,9 +22,278 @@
 
 #include "nx/format/nx.h"
 
+#include <string.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define NX_HAVE_X86_SIMD 1
+#elif defined(__aarch64__) && defined(__ARM_NEON) && \
+    (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#include <arm_neon.h>
+#define NX_HAVE_NEON 1
+#endif
+
 #define LO32(x) ((x) & 0xffffffff)
 #define HI32(x) ((x) >> 32)
 
+#define NX_CPU_SSE41 (1 << 0)
+#define NX_CPU_AVX2  (1 << 1)
+#define NX_CPU_NEON  (1 << 2)
+
+/*
+ * The features and the checksum implementation are picked lazily, and
+ * blocks are verified from many threads at once: both are read and
+ * published atomically.
+ */
+static unsigned
+_nx_cpu_features(void)
+{
+    static int features = -1;
+    int        current  = __atomic_load_n(&features, __ATOMIC_ACQUIRE);
+
+    if (current < 0) {
+        int detected = 0;
+#if defined(NX_HAVE_X86_SIMD)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse4.1"))
+            detected |= NX_CPU_SSE41;
+        if (__builtin_cpu_supports("avx2"))
+            detected |= NX_CPU_AVX2;
+#elif defined(NX_HAVE_NEON)
+        detected |= NX_CPU_NEON;
+#endif
+        __atomic_store_n(&features, detected, __ATOMIC_RELEASE);
+        current = detected;
+    }
+
+    return (unsigned)current;
+}
+
+/*
+ * Fletcher-64 over little endian 32-bit words, each word is added to lo
+ * and lo to hi. Over the m words following (lo, hi) this gives
+ * lo + sum(w[i]) and hi + m * lo + sum((m - i) * w[i]).
+ *
+ * The vectorized versions sum every L-th word in each of their L lanes,
+ * A[j] being the sum of lane j and B[j] the sum of its running sums over
+ * K = m / L steps, so that sum((m - i) * w[i]) is
+ * L * sum(B[j]) - sum(j * A[j]). Everything wraps modulo 2^64 as the
+ * scalar loop does, hence all versions give the same result.
+ */
+typedef void (*_nx_checksum_fn)(uint32_t const *words, size_t nwords,
+        uint64_t *lo, uint64_t *hi);
+
+static void
+_nx_checksum_scalar(uint32_t const *words, size_t nwords, uint64_t *lop,
+        uint64_t *hip)
+{
+    uint64_t lo = *lop;
+    uint64_t hi = *hip;
+    size_t   n;
+
+    for (n = 0; n < nwords; n++) {
+        lo += nx_swap32(words[n]);
+        hi += lo;
+    }
+
+    *lop = lo;
+    *hip = hi;
+}
+
+#if defined(NX_HAVE_X86_SIMD) || defined(NX_HAVE_NEON)
+static void
+_nx_checksum_merge(uint64_t const *a, uint64_t const *b, size_t lanes,
+        size_t nwords, uint64_t *lop, uint64_t *hip)
+{
+    uint64_t sa = 0, sb = 0, sj = 0;
+    size_t   j;
+
+    for (j = 0; j < lanes; j++) {
+        sa += a[j];
+        sb += b[j];
+        sj += j * a[j];
+    }
+
+    *hip += nwords * *lop + lanes * sb - sj;
+    *lop += sa;
+}
+#endif
+
+#ifdef NX_HAVE_X86_SIMD
+/*
+ * Words 0-3 and 4-7 of each 32 bytes go to separate accumulators, lanes
+ * 0-3 and 4-7, so that their additions do not depend on each other.
+ */
+__attribute__((target("avx2")))
+static void
+_nx_checksum_avx2(uint32_t const *words, size_t nwords, uint64_t *lop,
+        uint64_t *hip)
+{
+    __m256i  a0 = _mm256_setzero_si256();
+    __m256i  a1 = _mm256_setzero_si256();
+    __m256i  b0 = _mm256_setzero_si256();
+    __m256i  b1 = _mm256_setzero_si256();
+    uint64_t sa[8], sb[8];
+    size_t   n, m = nwords & ~(size_t)7;
+
+    for (n = 0; n < m; n += 8) {
+        __m256i w = _mm256_loadu_si256((__m256i const *)&words[n]);
+
+        a0 = _mm256_add_epi64(a0, _mm256_cvtepu32_epi64(
+                    _mm256_castsi256_si128(w)));
+        a1 = _mm256_add_epi64(a1, _mm256_cvtepu32_epi64(
+                    _mm256_extracti128_si256(w, 1)));
+        b0 = _mm256_add_epi64(b0, a0);
+        b1 = _mm256_add_epi64(b1, a1);
+    }
+
+    _mm256_storeu_si256((__m256i *)&sa[0], a0);
+    _mm256_storeu_si256((__m256i *)&sa[4], a1);
+    _mm256_storeu_si256((__m256i *)&sb[0], b0);
+    _mm256_storeu_si256((__m256i *)&sb[4], b1);
+    _nx_checksum_merge(sa, sb, 8, m, lop, hip);
+    _nx_checksum_scalar(words + m, nwords - m, lop, hip);
+}
+
+__attribute__((target("sse4.1")))
+static void
+_nx_checksum_sse41(uint32_t const *words, size_t nwords, uint64_t *lop,
+        uint64_t *hip)
+{
+    __m128i  a0 = _mm_setzero_si128();
+    __m128i  a1 = _mm_setzero_si128();
+    __m128i  b0 = _mm_setzero_si128();
+    __m128i  b1 = _mm_setzero_si128();
+    uint64_t sa[4], sb[4];
+    size_t   n, m = nwords & ~(size_t)3;
+
+    for (n = 0; n < m; n += 4) {
+        __m128i w = _mm_loadu_si128((__m128i const *)&words[n]);
+
+        a0 = _mm_add_epi64(a0, _mm_cvtepu32_epi64(w));
+        a1 = _mm_add_epi64(a1, _mm_cvtepu32_epi64(_mm_srli_si128(w, 8)));
+        b0 = _mm_add_epi64(b0, a0);
+        b1 = _mm_add_epi64(b1, a1);
+    }
+
+    _mm_storeu_si128((__m128i *)&sa[0], a0);
+    _mm_storeu_si128((__m128i *)&sa[2], a1);
+    _mm_storeu_si128((__m128i *)&sb[0], b0);
+    _mm_storeu_si128((__m128i *)&sb[2], b1);
+    _nx_checksum_merge(sa, sb, 4, m, lop, hip);
+    _nx_checksum_scalar(words + m, nwords - m, lop, hip);
+}
+#endif
+
+#ifdef NX_HAVE_NEON
+static void
+_nx_checksum_neon(uint32_t const *words, size_t nwords, uint64_t *lop,
+        uint64_t *hip)
+{
+    uint64x2_t a0 = vdupq_n_u64(0);
+    uint64x2_t a1 = vdupq_n_u64(0);
+    uint64x2_t b0 = vdupq_n_u64(0);
+    uint64x2_t b1 = vdupq_n_u64(0);
+    uint64_t   sa[4], sb[4];
+    size_t     n, m = nwords & ~(size_t)3;
+
+    for (n = 0; n < m; n += 4) {
+        uint32x4_t w = vld1q_u32(&words[n]);
+
+        a0 = vaddq_u64(a0, vmovl_u32(vget_low_u32(w)));
+        a1 = vaddq_u64(a1, vmovl_high_u32(w));
+        b0 = vaddq_u64(b0, a0);
+        b1 = vaddq_u64(b1, a1);
+    }
+
+    vst1q_u64(&sa[0], a0);
+    vst1q_u64(&sa[2], a1);
+    vst1q_u64(&sb[0], b0);
+    vst1q_u64(&sb[2], b1);
+    _nx_checksum_merge(sa, sb, 4, m, lop, hip);
+    _nx_checksum_scalar(words + m, nwords - m, lop, hip);
+}
+#endif
+
+static struct {
+    char const      *name;
+    unsigned         requires;
+    _nx_checksum_fn  fn;
+} const _nx_checksum_impls[] = {
+#ifdef NX_HAVE_X86_SIMD
+    { "avx2",   NX_CPU_AVX2,  _nx_checksum_avx2   },
+    { "sse4.1", NX_CPU_SSE41, _nx_checksum_sse41  },
+#endif
+#ifdef NX_HAVE_NEON
+    { "neon",   NX_CPU_NEON,  _nx_checksum_neon   },
+#endif
+    { "scalar", 0,            _nx_checksum_scalar }
+};
+
+#define NX_CHECKSUM_IMPL_COUNT \
+    (sizeof(_nx_checksum_impls) / sizeof(_nx_checksum_impls[0]))
+
+static int _nx_checksum_impl = -1;
+
+static int
+_nx_checksum_find_impl(char const *name)
+{
+    size_t n;
+
+    for (n = 0; n < NX_CHECKSUM_IMPL_COUNT; n++) {
+        if ((_nx_checksum_impls[n].requires & _nx_cpu_features()) !=
+                _nx_checksum_impls[n].requires)
+            continue;
+        if (name == NULL || strcmp(name, _nx_checksum_impls[n].name) == 0)
+            return (int)n;
+    }
+
+    return -1;
+}
+
+static int
+_nx_checksum_get_index(void)
+{
+    int impl = __atomic_load_n(&_nx_checksum_impl, __ATOMIC_ACQUIRE);
+    int found;
+
+    if (impl >= 0)
+        return impl;
+
+    /*
+     * Should another thread pick one meanwhile, its choice is kept.
+     */
+    found = _nx_checksum_find_impl(NULL);
+    if (!__atomic_compare_exchange_n(&_nx_checksum_impl, &impl, found,
+                false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return impl;
+
+    return found;
+}
+
+/*
+ * Selects the checksum implementation by name, or the fastest one the
+ * processor supports when name is NULL. This is meant for testing and
+ * benchmarking, and must not be called while checksums are computed.
+ */
+bool
+nx_checksum_set_impl(char const *name)
+{
+    int impl = _nx_checksum_find_impl(name);
+
+    if (impl < 0)
+        return false;
+
+    __atomic_store_n(&_nx_checksum_impl, impl, __ATOMIC_RELEASE);
+    return true;
+}
+
+char const *
+nx_checksum_get_impl(void)
+{
+    return _nx_checksum_impls[_nx_checksum_get_index()].name;
+}
+
 static uint64_t
 _nx_make_checksum(void const *data, size_t start, size_t length, uint64_t init)
 {
@@ -35,9 +304,10 @@ _nx_make_checksum(void const *data, size_t start, size_t length, uint64_t init)
     lo = LO32(init);
     hi = HI32(init);
 
-    for (n = start / sizeof(words[0]); n < nwords; n++) {
-        lo += nx_swap32(words[n]);
-        hi += lo;
+    n = start / sizeof(words[0]);
+    if (n < nwords) {
+        (*_nx_checksum_impls[_nx_checksum_get_index()].fn)(words + n,
+                nwords - n, &lo, &hi);
     }
 
     lo %= UINT32_MAX;
@@ -159,6 +429,231 @@ nx_btn_get_kvptrs(nx_btn_t const *btn, nx_btn_t const *btntop,
     return true;
 }
 
+/*
+ * Binary search the slots [first, nkeys) of a btree node, *index is set
+ * to the first slot whose key does not compare less than the searched one,
+ * or to nkeys if there's none. Keys are located directly from the table of
+ * contents, both for fixed (compressed) and variable size slots.
+ */
+bool
+nx_btn_lower_bound(nx_btn_t const *btn, nx_btn_t const *btntop,
+        uint32_t first, nx_btn_compare_callback_t compare, void *opaque,
+        uint32_t *index)
+{
+    bt_fixed_t const *bt;
+    uintptr_t         keys;
+    uintptr_t         limit;
+    size_t            table_len;
+    size_t            slot_size;
+    uint32_t          lo, hi;
+    bool              compressed;
+
+    if (btn == NULL || btntop == NULL || compare == NULL || index == NULL)
+        return false;
+
+    bt         = NX_BTN_FIXED(btntop);
+    compressed = (nx_swap16(btn->btn_flags) & NX_BTN_FLAG_COMPRESSED) != 0;
+    slot_size  = compressed ? sizeof(btn_cslot_t) : sizeof(btn_slot_t);
+    table_len  = nx_swap16(btn->btn_table_space.len);
+    keys       = (uintptr_t)NX_BTN_DATA(btn) + table_len;
+    limit      = (uintptr_t)btn + nx_swap32(bt->bt_node_size);
+
+    lo = first;
+    hi = nx_swap32(btn->btn_nkeys);
+
+    if (hi * slot_size > table_len)
+        return false;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        uint16_t key_offset;
+        size_t   key_size;
+
+        if (compressed) {
+            key_offset = nx_swap16(NX_BTN_CSLOT(btn, mid)->key_offset);
+            key_size   = nx_swap32(bt->bt_key_size);
+        } else {
+            key_offset = nx_swap16(NX_BTN_SLOT(btn, mid)->key_offset);
+            key_size   = nx_swap16(NX_BTN_SLOT(btn, mid)->key_size);
+        }
+
+        if (key_offset == NX_BTN_NONE || keys + key_offset + key_size > limit)
+            return false;
+
+        if ((*compare)(opaque, (void const *)(keys + key_offset),
+                    key_size) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    *index = lo;
+
+    return true;
+}
+
+static inline uint64_t
+_nx_btn_key_u64(uint8_t const *keys, btn_cslot_t const *slot)
+{
+    uint64_t value;
+
+    memcpy(&value, keys + nx_swap16(slot->key_offset), sizeof(value));
+
+    return nx_swap64(value);
+}
+
+static uint32_t
+_nx_btn_count_less_u64(uint8_t const *keys, btn_cslot_t const *slots,
+        uint32_t first, uint32_t last, uint64_t value)
+{
+    uint32_t count = 0;
+    uint32_t n;
+
+    for (n = first; n < last; n++) {
+        count += (_nx_btn_key_u64(keys, &slots[n]) < value);
+    }
+
+    return count;
+}
+
+#ifdef NX_HAVE_X86_SIMD
+/*
+ * Counts the 16 bytes keys stored contiguously at keys whose leading word
+ * is less than value, four keys at a time; unsigned comparisons are done
+ * as signed ones with the sign bit flipped.
+ */
+__attribute__((target("avx2")))
+static uint32_t
+_nx_btn_count_less_u64_avx2(uint8_t const *keys, uint32_t nkeys,
+        uint64_t value)
+{
+    __m256i  bias   = _mm256_set1_epi64x((long long)0x8000000000000000ULL);
+    __m256i  target = _mm256_xor_si256(_mm256_set1_epi64x((long long)value),
+            bias);
+    uint32_t count  = 0;
+    uint32_t n;
+
+    for (n = 0; n + 4 <= nkeys; n += 4) {
+        __m256i lo    = _mm256_loadu_si256((__m256i const *)(keys + n * 16));
+        __m256i hi    = _mm256_loadu_si256((__m256i const *)(keys + n * 16 +
+                    32));
+        __m256i words = _mm256_xor_si256(_mm256_unpacklo_epi64(lo, hi), bias);
+        __m256i less  = _mm256_cmpgt_epi64(target, words);
+
+        count += (uint32_t)__builtin_popcount(
+                _mm256_movemask_pd(_mm256_castsi256_pd(less)));
+    }
+
+    for (; n < nkeys; n++) {
+        uint64_t word;
+
+        memcpy(&word, keys + n * 16, sizeof(word));
+        count += (nx_swap64(word) < value);
+    }
+
+    return count;
+}
+#endif
+
+#define NX_BTN_COUNT_WINDOW 32
+
+/*
+ * Same as nx_btn_lower_bound(), for fixed size (compressed) slots whose
+ * keys begin with a 64-bit word, such as object map keys, searched by that
+ * word alone. The slots are narrowed with a binary search, then the keys
+ * left less than value are counted, four at a time where AVX2 is
+ * available and the keys are 16 bytes long and stored in slot order.
+ */
+
+bool
+nx_btn_lower_bound_u64(nx_btn_t const *btn, nx_btn_t const *btntop,
+        uint32_t first, uint64_t value, uint32_t *index)
+{
+    bt_fixed_t const  *bt;
+    btn_cslot_t const *slots;
+    uint8_t const     *keys;
+    size_t             table_len;
+    size_t             key_limit;
+    uint32_t           lo, hi, n;
+
+    if (btn == NULL || btntop == NULL || index == NULL)
+        return false;
+
+    if (!(nx_swap16(btn->btn_flags) & NX_BTN_FLAG_COMPRESSED))
+        return false;
+
+    bt        = NX_BTN_FIXED(btntop);
+    slots     = (btn_cslot_t const *)NX_BTN_DATA(btn);
+    table_len = nx_swap16(btn->btn_table_space.len);
+    keys      = (uint8_t const *)NX_BTN_DATA(btn) + table_len;
+
+    if (nx_swap32(bt->bt_key_size) < sizeof(uint64_t))
+        return false;
+
+    /*
+     * Every key searched must lie within the node.
+     */
+    if ((uintptr_t)btn + nx_swap32(bt->bt_node_size) <
+            (uintptr_t)keys + sizeof(uint64_t))
+        return false;
+
+    key_limit = (uintptr_t)btn + nx_swap32(bt->bt_node_size) -
+        (uintptr_t)keys - sizeof(uint64_t);
+
+    lo = first;
+    hi = nx_swap32(btn->btn_nkeys);
+
+    if (hi * sizeof(btn_cslot_t) > table_len)
+        return false;
+
+    while (hi - lo > NX_BTN_COUNT_WINDOW) {
+        uint32_t mid = lo + (hi - lo) / 2;
+
+        if (nx_swap16(slots[mid].key_offset) > key_limit)
+            return false;
+
+        if (_nx_btn_key_u64(keys, &slots[mid]) < value) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+#ifdef NX_HAVE_X86_SIMD
+    /*
+     * Keys are usually stored in the order of their slots, when so they
+     * are compared straight from the key area.
+     */
+    if (lo < hi && nx_swap32(bt->bt_key_size) == 16 &&
+            (_nx_cpu_features() & NX_CPU_AVX2) != 0) {
+        size_t   base       = nx_swap16(slots[lo].key_offset);
+        uint32_t misordered = 0;
+
+        for (n = lo; n < hi; n++) {
+            misordered |= nx_swap16(slots[n].key_offset) ^
+                (uint32_t)(base + (size_t)(n - lo) * 16);
+        }
+
+        if (misordered == 0 && base + (size_t)(hi - lo) * 16 - 8 <=
+                key_limit) {
+            *index = lo + _nx_btn_count_less_u64_avx2(keys + base, hi - lo,
+                    value);
+            return true;
+        }
+    }
+#endif
+
+    for (n = lo; n < hi; n++) {
+        if (nx_swap16(slots[n].key_offset) > key_limit)
+            return false;
+    }
+
+    *index = lo + _nx_btn_count_less_u64(keys, slots, lo, hi, value);
+
+    return true;
+}
+
 bool
 nx_btn_traverse(nx_btn_t const *btn, nx_btn_t const *btntop,
         nx_btn_traverse_callback_t callback, void *opaque)
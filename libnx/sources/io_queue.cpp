@@ -0,0 +1,733 @@
+/*
+ * Copyright (c) 2017-present Orlando Bassotto
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "nx/io_queue.h"
+#include "nx/device.h"
+
+#include "nxcompat/nxcompat.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+
+using nx::io_queue;
+using nx::device;
+
+class io_queue::backend {
+public:
+    virtual ~backend()
+    { }
+
+public:
+    virtual bool submit(request *request) = 0;
+    virtual void flush()
+    { }
+    virtual size_t complete(request **requests, size_t count, bool wait) = 0;
+
+protected:
+    static inline int descriptor(device const *device)
+    { return device->_fd; }
+
+    static inline void account(device const *device, uint64_t requests,
+            uint64_t calls, uint64_t blocks)
+    {
+        device->_read_requests.fetch_add(requests, std::memory_order_relaxed);
+        device->_read_calls.fetch_add(calls, std::memory_order_relaxed);
+        device->_read_blocks.fetch_add(blocks, std::memory_order_relaxed);
+    }
+
+    static inline void read(device const *device, request *request)
+    {
+        request->nread = 0;
+        request->error = 0;
+        if (!device->read(request->lba, request->buffer, request->count,
+                    &request->nread)) {
+            request->error = errno;
+        }
+    }
+};
+
+namespace {
+
+//
+// Reads at submission.
+//
+class sync_backend : public io_queue::backend {
+private:
+    device const                      *_device;
+    std::deque<io_queue::request *>    _completed;
+
+public:
+    sync_backend(device const *device)
+        : _device(device)
+    { }
+
+public:
+    bool submit(io_queue::request *request) override
+    {
+        read(_device, request);
+        _completed.push_back(request);
+        return true;
+    }
+
+    size_t complete(io_queue::request **requests, size_t count,
+            bool) override
+    {
+        size_t n;
+
+        for (n = 0; n < count && !_completed.empty(); n++) {
+            requests[n] = _completed.front();
+            _completed.pop_front();
+        }
+
+        return n;
+    }
+};
+
+//
+// Reads from a pool of threads.
+//
+class thread_backend : public io_queue::backend {
+private:
+    device const                      *_device;
+    std::vector<std::thread>           _threads;
+    std::mutex                         _lock;
+    std::condition_variable            _submitted;
+    std::condition_variable            _completion;
+    std::deque<io_queue::request *>    _pending;
+    std::deque<io_queue::request *>    _completed;
+    bool                               _stop;
+
+public:
+    thread_backend(device const *device, size_t depth)
+        : _device(device)
+        , _stop  (false)
+    {
+        size_t nthreads = std::max<size_t>(std::thread::hardware_concurrency(),
+                4);
+        nthreads = std::min(nthreads, std::max<size_t>(depth, 1));
+
+        for (size_t n = 0; n < nthreads; n++) {
+            _threads.push_back(std::thread(&thread_backend::run, this));
+        }
+    }
+
+    ~thread_backend()
+    {
+        {
+            std::lock_guard<std::mutex> _(_lock);
+            _stop = true;
+        }
+        _submitted.notify_all();
+
+        for (auto &thread : _threads) {
+            thread.join();
+        }
+    }
+
+public:
+    bool submit(io_queue::request *request) override
+    {
+        {
+            std::lock_guard<std::mutex> _(_lock);
+            _pending.push_back(request);
+        }
+        _submitted.notify_one();
+        return true;
+    }
+
+    size_t complete(io_queue::request **requests, size_t count,
+            bool wait) override
+    {
+        std::unique_lock<std::mutex> lock(_lock);
+        size_t                       n;
+
+        if (wait) {
+            _completion.wait(lock, [this] { return !_completed.empty(); });
+        }
+
+        for (n = 0; n < count && !_completed.empty(); n++) {
+            requests[n] = _completed.front();
+            _completed.pop_front();
+        }
+
+        return n;
+    }
+
+private:
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(_lock);
+
+        for (;;) {
+            _submitted.wait(lock, [this] { return _stop || !_pending.empty(); });
+            if (_stop)
+                break;
+
+            auto request = _pending.front();
+            _pending.pop_front();
+
+            lock.unlock();
+            read(_device, request);
+            lock.lock();
+
+            _completed.push_back(request);
+            _completion.notify_one();
+        }
+    }
+};
+
+#ifdef HAVE_LINUX_IO_URING_H
+//
+// Reads through an io_uring, set up with the raw system calls.
+//
+class uring_backend : public io_queue::backend {
+private:
+    struct slot {
+        struct iovec       iov;
+        io_queue::request *request;
+    };
+
+private:
+    device const        *_device;
+    int                  _ring;
+    void                *_sq_ring;
+    size_t               _sq_ring_size;
+    void                *_cq_ring;
+    size_t               _cq_ring_size;
+    struct io_uring_sqe *_sqes;
+    size_t               _sqes_size;
+    unsigned            *_sq_tail;
+    unsigned            *_sq_mask;
+    unsigned            *_sq_array;
+    unsigned            *_cq_head;
+    unsigned            *_cq_tail;
+    unsigned            *_cq_mask;
+    struct io_uring_cqe *_cqes;
+    unsigned             _unsubmitted;
+    std::vector<slot>    _slots;
+    std::vector<size_t>  _free;
+    bool                 _failed;
+    std::deque<io_queue::request *>
+                         _aborted;
+
+public:
+    uring_backend(device const *device)
+        : _device      (device)
+        , _ring        (-1)
+        , _sq_ring     (MAP_FAILED)
+        , _sq_ring_size(0)
+        , _cq_ring     (MAP_FAILED)
+        , _cq_ring_size(0)
+        , _sqes        (reinterpret_cast<struct io_uring_sqe *>(MAP_FAILED))
+        , _sqes_size   (0)
+        , _unsubmitted (0)
+        , _failed      (false)
+    { }
+
+    ~uring_backend()
+    {
+        if (_sqes != MAP_FAILED) {
+            ::munmap(_sqes, _sqes_size);
+        }
+        if (_cq_ring != MAP_FAILED && _cq_ring != _sq_ring) {
+            ::munmap(_cq_ring, _cq_ring_size);
+        }
+        if (_sq_ring != MAP_FAILED) {
+            ::munmap(_sq_ring, _sq_ring_size);
+        }
+        if (_ring >= 0) {
+            ::close(_ring);
+        }
+    }
+
+public:
+    bool setup(size_t depth)
+    {
+        struct io_uring_params params;
+
+        ::memset(&params, 0, sizeof(params));
+        _ring = ::syscall(__NR_io_uring_setup, static_cast<unsigned>(depth),
+                &params);
+        if (_ring < 0)
+            return false;
+
+        _sq_ring_size = params.sq_off.array +
+            params.sq_entries * sizeof(unsigned);
+        _cq_ring_size = params.cq_off.cqes +
+            params.cq_entries * sizeof(struct io_uring_cqe);
+
+#ifdef IORING_FEAT_SINGLE_MMAP
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            _sq_ring_size = _cq_ring_size =
+                std::max(_sq_ring_size, _cq_ring_size);
+        }
+#endif
+
+        _sq_ring = ::mmap(nullptr, _sq_ring_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, _ring, IORING_OFF_SQ_RING);
+        if (_sq_ring == MAP_FAILED)
+            return false;
+
+#ifdef IORING_FEAT_SINGLE_MMAP
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            _cq_ring = _sq_ring;
+        } else
+#endif
+        {
+            _cq_ring = ::mmap(nullptr, _cq_ring_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, _ring, IORING_OFF_CQ_RING);
+            if (_cq_ring == MAP_FAILED)
+                return false;
+        }
+
+        _sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+        _sqes = reinterpret_cast<struct io_uring_sqe *>(::mmap(nullptr,
+                    _sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, _ring, IORING_OFF_SQES));
+        if (_sqes == MAP_FAILED)
+            return false;
+
+        auto sq = reinterpret_cast<uint8_t *>(_sq_ring);
+        auto cq = reinterpret_cast<uint8_t *>(_cq_ring);
+
+        _sq_tail  = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        _sq_mask  = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        _sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        _cq_head  = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        _cq_tail  = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        _cq_mask  = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        _cqes     = reinterpret_cast<struct io_uring_cqe *>(cq +
+                params.cq_off.cqes);
+
+        //
+        // No more requests than submission entries are ever in flight,
+        // and there are at least as many completion entries.
+        //
+        _slots.resize(params.sq_entries);
+        for (size_t n = params.sq_entries; n > 0; n--) {
+            _free.push_back(n - 1);
+        }
+
+        return true;
+    }
+
+public:
+    bool submit(io_queue::request *request) override
+    {
+        if (_failed) {
+            errno = EIO;
+            return false;
+        }
+
+        if (_free.empty()) {
+            errno = EAGAIN;
+            return false;
+        }
+
+        size_t index = _free.back();
+        _free.pop_back();
+
+        auto &s = _slots[index];
+        s.iov.iov_base = request->buffer;
+        s.iov.iov_len  = request->count * _device->get_block_size();
+        s.request      = request;
+
+        unsigned tail = *_sq_tail;
+        unsigned entry = tail & *_sq_mask;
+        auto     sqe  = &_sqes[entry];
+
+        ::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode    = IORING_OP_READV;
+        sqe->fd        = descriptor(_device);
+        sqe->addr      = reinterpret_cast<uint64_t>(&s.iov);
+        sqe->len       = 1;
+        sqe->off       = request->lba * _device->get_block_size();
+        sqe->user_data = index;
+
+        _sq_array[entry] = entry;
+        __atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+        _unsubmitted++;
+
+        account(_device, 1, 0, 0);
+        return true;
+    }
+
+    void flush() override
+    {
+        enter(0);
+    }
+
+    size_t complete(io_queue::request **requests, size_t count,
+            bool wait) override
+    {
+        size_t n = take_aborted(requests, count);
+        if (n != 0)
+            return n;
+
+        n = reap(requests, count);
+        if (n != 0 || (_unsubmitted == 0 && !wait))
+            return n;
+
+        if (!_failed && enter(wait && _free.size() != _slots.size() ? 1 : 0))
+            return reap(requests, count);
+
+        n = take_aborted(requests, count);
+        if (n != 0)
+            return n;
+
+        //
+        // The kernel writes into the buffers of the requests it was handed
+        // until they complete, they are waited for even though the ring
+        // failed, so that their callers do not release the buffers early.
+        //
+        while (wait && _free.size() != _slots.size()) {
+            n = reap(requests, count);
+            if (n != 0)
+                return n;
+
+            if (::syscall(__NR_io_uring_enter, _ring, 0, 1,
+                        IORING_ENTER_GETEVENTS, nullptr, 0) < 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+
+        return reap(requests, count);
+    }
+
+private:
+    bool enter(unsigned min_complete)
+    {
+        while (_unsubmitted != 0 || min_complete != 0) {
+            long result = ::syscall(__NR_io_uring_enter, _ring, _unsubmitted,
+                    min_complete, min_complete ? IORING_ENTER_GETEVENTS : 0,
+                    nullptr, 0);
+            if (result < 0) {
+                if (errno == EINTR)
+                    continue;
+
+                //
+                // The kernel is short of resources or of completion
+                // entries for a while.
+                //
+                if (errno == EAGAIN || errno == EBUSY) {
+                    std::this_thread::yield();
+                    continue;
+                }
+
+                fail(errno);
+                return false;
+            }
+
+            account(_device, 0, 1, 0);
+            _unsubmitted -= static_cast<unsigned>(result);
+            break;
+        }
+
+        return true;
+    }
+
+    //
+    // Takes back the entries not handed to the kernel yet, which fail
+    // with error, and refuses further requests.
+    //
+    void fail(int error)
+    {
+        unsigned tail = *_sq_tail;
+
+        _failed = true;
+
+        for (; _unsubmitted != 0; _unsubmitted--) {
+            tail--;
+
+            auto  index   = static_cast<size_t>(
+                    _sqes[tail & *_sq_mask].user_data);
+            auto  request = _slots[index].request;
+
+            request->nread = 0;
+            request->error = error;
+
+            _free.push_back(index);
+            _aborted.push_front(request);
+        }
+
+        __atomic_store_n(_sq_tail, tail, __ATOMIC_RELEASE);
+    }
+
+    size_t take_aborted(io_queue::request **requests, size_t count)
+    {
+        size_t n;
+
+        for (n = 0; n < count && !_aborted.empty(); n++) {
+            requests[n] = _aborted.front();
+            _aborted.pop_front();
+        }
+
+        return n;
+    }
+
+    size_t reap(io_queue::request **requests, size_t count)
+    {
+        unsigned head  = *_cq_head;
+        unsigned tail  = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+        size_t   n     = 0;
+        size_t   bsize = _device->get_block_size();
+
+        for (; head != tail && n < count; head++) {
+            auto  cqe     = &_cqes[head & *_cq_mask];
+            auto  index   = static_cast<size_t>(cqe->user_data);
+            auto  request = _slots[index].request;
+
+            if (cqe->res < 0) {
+                request->nread = 0;
+                request->error = -cqe->res;
+            } else {
+                request->nread = cqe->res / bsize;
+                request->error = 0;
+                account(_device, 0, 0, request->nread);
+            }
+
+            _free.push_back(index);
+            requests[n++] = request;
+        }
+
+        __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+        return n;
+    }
+};
+#endif
+
+}
+
+io_queue::io_queue()
+    : _device   (nullptr)
+    , _type     (BACKEND_SYNC)
+    , _depth    (0)
+    , _in_flight(0)
+{
+}
+
+io_queue::~io_queue()
+{
+    close();
+}
+
+bool io_queue::
+is_supported(backend_type type)
+{
+    switch (type) {
+        case BACKEND_DEFAULT:
+        case BACKEND_SYNC:
+        case BACKEND_THREADS:
+            return true;
+
+        case BACKEND_URING:
+#ifdef HAVE_LINUX_IO_URING_H
+            {
+                //
+                // The kernel may lack io_uring or deny it, probe once.
+                //
+                static int supported = -1;
+                if (supported < 0) {
+                    uring_backend probe(nullptr);
+                    supported = probe.setup(1) ? 1 : 0;
+                }
+                return supported != 0;
+            }
+#else
+            return false;
+#endif
+    }
+
+    return false;
+}
+
+char const *io_queue::
+get_backend_name(backend_type type)
+{
+    switch (type) {
+        case BACKEND_SYNC:
+            return "sync";
+        case BACKEND_THREADS:
+            return "threads";
+        case BACKEND_URING:
+            return "io_uring";
+        default:
+            return "default";
+    }
+}
+
+bool io_queue::
+parse_backend_name(char const *name, backend_type &type)
+{
+    static backend_type const types[] = {
+        BACKEND_DEFAULT, BACKEND_SYNC, BACKEND_THREADS, BACKEND_URING
+    };
+
+    for (auto t : types) {
+        if (::strcmp(name, get_backend_name(t)) == 0) {
+            type = t;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool io_queue::
+open(device const *device, backend_type type, size_t depth)
+{
+    close();
+
+    if (device == nullptr || depth == 0) {
+        errno = EINVAL;
+        return false;
+    }
+
+    if (type == BACKEND_DEFAULT) {
+        type = is_supported(BACKEND_URING) ? BACKEND_URING : BACKEND_THREADS;
+    }
+
+    switch (type) {
+        case BACKEND_SYNC:
+            _backend.reset(new (std::nothrow) sync_backend(device));
+            break;
+
+        case BACKEND_THREADS:
+            _backend.reset(new (std::nothrow) thread_backend(device, depth));
+            break;
+
+        case BACKEND_URING:
+#ifdef HAVE_LINUX_IO_URING_H
+            {
+                std::unique_ptr<uring_backend> uring(new (std::nothrow)
+                        uring_backend(device));
+                if (uring && uring->setup(depth)) {
+                    _backend.reset(uring.release());
+                }
+            }
+            break;
+#else
+            errno = ENOTSUP;
+            return false;
+#endif
+
+        default:
+            errno = EINVAL;
+            return false;
+    }
+
+    if (!_backend) {
+        if (errno == 0) {
+            errno = ENOMEM;
+        }
+        return false;
+    }
+
+    _device = device;
+    _type   = type;
+    _depth  = depth;
+
+    return true;
+}
+
+void io_queue::
+close()
+{
+    //
+    // Requests still in flight are waited for, as they write into the
+    // caller buffers.
+    //
+    while (_in_flight != 0) {
+        request *done[16];
+        if (complete(done, 16, true) == 0)
+            break;
+    }
+
+    _backend.reset();
+    _device    = nullptr;
+    _depth     = 0;
+    _in_flight = 0;
+}
+
+bool io_queue::
+submit(request *request)
+{
+    if (!_backend) {
+        errno = EBADF;
+        return false;
+    }
+
+    if (_in_flight >= _depth) {
+        errno = EAGAIN;
+        return false;
+    }
+
+    if (request->count == 0 || request->buffer == nullptr) {
+        errno = EINVAL;
+        return false;
+    }
+
+    if (request->lba >= _device->get_block_count() ||
+            request->count > _device->get_block_count() - request->lba) {
+        errno = E2BIG;
+        return false;
+    }
+
+    request->nread = 0;
+    request->error = 0;
+
+    if (!_backend->submit(request))
+        return false;
+
+    _in_flight++;
+    return true;
+}
+
+void io_queue::
+flush()
+{
+    if (_backend) {
+        _backend->flush();
+    }
+}
+
+size_t io_queue::
+complete(request **requests, size_t count, bool wait)
+{
+    if (!_backend || _in_flight == 0 || count == 0)
+        return 0;
+
+    size_t n = _backend->complete(requests, count, wait);
+    _in_flight -= n;
+
+    return n;
+}
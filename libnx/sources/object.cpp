@@ -21,7 +21,7 @@
  */
 
 #include "nx/object.h"
-#include "nx/enumerator.h"
+#include "nx/basic_enumerator.h"
 
 #include "nxcompat/nxcompat.h"
 
@@ -45,18 +45,23 @@ object::~object()
 bool object::
 read_omap(device *device, uint64_t lba, nx_omap_t *&omap) const
 {
-    omap = device->new_block <nx_omap_t> ();
-    if (omap == nullptr) {
-        _context->log(severity::fatal, "not enough memory to allocate "
-                "object map");
-        return false;
-    }
-
-    if (!device->read(lba, omap, false)) {
-        _context->log(severity::fatal, "cannot read object map at lba "
-                "%" PRIu64 ": %s", lba, ::strerror(errno));
-        nx::device::free_block(omap);
-        return false;
+    omap = device->lookup_block <nx_omap_t> (lba);
+
+    bool cached = (omap != nullptr);
+    if (!cached) {
+        omap = device->new_block <nx_omap_t> ();
+        if (omap == nullptr) {
+            _context->log(severity::fatal, "not enough memory to allocate "
+                    "object map");
+            return false;
+        }
+
+        if (!device->read(lba, omap, false)) {
+            _context->log(severity::fatal, "cannot read object map at lba "
+                    "%" PRIu64 ": %s", lba, ::strerror(errno));
+            nx::device::free_block(omap);
+            return false;
+        }
     }
 
     if (nx::swap(omap->om_o.o_type) != NX_OBJECT_DIRECT_TYPE(OBJECT_MAP)) {
@@ -66,7 +71,10 @@ read_omap(device *device, uint64_t lba, nx_omap_t *&omap) const
         return false;
     }
 
-    if (!::nx_object_verify(&omap->om_o)) {
+    if (cached)
+        return true;
+
+    if (!device->verify_block(lba, &omap->om_o)) {
         _context->log(severity::error, "object map verification failed, "
                 "checksum mismatch (expected %#" PRIx64 ", got %#"
                 PRIx64 ")", nx::swap(omap->om_o.o_checksum),
@@ -75,43 +83,67 @@ read_omap(device *device, uint64_t lba, nx_omap_t *&omap) const
         return false;
     }
 
+    device->cache_block(lba, omap);
+
     return true;
 }
 
 bool object::
 read_btn(device *device, uint64_t lba, nx_btn_t *&btn) const
 {
-    btn = device->new_block <nx_btn_t> ();
-    if (btn == nullptr) {
-        _context->log(severity::fatal, "not enough memory to allocate "
-                "btree node");
-        return false;
+    //
+    // Nodes of mapped devices are used in place, they are neither copied
+    // nor cached.
+    //
+    btn = device->map_block <nx_btn_t> (lba);
+
+    bool mapped = (btn != nullptr);
+    bool cached = false;
+    if (!mapped) {
+        btn = device->lookup_block <nx_btn_t> (lba);
+        cached = (btn != nullptr);
     }
 
-    if (!device->read(lba, btn, false)) {
-        _context->log(severity::fatal, "cannot read btree node at lba "
-                "%" PRIu64 ": %s", lba, ::strerror(errno));
-        nx::device::free_block(btn);
-        return false;
+    if (!mapped && !cached) {
+        btn = device->new_block <nx_btn_t> ();
+        if (btn == nullptr) {
+            _context->log(severity::fatal, "not enough memory to allocate "
+                    "btree node");
+            return false;
+        }
+
+        if (!device->read(lba, btn, false)) {
+            _context->log(severity::fatal, "cannot read btree node at lba "
+                    "%" PRIu64 ": %s", lba, ::strerror(errno));
+            nx::device::free_block(btn);
+            return false;
+        }
     }
 
     if (NX_OBJECT_GET_TYPE(nx::swap(btn->btn_o.o_type)) != NX_OBJECT_TYPE_BTREE_ROOT &&
         NX_OBJECT_GET_TYPE(nx::swap(btn->btn_o.o_type)) != NX_OBJECT_TYPE_BTREE_NODE) {
         _context->log(severity::error, "block %" PRIu64 " is not a "
                 "btree node block", lba);
-        nx::device::free_block(btn);
+        device->release_block(btn);
         return false;
     }
 
-    if (!::nx_object_verify(&btn->btn_o)) {
+    if (cached)
+        return true;
+
+    if (!device->verify_block(lba, &btn->btn_o)) {
         _context->log(severity::error, "btree node verification failed, "
                 "checksum mismatch (expected %#" PRIx64 ", got %#"
                 PRIx64 ")", nx::swap(btn->btn_o.o_checksum),
                 ::nx_object_checksum(&btn->btn_o));
-        nx::device::free_block(btn);
+        device->release_block(btn);
         return false;
     }
 
+    if (!mapped) {
+        device->cache_block(lba, btn);
+    }
+
     return true;
 }
 
@@ -135,9 +167,10 @@ bool object::
 lookup_omap_oid(device *device, nx_omap_t const *omap, uint64_t oid,
         uint32_t type, uint64_t &paddr, uint64_t &size) const
 {
-    enumerator e(const_cast<object *>(this), device,
-            nx::swap(omap->om_tree_oid), oid, nx::swap(omap->om_tree_type));
-    if (!e.reset())
+    basic_enumerator<physical_mapper, btn_u64_comparer> e(_context, device,
+            nx::swap(omap->om_tree_oid), nx::swap(omap->om_tree_type),
+            physical_mapper());
+    if (!e.seek(btn_u64_comparer{ oid }))
         return false;
 
     sized_value_type k, v;
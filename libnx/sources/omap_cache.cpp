@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2017-present Orlando Bassotto
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "nx/omap_cache.h"
+
+using nx::omap_cache;
+
+omap_cache::omap_cache(size_t size)
+{
+    resize(size);
+}
+
+void omap_cache::
+resize(size_t size)
+{
+    std::lock_guard<std::mutex> _(_lock);
+
+    //
+    // Object ids are never zero, an all zero slot is thus empty.
+    //
+    _slots.assign(size, slot());
+    _stats.entries = 0;
+}
+
+void omap_cache::
+clear()
+{
+    resize(get_size());
+}
+
+omap_cache::stats omap_cache::
+get_stats() const
+{
+    std::lock_guard<std::mutex> _(_lock);
+    return _stats;
+}
+
+bool omap_cache::
+lookup(uint64_t oid, uint64_t xid, uint64_t &paddr, uint64_t &size) const
+{
+    std::lock_guard<std::mutex> _(_lock);
+
+    if (_slots.empty() || oid == 0)
+        return false;
+
+    auto const &s = _slots[index_of(oid, xid)];
+    if (s.oid != oid || s.xid != xid) {
+        _stats.misses++;
+        return false;
+    }
+
+    paddr = s.paddr;
+    size  = s.size;
+
+    _stats.hits++;
+
+    return true;
+}
+
+void omap_cache::
+insert(uint64_t oid, uint64_t xid, uint64_t paddr, uint64_t size)
+{
+    std::lock_guard<std::mutex> _(_lock);
+
+    if (_slots.empty() || oid == 0)
+        return;
+
+    auto &s = _slots[index_of(oid, xid)];
+    if (s.oid == 0) {
+        _stats.entries++;
+    }
+
+    s.oid   = oid;
+    s.xid   = xid;
+    s.paddr = paddr;
+    s.size  = size;
+
+    _stats.inserts++;
+}
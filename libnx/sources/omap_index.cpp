@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2017-present Orlando Bassotto
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "nx/omap_index.h"
+
+#include <algorithm>
+
+using nx::omap_index;
+
+omap_index::omap_index()
+    : _sorted(true)
+{
+}
+
+void omap_index::
+add(uint64_t oid, uint64_t paddr)
+{
+    if (!_staging.empty()) {
+        uint64_t last = _staging.back().oid;
+        if (oid == last)
+            return;
+        if (oid < last) {
+            _sorted = false;
+        }
+    }
+
+    _staging.push_back({ oid, paddr });
+}
+
+void omap_index::
+finish()
+{
+    if (!_sorted) {
+        std::stable_sort(_staging.begin(), _staging.end(),
+                [](staged const &a, staged const &b)
+                { return a.oid < b.oid; });
+        _staging.erase(std::unique(_staging.begin(), _staging.end(),
+                    [](staged const &a, staged const &b)
+                    { return a.oid == b.oid; }), _staging.end());
+    }
+
+    //
+    // Slot zero is unused so that the children of k are 2k and 2k + 1.
+    //
+    _oids.assign(_staging.size() + 1, 0);
+    _paddrs.assign(_staging.size() + 1, 0);
+    layout(0, 1);
+
+    std::vector<staged>().swap(_staging);
+    _sorted = true;
+}
+
+void omap_index::
+clear()
+{
+    std::vector<staged>().swap(_staging);
+    std::vector<uint64_t>().swap(_oids);
+    std::vector<uint64_t>().swap(_paddrs);
+    _sorted = true;
+}
+
+size_t omap_index::
+layout(size_t i, size_t k)
+{
+    //
+    // In-order walk of the implicit tree, assigning the sorted entries.
+    //
+    if (k < _oids.size()) {
+        i = layout(i, 2 * k);
+        _oids[k]   = _staging[i].oid;
+        _paddrs[k] = _staging[i].paddr;
+        i = layout(i + 1, 2 * k + 1);
+    }
+
+    return i;
+}
+
+bool omap_index::
+lookup(uint64_t oid, uint64_t &paddr) const
+{
+    size_t n = size();
+    size_t k = 1;
+
+    while (k <= n) {
+        k = 2 * k + (_oids[k] < oid);
+    }
+
+    //
+    // Drop the trailing right turns and the final left turn, what remains
+    // is the smallest entry not less than oid.
+    //
+    while (k & 1) {
+        k >>= 1;
+    }
+    k >>= 1;
+
+    if (k == 0 || _oids[k] != oid)
+        return false;
+
+    paddr = _paddrs[k];
+
+    return true;
+}
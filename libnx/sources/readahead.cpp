@@ -0,0 +1,460 @@
+/*
+ * Copyright (c) 2017-present Orlando Bassotto
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "nx/readahead.h"
+#include "nx/device.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+using nx::readahead;
+using nx::io_queue;
+
+readahead::readahead(device const *device, mapper_type const &mapper,
+        size_t depth)
+    : _device      (device)
+    , _mapper      (mapper)
+    , _max_window  (device->get_readahead())
+    , _depth       (std::max(depth, static_cast<size_t>(1)))
+    , _window      (std::min(static_cast<size_t>(MIN_WINDOW), _max_window))
+    , _next        (0)
+    , _queue_failed(false)
+{
+    for (auto &w : _windows) {
+        w.start       = 0;
+        w.count       = 0;
+        w.valid       = 0;
+        w.used        = 0;
+        w.nruns       = 0;
+        w.submitted   = 0;
+        w.capacity    = 0;
+    }
+}
+
+readahead::~readahead()
+{
+    reset();
+}
+
+readahead::stats readahead::
+get_stats() const
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    return _stats;
+}
+
+void readahead::
+reset()
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    for (auto &w : _windows) {
+        drop(w);
+    }
+
+    _window = std::min(static_cast<size_t>(MIN_WINDOW), _max_window);
+}
+
+bool readahead::
+map(uint64_t block, uint64_t &lba, size_t &count) const
+{
+    if (_mapper)
+        return _mapper(block, lba, count);
+
+    if (block >= _device->get_block_count())
+        return false;
+
+    lba   = block;
+    count = _device->get_block_count() - block;
+    return true;
+}
+
+bool readahead::
+read(uint64_t block, void *blocks, size_t count, size_t *nread)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    auto   bytes = reinterpret_cast<uint8_t *>(blocks);
+    size_t done  = 0;
+
+    _stats.reads++;
+
+    //
+    // Without an asynchronous backend windows would be read when fetched,
+    // in the way of the read that wanted a few blocks of them.
+    //
+    if (_device->is_mapped() || _max_window == 0 ||
+            _device->get_io_backend() == io_queue::BACKEND_SYNC) {
+        done = read_direct(block, bytes, count);
+    } else {
+        reap();
+
+        //
+        // A read continuing the previous one, or falling in a window,
+        // keeps the stream sequential; any other read drops the windows
+        // and starts again from the smallest one.
+        //
+        bool sequential = (block == _next || find_window(block) != nullptr);
+        if (!sequential) {
+            for (auto &w : _windows) {
+                drop(w);
+            }
+            _window = std::min(static_cast<size_t>(MIN_WINDOW), _max_window);
+        }
+
+        while (done < count) {
+            uint64_t at = block + done;
+            auto     w  = find_window(at);
+
+            if (w != nullptr) {
+                wait(*w);
+
+                size_t offset = at - w->start;
+                if (offset < w->valid) {
+                    size_t n = std::min(count - done, w->valid - offset);
+                    memcpy(bytes + done * NX_OBJECT_SIZE,
+                            w->buffer.get() + offset * NX_OBJECT_SIZE,
+                            n * NX_OBJECT_SIZE);
+                    w->used = std::max(w->used, offset + n);
+                    _stats.hits += n;
+                    done += n;
+                    continue;
+                }
+            }
+
+            //
+            // Blocks missing from the windows are read on demand, up to
+            // the next window.
+            //
+            size_t limit = count - done;
+            for (auto const &o : _windows) {
+                if (o.count != 0 && o.start > at) {
+                    limit = std::min(limit, static_cast<size_t>(o.start - at));
+                }
+            }
+
+            size_t n = read_direct(at, bytes + done * NX_OBJECT_SIZE, limit);
+            _stats.misses += n;
+            done += n;
+            if (n < limit)
+                break;
+        }
+
+        _next = block + done;
+
+        if (sequential && done == count) {
+            prefetch();
+        }
+    }
+
+    if (nread != nullptr) {
+        *nread = done;
+    }
+
+    if (done < count) {
+        if (errno == 0) {
+            errno = EIO;
+        }
+        return false;
+    }
+
+    return true;
+}
+
+size_t readahead::
+read_direct(uint64_t block, uint8_t *blocks, size_t count)
+{
+    size_t done = 0;
+
+    while (done < count) {
+        device::read_request requests[MAX_RUNS];
+        size_t               nrequests = 0;
+        size_t               planned   = 0;
+
+        while (done + planned < count && nrequests < MAX_RUNS) {
+            uint64_t lba;
+            size_t   run;
+
+            if (!map(block + done + planned, lba, run))
+                break;
+
+            auto &r = requests[nrequests++];
+            r.lba    = lba;
+            r.count  = std::min(run, count - done - planned);
+            r.buffer = blocks + (done + planned) * NX_OBJECT_SIZE;
+            r.nread  = 0;
+
+            planned += r.count;
+        }
+
+        if (nrequests == 0)
+            break;
+
+        _device->read_batch(requests, nrequests);
+
+        for (size_t n = 0; n < nrequests; n++) {
+            done += requests[n].nread;
+            if (requests[n].nread != requests[n].count)
+                return done;
+        }
+    }
+
+    return done;
+}
+
+readahead::window *readahead::
+find_window(uint64_t block)
+{
+    for (auto &w : _windows) {
+        if (w.count != 0 && block >= w.start && block - w.start < w.count)
+            return &w;
+    }
+
+    return nullptr;
+}
+
+readahead::window *readahead::
+free_window()
+{
+    for (auto &w : _windows) {
+        if (w.count == 0)
+            return &w;
+    }
+
+    for (auto &w : _windows) {
+        if (w.start + w.count <= _next) {
+            drop(w);
+            return &w;
+        }
+    }
+
+    return nullptr;
+}
+
+void readahead::
+prefetch()
+{
+    uint64_t end = _next;
+
+    for (auto const &w : _windows) {
+        if (w.count != 0) {
+            end = std::max(end, w.start + w.count);
+        }
+    }
+
+    //
+    // The next window is fetched once less than a window is left ahead of
+    // the stream, and the window then doubles.
+    //
+    if (end - _next >= _window)
+        return;
+
+    auto w = free_window();
+    if (w == nullptr)
+        return;
+
+    fetch(*w, end, _window);
+    if (w->count != 0) {
+        _stats.windows++;
+        _window = std::min(_window * 2, _max_window);
+    }
+}
+
+void readahead::
+fetch(window &w, uint64_t start, size_t count)
+{
+    if (_queue_failed || !_device->open_io_queue()) {
+        _queue_failed = true;
+        return;
+    }
+
+    if (w.capacity < count) {
+        w.buffer.reset(new (std::nothrow) uint8_t[count * NX_OBJECT_SIZE]);
+        w.capacity = (w.buffer != nullptr) ? count : 0;
+        if (w.capacity == 0)
+            return;
+    }
+
+    w.start     = start;
+    w.count     = 0;
+    w.valid     = 0;
+    w.used      = 0;
+    w.nruns     = 0;
+    w.submitted = 0;
+
+    while (w.count < count && w.nruns < MAX_RUNS) {
+        uint64_t lba;
+        size_t   run;
+
+        if (!map(start + w.count, lba, run))
+            break;
+
+        auto &r = w.runs[w.nruns++];
+        r.lba    = lba;
+        r.count  = std::min(run, count - w.count);
+        r.buffer = w.buffer.get() + w.count * NX_OBJECT_SIZE;
+        r.nread  = 0;
+        r.error  = 0;
+
+        w.count += r.count;
+    }
+
+    if (w.count == 0)
+        return;
+
+    _stats.prefetched += w.count;
+
+    submit_pending();
+}
+
+void readahead::
+drop(window &w)
+{
+    if (w.count == 0)
+        return;
+
+    wait(w);
+
+    if (w.valid > w.used) {
+        _stats.wasted += w.valid - w.used;
+    }
+
+    w.count = 0;
+    w.valid = 0;
+    w.used  = 0;
+    w.nruns = 0;
+}
+
+void readahead::
+wait(window &w)
+{
+    while (!_queue_failed &&
+            (w.submitted < w.nruns || get_in_flight(w) != 0)) {
+        submit_pending();
+
+        //
+        // Runs not yet submitted wait for the other window, or for other
+        // streams, to leave room on the queue.
+        //
+        window *o = &w;
+        if (get_in_flight(w) == 0) {
+            o = (&w == &_windows[0]) ? &_windows[1] : &_windows[0];
+        }
+
+        if (get_in_flight(*o) != 0) {
+            if (!_device->wait_queued(o->tracker)) {
+                fail();
+            }
+        } else if (w.submitted < w.nruns) {
+            _device->reap_queued(true);
+        }
+    }
+
+    finish(w);
+}
+
+void readahead::
+submit_pending()
+{
+    window *order[2] = { &_windows[0], &_windows[1] };
+
+    //
+    // Runs are submitted in stream order as the queue drains, the window
+    // nearest to the stream first.
+    //
+    if (order[1]->start < order[0]->start) {
+        std::swap(order[0], order[1]);
+    }
+
+    size_t in_flight = get_in_flight(*order[0]) + get_in_flight(*order[1]);
+
+    for (auto w : order) {
+        while (w->submitted < w->nruns && in_flight < _depth) {
+            size_t count = std::min(w->nruns - w->submitted,
+                    _depth - in_flight);
+            size_t n     = _device->submit_queued(w->runs + w->submitted,
+                    count, w->tracker);
+
+            w->submitted += n;
+            in_flight    += n;
+            if (n < count) {
+                if (errno != EAGAIN) {
+                    fail();
+                }
+                return;
+            }
+        }
+    }
+}
+
+void readahead::
+reap()
+{
+    if (get_in_flight(_windows[0]) + get_in_flight(_windows[1]) != 0) {
+        _device->reap_queued(false);
+    }
+
+    submit_pending();
+}
+
+void readahead::
+fail()
+{
+    //
+    // Runs not yet submitted are given up and the stream is read directly
+    // from now on. Runs in flight are waited for, as their buffers are
+    // still written to; the buffer of a window the queue cannot reap is
+    // left to it.
+    //
+    _queue_failed = true;
+
+    for (auto &w : _windows) {
+        for (size_t n = w.submitted; n < w.nruns; n++) {
+            w.runs[n].nread = 0;
+        }
+        w.submitted = w.nruns;
+
+        if (get_in_flight(w) != 0 && !_device->wait_queued(w.tracker)) {
+            for (size_t n = 0; n < w.nruns; n++) {
+                w.runs[n].nread = 0;
+            }
+            w.buffer.release();
+            w.capacity = 0;
+        }
+
+        finish(w);
+    }
+}
+
+void readahead::
+finish(window &w)
+{
+    //
+    // The window holds the blocks up to the first short run.
+    //
+    w.valid = 0;
+    for (size_t n = 0; n < w.nruns; n++) {
+        w.valid += w.runs[n].nread;
+        if (w.runs[n].nread != w.runs[n].count)
+            break;
+    }
+}
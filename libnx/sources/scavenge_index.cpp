@@ -0,0 +1,447 @@
+/*
+ * Copyright (c) 2017-present Orlando Bassotto
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "nx/scavenge_index.h"
+#include "nx/device.h"
+#include "nx/swap.h"
+
+#include "nxcompat/nxcompat.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <numeric>
+#include <tuple>
+
+using nx::scavenge_index;
+
+struct scavenge_index::header {
+    uint64_t  magic;
+    uint32_t  version;
+    uint32_t  entry_size;
+    uint32_t  block_size;
+    uint32_t  reserved0;
+    uint64_t  block_count;
+    uint64_t  start;
+    uint64_t  end;
+    uint64_t  count;
+    nx_uuid_t uuid;
+    uint64_t  xid;
+    uint64_t  reserved1;
+};
+
+namespace {
+
+uint64_t const INDEX_MAGIC   = 0x584449564353584eULL; /* NXSCVIDX */
+uint32_t const INDEX_VERSION = 1;
+
+typedef scavenge_index::entry entry;
+
+inline std::tuple<uint32_t, uint32_t, uint64_t, uint64_t, uint64_t>
+oid_key(entry const &e)
+{
+    return std::make_tuple(NX_OBJECT_GET_TYPE(e.type), e.subtype, e.oid,
+            e.xid, e.paddr);
+}
+
+inline std::tuple<uint32_t, uint32_t, uint64_t, uint64_t, uint64_t>
+xid_key(entry const &e)
+{
+    return std::make_tuple(NX_OBJECT_GET_TYPE(e.type), e.subtype, e.xid,
+            e.oid, e.paddr);
+}
+
+}
+
+scavenge_index::scavenge_index()
+    : _block_size (0)
+    , _block_count(0)
+    , _start      (0)
+    , _end        (0)
+    , _xid        (0)
+    , _map        (nullptr)
+    , _map_size   (0)
+    , _entries    (nullptr)
+    , _by_oid     (nullptr)
+    , _by_xid     (nullptr)
+    , _count      (0)
+{
+    memset(&_uuid, 0, sizeof(_uuid));
+}
+
+scavenge_index::~scavenge_index()
+{
+    close();
+}
+
+bool scavenge_index::
+identify(device const *device, nx_uuid_t &uuid, uint64_t &xid) const
+{
+    memset(&uuid, 0, sizeof(uuid));
+    xid = 0;
+
+    auto super = device->new_block<nx_super_t>();
+    if (super == nullptr)
+        return false;
+
+    if (device->read(0, super, true) &&
+            nx::swap(super->nx_signature) == NX_SUPER_SIGNATURE) {
+        uuid = super->nx_uuid;
+        xid  = nx::swap(super->nx_o.o_xid);
+    }
+
+    device::free_block(super);
+    return true;
+}
+
+void scavenge_index::
+reset(device const *device, uint64_t start, uint64_t end)
+{
+    close();
+
+    _block_size  = device->get_block_size();
+    _block_count = device->get_block_count();
+    _start       = std::min(start, _block_count);
+    _end         = std::min(end, _block_count);
+
+    identify(device, _uuid, _xid);
+}
+
+bool scavenge_index::
+add(uint64_t paddr, nx_object_t const *object)
+{
+    if (_built.size() >= UINT32_MAX) {
+        errno = E2BIG;
+        return false;
+    }
+
+    entry e;
+
+    e.paddr   = paddr;
+    e.oid     = nx::swap(object->o_oid);
+    e.xid     = nx::swap(object->o_xid);
+    e.type    = nx::swap(object->o_type);
+    e.subtype = nx::swap(object->o_subtype);
+    e.flags   = 0;
+    e.level   = 0;
+    e.nkeys   = 0;
+
+    switch (NX_OBJECT_GET_TYPE(e.type)) {
+        case NX_OBJECT_TYPE_BTREE_ROOT:
+        case NX_OBJECT_TYPE_BTREE_NODE:
+            {
+                auto btn = reinterpret_cast<nx_btn_t const *>(object);
+                e.flags = nx::swap(btn->btn_flags);
+                e.level = nx::swap(btn->btn_level);
+                e.nkeys = nx::swap(btn->btn_nkeys);
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    _built.push_back(e);
+    return true;
+}
+
+void scavenge_index::
+sort()
+{
+    auto by_paddr = [](entry const &a, entry const &b)
+        { return a.paddr < b.paddr; };
+
+    //
+    // Objects found by an ordered scan come in block order already.
+    //
+    if (!std::is_sorted(_built.begin(), _built.end(), by_paddr)) {
+        std::sort(_built.begin(), _built.end(), by_paddr);
+    }
+
+    size_t count = _built.size();
+
+    _built_orders.resize(count * 2);
+
+    auto by_oid = _built_orders.begin();
+    auto by_xid = by_oid + count;
+
+    std::iota(by_oid, by_xid, 0);
+    std::sort(by_oid, by_xid, [this](uint32_t a, uint32_t b)
+            { return oid_key(_built[a]) < oid_key(_built[b]); });
+
+    std::iota(by_xid, _built_orders.end(), 0);
+    std::sort(by_xid, _built_orders.end(), [this](uint32_t a, uint32_t b)
+            { return xid_key(_built[a]) < xid_key(_built[b]); });
+
+    _entries = _built.data();
+    _by_oid  = _built_orders.data();
+    _by_xid  = _built_orders.data() + count;
+    _count   = count;
+}
+
+bool scavenge_index::
+save(char const *path)
+{
+    if (_map != nullptr || !_loaded.empty()) {
+        errno = EINVAL;
+        return false;
+    }
+
+    sort();
+
+    header h;
+
+    memset(&h, 0, sizeof(h));
+    h.magic       = INDEX_MAGIC;
+    h.version     = INDEX_VERSION;
+    h.entry_size  = sizeof(entry);
+    h.block_size  = _block_size;
+    h.block_count = _block_count;
+    h.start       = _start;
+    h.end         = _end;
+    h.count       = _count;
+    h.uuid        = _uuid;
+    h.xid         = _xid;
+
+    FILE *fp = fopen(path, "wb");
+    if (fp == nullptr)
+        return false;
+
+    bool ok = (fwrite(&h, sizeof(h), 1, fp) == 1 &&
+            fwrite(_entries, sizeof(entry), _count, fp) == _count &&
+            fwrite(_by_oid, sizeof(uint32_t), _count * 2, fp) == _count * 2);
+
+    if (fclose(fp) != 0) {
+        ok = false;
+    }
+
+    if (!ok) {
+        int error = errno;
+        remove(path);
+        errno = error;
+    }
+
+    return ok;
+}
+
+bool scavenge_index::
+attach(uint8_t const *data, size_t size)
+{
+    header h;
+
+    if (size < sizeof(h)) {
+        errno = EINVAL;
+        return false;
+    }
+
+    memcpy(&h, data, sizeof(h));
+
+    if (h.magic != INDEX_MAGIC || h.version != INDEX_VERSION ||
+            h.entry_size != sizeof(entry) || h.count > UINT32_MAX ||
+            size != sizeof(h) + h.count * (sizeof(entry) +
+                2 * sizeof(uint32_t))) {
+        errno = EINVAL;
+        return false;
+    }
+
+    _block_size  = h.block_size;
+    _block_count = h.block_count;
+    _start       = h.start;
+    _end         = h.end;
+    _uuid        = h.uuid;
+    _xid         = h.xid;
+    _count       = h.count;
+    _entries     = reinterpret_cast<entry const *>(data + sizeof(h));
+    _by_oid      = reinterpret_cast<uint32_t const *>(_entries + _count);
+    _by_xid      = _by_oid + _count;
+
+    //
+    // The orders are trusted by the queries, check they stay in range.
+    //
+    for (size_t n = 0; n < _count * 2; n++) {
+        if (_by_oid[n] >= _count) {
+            errno = EINVAL;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool scavenge_index::
+open(char const *path, device const *device)
+{
+    struct stat stbuf;
+
+    close();
+
+    int fd = ::open(path, O_RDONLY | O_BINARY);
+    if (fd < 0)
+        return false;
+
+    if (::fstat(fd, &stbuf) < 0) {
+        ::close(fd);
+        return false;
+    }
+
+    size_t         size = stbuf.st_size;
+    uint8_t const *data = nullptr;
+
+#ifdef HAVE_SYS_MMAN_H
+    if (size != 0) {
+        void *map = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED) {
+            _map      = map;
+            _map_size = size;
+            data      = reinterpret_cast<uint8_t const *>(map);
+        }
+    }
+#endif
+
+    if (data == nullptr) {
+        _loaded.resize(size);
+
+        size_t nread = 0;
+        while (nread < size) {
+            ssize_t n = ::read(fd, &_loaded[nread], size - nread);
+            if (n <= 0) {
+                if (n == 0) {
+                    errno = EINVAL;
+                }
+                int error = errno;
+                ::close(fd);
+                close();
+                errno = error;
+                return false;
+            }
+            nread += n;
+        }
+
+        data = _loaded.data();
+    }
+
+    ::close(fd);
+
+    if (!attach(data, size)) {
+        int error = errno;
+        close();
+        errno = error;
+        return false;
+    }
+
+    if (device != nullptr) {
+        nx_uuid_t uuid;
+        uint64_t  xid;
+
+        if (device->get_block_size() != _block_size ||
+                device->get_block_count() != _block_count ||
+                !identify(device, uuid, xid) || xid != _xid ||
+                memcmp(&uuid, &_uuid, sizeof(uuid)) != 0) {
+            close();
+            errno = ESTALE;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void scavenge_index::
+close()
+{
+#ifdef HAVE_SYS_MMAN_H
+    if (_map != nullptr) {
+        ::munmap(_map, _map_size);
+    }
+#endif
+
+    _map      = nullptr;
+    _map_size = 0;
+    _entries  = nullptr;
+    _by_oid   = nullptr;
+    _by_xid   = nullptr;
+    _count    = 0;
+
+    _built.clear();
+    _built_orders.clear();
+    _loaded.clear();
+}
+
+scavenge_index::entry const *scavenge_index::
+lookup(uint64_t paddr) const
+{
+    auto end = _entries + _count;
+    auto e   = std::lower_bound(_entries, end, paddr,
+            [](entry const &e, uint64_t paddr)
+            { return e.paddr < paddr; });
+
+    return (e != end && e->paddr == paddr) ? e : nullptr;
+}
+
+void scavenge_index::
+find_oid(uint32_t type, uint32_t subtype, uint64_t oid,
+        visitor_type const &visitor) const
+{
+    auto key = std::make_tuple(type, subtype, oid);
+    auto end = _by_oid + _count;
+    auto i   = std::lower_bound(_by_oid, end, key,
+            [this](uint32_t index, decltype(key) const &key)
+            {
+                auto const &e = _entries[index];
+                return std::make_tuple(NX_OBJECT_GET_TYPE(e.type), e.subtype,
+                        e.oid) < key;
+            });
+
+    for (; i != end; ++i) {
+        auto const &e = _entries[*i];
+        if (std::make_tuple(NX_OBJECT_GET_TYPE(e.type), e.subtype,
+                    e.oid) != key)
+            break;
+
+        if (!visitor(e))
+            break;
+    }
+}
+
+void scavenge_index::
+find_xid(uint32_t type, uint32_t subtype, uint64_t min_xid, uint64_t max_xid,
+        visitor_type const &visitor) const
+{
+    auto key = std::make_tuple(type, subtype, min_xid);
+    auto end = _by_xid + _count;
+    auto i   = std::lower_bound(_by_xid, end, key,
+            [this](uint32_t index, decltype(key) const &key)
+            {
+                auto const &e = _entries[index];
+                return std::make_tuple(NX_OBJECT_GET_TYPE(e.type), e.subtype,
+                        e.xid) < key;
+            });
+
+    for (; i != end; ++i) {
+        auto const &e = _entries[*i];
+        if (NX_OBJECT_GET_TYPE(e.type) != type || e.subtype != subtype ||
+                e.xid > max_xid)
+            break;
+
+        if (!visitor(e))
+            break;
+    }
+}
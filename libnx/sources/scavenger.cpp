@@ -0,0 +1,526 @@
+/*
+ * Copyright (c) 2017-present Orlando Bassotto
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "nx/scavenger.h"
+#include "nx/device.h"
+#include "nx/io_queue.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+using nx::scavenger;
+using nx::device;
+using nx::io_queue;
+using nx::space_map;
+
+namespace {
+
+struct chunk {
+    uint64_t                   seq;
+    uint64_t                   lba;
+    size_t                     count;
+    size_t                     nread;
+    int                        error;
+    uint8_t                   *blocks;
+    std::unique_ptr<uint8_t[]> buffer;
+    std::vector<size_t>        found;
+    io_queue::request          request;
+};
+
+//
+// One scan: a reader thread keeps chunks in flight on the queue and hands
+// them to the verifier threads as they are read, verified chunks are then
+// delivered and recycled by the calling thread.
+//
+class pipeline {
+private:
+    device const                       *_device;
+    io_queue                           *_queue;
+    space_map::extent_vector const     &_extents;
+    size_t                              _chunk_size;
+    std::vector<std::unique_ptr<chunk>> _chunks;
+    std::mutex                          _lock;
+    std::condition_variable             _recycled;
+    std::condition_variable             _read;
+    std::condition_variable             _verified;
+    std::vector<chunk *>                _free;
+    std::deque<chunk *>                 _work;
+    std::map<uint64_t, chunk *>         _done;
+    bool                                _stopping;
+
+public:
+    pipeline(device const *device, io_queue *queue,
+            space_map::extent_vector const &extents, size_t chunk_size)
+        : _device    (device)
+        , _queue     (queue)
+        , _extents   (extents)
+        , _chunk_size(chunk_size)
+        , _stopping  (false)
+    { }
+
+public:
+    bool allocate(size_t count);
+    void stop();
+
+    void read();
+    void verify();
+    chunk *wait(bool ordered, uint64_t seq);
+    void recycle(chunk *c);
+
+private:
+    void push_work(chunk *c);
+};
+
+bool pipeline::
+allocate(size_t count)
+{
+    size_t size = _chunk_size * _device->get_block_size();
+
+    for (size_t n = 0; n < count; n++) {
+        std::unique_ptr<chunk> c(new (std::nothrow) chunk);
+        if (!c)
+            return false;
+
+        //
+        // Chunks of mapped devices point in the mapping.
+        //
+        if (!_device->is_mapped()) {
+            c->buffer.reset(new (std::nothrow) uint8_t[size]);
+            if (!c->buffer)
+                return false;
+        }
+
+        _free.push_back(c.get());
+        _chunks.push_back(std::move(c));
+    }
+
+    return true;
+}
+
+void pipeline::
+stop()
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    _stopping = true;
+    _recycled.notify_all();
+    _read.notify_all();
+    _verified.notify_all();
+}
+
+void pipeline::
+push_work(chunk *c)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    _work.push_back(c);
+    _read.notify_one();
+}
+
+void pipeline::
+read()
+{
+    size_t   index = 0;
+    uint64_t lba   = _extents.empty() ? 0 : _extents[0].start;
+    uint64_t seq   = 0;
+
+    std::vector<chunk *> queued;
+
+    for (;;) {
+        std::vector<chunk *> chunks;
+
+        {
+            std::unique_lock<std::mutex> lock(_lock);
+
+            while (!_stopping && index < _extents.size() && _free.empty() &&
+                    (_queue == nullptr || _queue->get_in_flight() == 0)) {
+                _recycled.wait(lock);
+            }
+
+            if (_stopping)
+                break;
+
+            while (index < _extents.size() && !_free.empty()) {
+                auto c   = _free.back();
+                auto end = _extents[index].start + _extents[index].count;
+                _free.pop_back();
+
+                c->seq   = seq++;
+                c->lba   = lba;
+                c->count = std::min(static_cast<uint64_t>(_chunk_size),
+                        end - lba);
+                c->nread = 0;
+                c->error = 0;
+                lba += c->count;
+
+                //
+                // Chunks do not span extents.
+                //
+                if (lba == end && ++index < _extents.size()) {
+                    lba = _extents[index].start;
+                }
+
+                chunks.push_back(c);
+            }
+        }
+
+        for (auto c : chunks) {
+            if (_queue == nullptr) {
+                c->blocks = _device->map_block<uint8_t>(c->lba);
+                c->nread  = c->count;
+                push_work(c);
+                continue;
+            }
+
+            c->blocks = c->buffer.get();
+
+            auto &r = c->request;
+            r.lba    = c->lba;
+            r.count  = c->count;
+            r.buffer = c->blocks;
+            r.opaque = c;
+            if (!_queue->submit(&r)) {
+                c->error = errno;
+                push_work(c);
+            } else {
+                queued.push_back(c);
+            }
+        }
+
+        if (_queue == nullptr) {
+            if (index >= _extents.size())
+                break;
+            continue;
+        }
+
+        _queue->flush();
+
+        if (_queue->get_in_flight() != 0) {
+            io_queue::request *done[16];
+
+            size_t n = _queue->complete(done, 16, true);
+            for (size_t i = 0; i < n; i++) {
+                auto c = reinterpret_cast<chunk *>(done[i]->opaque);
+                c->nread = done[i]->nread;
+                c->error = done[i]->error;
+                queued.erase(std::find(queued.begin(), queued.end(), c));
+                push_work(c);
+            }
+
+            //
+            // A queue that cannot reap would have us wait forever, fail
+            // what is still queued so the scan ends with an error.
+            //
+            if (n == 0) {
+                for (auto c : queued) {
+                    c->nread = 0;
+                    c->error = EIO;
+                    push_work(c);
+                }
+                break;
+            }
+        } else if (index >= _extents.size()) {
+            break;
+        }
+    }
+}
+
+void pipeline::
+verify()
+{
+    size_t block_size = _device->get_block_size();
+
+    for (;;) {
+        chunk *c;
+
+        {
+            std::unique_lock<std::mutex> lock(_lock);
+
+            while (!_stopping && _work.empty()) {
+                _read.wait(lock);
+            }
+
+            if (_stopping)
+                return;
+
+            c = _work.front();
+            _work.pop_front();
+        }
+
+        c->found.clear();
+        for (size_t n = 0; n < c->nread; n++) {
+            auto object = reinterpret_cast<nx_object_t const *>(c->blocks +
+                    n * block_size);
+
+            //
+            // Skip invalid objects.
+            //
+            if (object->o_checksum == 0 || object->o_checksum == UINT64_MAX)
+                continue;
+
+            if (!::nx_object_verify(object))
+                continue;
+
+            c->found.push_back(n);
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(_lock);
+
+            _done[c->seq] = c;
+            _verified.notify_one();
+        }
+    }
+}
+
+chunk *pipeline::
+wait(bool ordered, uint64_t seq)
+{
+    std::unique_lock<std::mutex> lock(_lock);
+
+    for (;;) {
+        auto i = ordered ? _done.find(seq) : _done.begin();
+        if (i != _done.end()) {
+            auto c = i->second;
+            _done.erase(i);
+            return c;
+        }
+
+        _verified.wait(lock);
+    }
+}
+
+void pipeline::
+recycle(chunk *c)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    _free.push_back(c);
+    _recycled.notify_one();
+}
+
+}
+
+scavenger::scavenger(device const *device)
+    : _device           (device)
+    , _start            (0)
+    , _end              (static_cast<uint64_t>(-1))
+    , _threads          (0)
+    , _chunk_size       (DEFAULT_CHUNK_SIZE)
+    , _ordered          (true)
+    , _filtered         (false)
+    , _progress_interval(1.0)
+{
+}
+
+void scavenger::
+set_range(uint64_t start, uint64_t end)
+{
+    _start = start;
+    _end   = end;
+}
+
+void scavenger::
+set_extents(space_map::extent_vector const &extents)
+{
+    _extents  = extents;
+    _filtered = true;
+}
+
+void scavenger::
+clear_extents()
+{
+    space_map::extent_vector().swap(_extents);
+    _filtered = false;
+}
+
+void scavenger::
+set_threads(size_t threads)
+{
+    _threads = threads;
+}
+
+void scavenger::
+set_chunk_size(size_t blocks)
+{
+    _chunk_size = std::max(blocks, static_cast<size_t>(1));
+}
+
+void scavenger::
+set_progress(progress_type const &callback, double interval)
+{
+    _progress          = callback;
+    _progress_interval = interval;
+}
+
+bool scavenger::
+run(callback_type const &callback) const
+{
+    if (!callback) {
+        errno = EINVAL;
+        return false;
+    }
+
+    uint64_t end   = std::min(_end, _device->get_block_count());
+    uint64_t start = std::min(_start, end);
+
+    //
+    // The extents scanned, clipped to the range.
+    //
+    space_map::extent_vector extents;
+    if (!_filtered) {
+        if (start < end) {
+            extents.push_back({ start, end - start });
+        }
+    } else {
+        for (auto const &e : _extents) {
+            uint64_t first = std::max(e.start, start);
+            uint64_t last  = std::min(e.start + e.count, end);
+            if (first < last) {
+                extents.push_back({ first, last - first });
+            }
+        }
+    }
+
+    size_t threads = _threads;
+    if (threads == 0) {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    //
+    // Enough chunks for every verifier to have one being verified and
+    // one read ahead, and for a chunk being delivered.
+    //
+    size_t   nchunks = threads * 2 + 1;
+    uint64_t total   = 0;
+    uint64_t blocks  = 0;
+
+    for (auto const &e : extents) {
+        total  += (e.count + _chunk_size - 1) / _chunk_size;
+        blocks += e.count;
+    }
+
+    io_queue queue;
+    bool     mapped = _device->is_mapped();
+
+    if (!mapped && total != 0 &&
+            !queue.open(_device, _device->get_io_backend(), nchunks))
+        return false;
+
+    pipeline scan(_device, mapped ? nullptr : &queue, extents, _chunk_size);
+    if (!scan.allocate(std::min(static_cast<uint64_t>(nchunks), total))) {
+        errno = ENOMEM;
+        return false;
+    }
+
+    if (mapped) {
+        _device->advise(device::ACCESS_SEQUENTIAL);
+    }
+
+    std::vector<std::thread> workers;
+    if (total != 0) {
+        workers.emplace_back(&pipeline::read, &scan);
+        for (size_t n = 0; n < threads; n++) {
+            workers.emplace_back(&pipeline::verify, &scan);
+        }
+    }
+
+    auto     begin  = std::chrono::steady_clock::now();
+    auto     last   = begin;
+    bool     ok     = true;
+    bool     stop   = false;
+    progress state;
+
+    state.start  = start;
+    state.end    = end;
+    state.blocks = blocks;
+
+    auto report = [&](bool force)
+    {
+        auto now = std::chrono::steady_clock::now();
+
+        if (!_progress)
+            return;
+
+        std::chrono::duration<double> since = now - last;
+        if (!force && since.count() < _progress_interval)
+            return;
+
+        std::chrono::duration<double> elapsed = now - begin;
+        state.elapsed = elapsed.count();
+        last = now;
+
+        if (!_progress(state)) {
+            stop = true;
+        }
+    };
+
+    for (uint64_t seq = 0; seq < total && !stop; seq++) {
+        auto c = scan.wait(_ordered, seq);
+
+        for (auto n : c->found) {
+            auto object = reinterpret_cast<nx_object_t const *>(c->blocks +
+                    n * _device->get_block_size());
+
+            state.objects++;
+            if (!callback(c->lba + n, object)) {
+                stop = true;
+                break;
+            }
+        }
+
+        state.scanned += c->nread;
+
+        //
+        // The scan ends at the first chunk not read completely.
+        //
+        if (c->nread != c->count) {
+            errno = (c->error != 0) ? c->error : EIO;
+            ok = false;
+            scan.recycle(c);
+            break;
+        }
+
+        scan.recycle(c);
+        report(false);
+    }
+
+    scan.stop();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    queue.close();
+
+    if (mapped) {
+        _device->advise(device::ACCESS_RANDOM);
+    }
+
+    report(true);
+
+    return ok;
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2017-present Orlando Bassotto
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "nx/space_map.h"
+
+#include <algorithm>
+
+using nx::space_map;
+
+space_map::space_map()
+    : _allocated_count(0)
+    , _free_count     (0)
+    , _end            (0)
+{
+}
+
+bool space_map::
+add(uint64_t start, uint64_t count, bool allocated)
+{
+    if (start < _end)
+        return false;
+
+    if (count == 0)
+        return true;
+
+    auto &extents = allocated ? _allocated : _free;
+
+    if (!extents.empty() &&
+            extents.back().start + extents.back().count == start) {
+        extents.back().count += count;
+    } else {
+        extents.push_back({ start, count });
+    }
+
+    if (allocated) {
+        _allocated_count += count;
+    } else {
+        _free_count += count;
+    }
+
+    _end = start + count;
+
+    return true;
+}
+
+void space_map::
+clear()
+{
+    extent_vector().swap(_allocated);
+    extent_vector().swap(_free);
+    _allocated_count = 0;
+    _free_count      = 0;
+    _end             = 0;
+}
+
+bool space_map::
+is_allocated(uint64_t block) const
+{
+    if (block >= _end)
+        return true;
+
+    //
+    // The last free extent starting at or before the block.
+    //
+    auto i = std::upper_bound(_free.begin(), _free.end(), block,
+            [](uint64_t block, extent const &e)
+            { return block < e.start; });
+    if (i == _free.begin())
+        return true;
+
+    --i;
+    return (block >= i->start + i->count);
+}
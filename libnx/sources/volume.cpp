@@ -23,10 +23,15 @@
 #include "nx/volume.h"
 #include "nx/container.h"
 #include "nx/enumerator.h"
+#include "nx/basic_enumerator.h"
 #include "nx/btree_traverser.h"
 
 #include "nxcompat/nxcompat.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
 using nx::volume;
 
 volume::volume(context *context, container *owner)
@@ -44,24 +49,59 @@ volume::~volume()
 bool volume::
 open(uint64_t lba)
 {
-    return read_super(_owner->get_main_device(), lba, _super);
+    if (!read_super(_owner->get_main_device(), lba, _super))
+        return false;
+
+    if (_owner->get_flatten_omap()) {
+        build_omap_index();
+    }
+
+    return true;
 }
 
 bool volume::
-read_super(device *device, uint64_t lba, apfs_fs_t *&super)
+lookup_omap_oid(device *device, uint64_t oid, uint32_t type, uint64_t &paddr,
+        uint64_t &size) const
 {
-    super = device->new_block <apfs_fs_t> ();
-    if (super == nullptr) {
-        _context->log(severity::fatal, "not enough memory to allocate "
-                "apfs super");
-        return false;
+    uint64_t xid = nx::swap(_super->apfs_o.o_xid);
+
+    if (_omap_index.lookup(oid, paddr)) {
+        size = get_block_size();
+        return true;
     }
 
-    if (!device->read(lba, super, false)) {
-        _context->log(severity::fatal, "cannot read apfs super at lba "
-                "%" PRIu64 ": %s", lba, ::strerror(errno));
-        nx::device::free_block(super);
+    if (_omap_cache.lookup(oid, xid, paddr, size))
+        return true;
+
+    if (!object::lookup_omap_oid(device, nx::swap(_super->apfs_omap_oid),
+                oid, type, paddr, size))
         return false;
+
+    _omap_cache.insert(oid, xid, paddr, size);
+
+    return true;
+}
+
+bool volume::
+read_super(device *device, uint64_t lba, apfs_fs_t *&super)
+{
+    super = device->lookup_block <apfs_fs_t> (lba);
+
+    bool cached = (super != nullptr);
+    if (!cached) {
+        super = device->new_block <apfs_fs_t> ();
+        if (super == nullptr) {
+            _context->log(severity::fatal, "not enough memory to allocate "
+                    "apfs super");
+            return false;
+        }
+
+        if (!device->read(lba, super, false)) {
+            _context->log(severity::fatal, "cannot read apfs super at lba "
+                    "%" PRIu64 ": %s", lba, ::strerror(errno));
+            nx::device::free_block(super);
+            return false;
+        }
     }
 
     if (nx::swap(super->apfs_o.o_type) != NX_OBJECT_OMAP_TYPE(APFS_VOLUME)) {
@@ -78,7 +118,10 @@ read_super(device *device, uint64_t lba, apfs_fs_t *&super)
         return false;
     }
 
-    if (!::nx_object_verify(&super->apfs_o)) {
+    if (cached)
+        return true;
+
+    if (!device->verify_block(lba, &super->apfs_o)) {
         _context->log(severity::error, "apfs super verification failed, "
                 "checksum mismatch (expected %#" PRIx64 ", got %#"
                 PRIx64 ")", nx::swap(super->apfs_o.o_checksum),
@@ -87,6 +130,8 @@ read_super(device *device, uint64_t lba, apfs_fs_t *&super)
         return false;
     }
 
+    device->cache_block(lba, super);
+
     return true;
 }
 
@@ -122,6 +167,32 @@ traverse_omap(omap_traverser_type const &callback) const
     device::free_block(omap);
 }
 
+void volume::
+build_omap_index()
+{
+    auto start = std::chrono::steady_clock::now();
+
+    _omap_index.clear();
+    traverse_omap([this](uint32_t, uint32_t level, uint32_t,
+                nx_omap_key_t const &key, nx_omap_value_t const &value)
+            {
+                if (level == 0) {
+                    _omap_index.add(nx::swap(key.ok_oid),
+                            nx::swap(value.ov_oid));
+                }
+                return true;
+            });
+    _omap_index.finish();
+
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    _context->log(severity::info, "volume object map index loaded, "
+            "%" PRIuSIZE " entries (%" PRIuSIZE " bytes) in %.3f ms",
+            _omap_index.size(), _omap_index.get_memory_size(),
+            elapsed.count());
+}
+
 inline uint64_t volume::
 get_root_tree_lba() const
 {
@@ -154,13 +225,30 @@ get_inode_used_count() const
     bt_fixed_t *bt = NX_BTN_FIXED(root);
     uint64_t ninodes = nx::swap(bt->bt_key_count);
 
-    device::free_block(root);
+    get_main_device()->release_block(root);
 
     return ninodes;
 }
 
 nx::enumerator *volume::
 open_oid(uint64_t oid) const
+{
+    return open_oid(oid, enumerator::key_comparer_type(), false);
+}
+
+//
+// Enumerates the records of oid from the first key not less than key,
+// or from the last key not greater than it when floor is set.
+//
+nx::enumerator *volume::
+open_oid(uint64_t oid, void const *key, size_t key_size, bool floor) const
+{
+    return open_oid(oid, make_key_comparer(key, key_size), floor);
+}
+
+nx::enumerator *volume::
+open_oid(uint64_t oid, enumerator::key_comparer_type const &seek,
+        bool floor) const
 {
     if (oid < 2)
         return nullptr;
@@ -184,7 +272,7 @@ open_oid(uint64_t oid) const
                 return (a > b) ? 1 : (a < b) ? -1 : 0;
             });
 
-    if (e != nullptr && !e->reset()) {
+    if (e != nullptr && !(seek ? e->seek(seek, floor) : e->reset())) {
         delete e;
         e = nullptr;
     }
@@ -198,6 +286,209 @@ open_root() const
     return open_oid(APFS_DREC_ROOT_FILE_ID);
 }
 
+//
+// Enumerates the records of oid starting from the file extent holding
+// the byte offset, or from the last record preceding it.
+//
+nx::enumerator *volume::
+open_file_extents(uint64_t oid, uint64_t offset) const
+{
+    apfs_file_extent_key_t key;
+
+    key.obj_id = nx::swap(APFS_OBJECT_MAKE(FILE_EXTENT, oid));
+    key.offset = nx::swap(offset);
+
+    return open_oid(oid, &key, sizeof(key), true);
+}
+
+//
+// Enumerates the directory records of oid whose name hash is not less
+// than hash, starting from the last record preceding them, so that a
+// directory without entries still opens; callers skip that record.
+//
+nx::enumerator *volume::
+open_directory(uint64_t oid, uint32_t hash) const
+{
+    apfs_drec_key_t key;
+
+    //
+    // An empty name sorts before any name of the same hash.
+    //
+    key.obj_id               = nx::swap(APFS_OBJECT_MAKE(DREC, oid));
+    key.hashed.name_len_hash = nx::swap(static_cast<uint32_t>(hash << 10));
+
+    return open_oid(oid, &key,
+            sizeof(key.obj_id) + sizeof(key.hashed.name_len_hash), true);
+}
+
+struct volume::oid_mapper {
+    volume const *self;
+    device       *dev;
+
+    inline bool operator()(uint64_t oid, uint64_t &lba) const
+    {
+        uint64_t size;
+        return self->lookup_omap_oid(dev, oid, 0, lba, size);
+    }
+};
+
+//
+// Orders keys truncated to the length of key, so that the range is made
+// of all the records sharing key as their prefix.
+//
+struct volume::key_prefix_comparer {
+    void const *key;
+    size_t      key_size;
+
+    inline int operator()(void const *k, size_t k_size) const
+    { return compare_keys(k, std::min(k_size, key_size), key, key_size); }
+};
+
+//
+// Visits the records whose key begins with key, such as the inode of an
+// object (the object id alone) or the directory records of a name hash
+// (the object id and the hash), until callback returns false. Nothing is
+// allocated when the nodes visited are cached.
+//
+// Returns true when at least one record has been visited.
+//
+bool volume::
+lookup_records(void const *key, size_t key_size, record_visitor_type callback,
+        void *opaque) const
+{
+    if (callback == nullptr || key_size < sizeof(uint64_t))
+        return false;
+
+    auto lba = get_root_tree_lba();
+    if (lba == 0)
+        return false;
+
+    auto device = get_main_device();
+    basic_enumerator<oid_mapper, key_prefix_comparer> e(_context, device, lba,
+            NX_OBJECT_OMAP_TYPE(BTREE_ROOT), oid_mapper{ this, device });
+
+    if (!e.seek(key_prefix_comparer{ key, key_size }))
+        return false;
+
+    sized_value_type k, v;
+    bool             found = false;
+
+    while (e.next(k, v)) {
+        found = true;
+        if (!(*callback)(opaque, k, v))
+            break;
+    }
+
+    return found;
+}
+
+//
+// Orders two keys of a file system tree: by object id, then by record
+// type, then by the secondary key of the record type.
+//
+int volume::
+compare_keys(void const *a, size_t a_size, void const *b, size_t b_size)
+{
+    auto compare = [](uint64_t x, uint64_t y)
+    { return (x > y) ? 1 : (x < y) ? -1 : 0; };
+
+    //
+    // Names sort bytewise, a prefix sorts first.
+    //
+    auto compare_names = [](uint8_t const *x, size_t x_size,
+            uint8_t const *y, size_t y_size)
+    {
+        int result = memcmp(x, y, std::min(x_size, y_size));
+        if (result != 0)
+            return (result > 0) ? 1 : -1;
+
+        return (x_size > y_size) ? 1 : (x_size < y_size) ? -1 : 0;
+    };
+
+    if (a_size < sizeof(uint64_t) || b_size < sizeof(uint64_t))
+        return compare(a_size, b_size);
+
+    auto x = reinterpret_cast<uint8_t const *>(a);
+    auto y = reinterpret_cast<uint8_t const *>(b);
+
+    uint64_t a_obj_id = nx::swap(*reinterpret_cast<uint64_t const *>(x));
+    uint64_t b_obj_id = nx::swap(*reinterpret_cast<uint64_t const *>(y));
+
+    int result = compare(APFS_OBJECT_ID_ID(a_obj_id),
+            APFS_OBJECT_ID_ID(b_obj_id));
+    if (result == 0) {
+        result = compare(APFS_OBJECT_ID_TYPE(a_obj_id),
+                APFS_OBJECT_ID_TYPE(b_obj_id));
+    }
+    if (result != 0)
+        return result;
+
+    x += sizeof(uint64_t), a_size -= sizeof(uint64_t);
+    y += sizeof(uint64_t), b_size -= sizeof(uint64_t);
+
+    switch (APFS_OBJECT_ID_TYPE(a_obj_id)) {
+        case APFS_OBJECT_TYPE_SIBLING:
+        case APFS_OBJECT_TYPE_FILE_EXTENT:
+            //
+            // Sibling id, or logical offset.
+            //
+            if (a_size < sizeof(uint64_t) || b_size < sizeof(uint64_t))
+                return compare(a_size, b_size);
+
+            return compare(nx::swap(*reinterpret_cast<uint64_t const *>(x)),
+                    nx::swap(*reinterpret_cast<uint64_t const *>(y)));
+
+        case APFS_OBJECT_TYPE_DREC:
+            //
+            // Name hash, then name.
+            //
+            if (a_size < sizeof(uint32_t) || b_size < sizeof(uint32_t))
+                return compare(a_size, b_size);
+
+            result = compare(
+                    nx::swap(*reinterpret_cast<uint32_t const *>(x)) >> 10,
+                    nx::swap(*reinterpret_cast<uint32_t const *>(y)) >> 10);
+            if (result != 0)
+                return result;
+
+            return compare_names(x + sizeof(uint32_t),
+                    a_size - sizeof(uint32_t), y + sizeof(uint32_t),
+                    b_size - sizeof(uint32_t));
+
+        case APFS_OBJECT_TYPE_XATTR:
+        case APFS_OBJECT_TYPE_SNAP_NAME:
+            //
+            // Length prefixed name.
+            //
+            if (a_size < sizeof(uint16_t) || b_size < sizeof(uint16_t))
+                return compare(a_size, b_size);
+
+            return compare_names(x + sizeof(uint16_t),
+                    std::min<size_t>(a_size - sizeof(uint16_t),
+                        nx::swap(*reinterpret_cast<uint16_t const *>(x))),
+                    y + sizeof(uint16_t),
+                    std::min<size_t>(b_size - sizeof(uint16_t),
+                        nx::swap(*reinterpret_cast<uint16_t const *>(y))));
+
+        default:
+            return 0;
+    }
+}
+
+//
+// Returns a seek comparer for an enumerator of the file system tree,
+// holding its own copy of key.
+//
+nx::enumerator::key_comparer_type volume::
+make_key_comparer(void const *key, size_t key_size)
+{
+    auto bytes = reinterpret_cast<uint8_t const *>(key);
+    auto copy  = std::vector<uint8_t>(bytes, bytes + key_size);
+
+    return [copy](void const *k, size_t k_size)
+    { return compare_keys(k, k_size, copy.data(), copy.size()); };
+}
+
 void volume::
 traverse_root(generic_traverser_type const &callback) const
 {
@@ -8,6 +8,9 @@
 #cmakedefine HAVE_SYS_DISKSLICE_H
 #cmakedefine HAVE_SYS_TIME_H
 #cmakedefine HAVE_SYS_UTIME_H
+#cmakedefine HAVE_SYS_MMAN_H
+#cmakedefine HAVE_SYS_UIO_H
+#cmakedefine HAVE_LINUX_IO_URING_H
 
 #cmakedefine HAVE_SSIZE_T
 #cmakedefine HAVE_TIMESPEC
@@ -31,4 +34,5 @@
 #cmakedefine HAVE_CHSIZE
 #cmakedefine HAVE_PREAD
 #cmakedefine HAVE_PWRITE
+#cmakedefine HAVE_PREADV
 #cmakedefine HAVE_SYMLINK
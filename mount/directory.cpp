@@ -27,16 +27,36 @@
 using apfs_fuse::directory;
 
 directory::directory(apfs::object *o, bool noxattr)
-    : object  (o)
-    , _entries(_object->get_entries())
-    , _noxattr(noxattr)
+    : object   (o)
+    , _cursor  (nullptr)
+    , _at_eod  (true)
+    , _nentries(0)
+    , _doffset (0)
+    , _noxattr (noxattr)
 {
 }
 
+directory::~directory()
+{
+    delete _cursor;
+}
+
 bool directory::
 rewind()
 {
-    _iterator = _entries.begin();
+    //
+    // Entries are streamed from disk, only the current one is kept.
+    //
+    if (_cursor == nullptr) {
+        _cursor = _object->open_directory();
+        if (_cursor == nullptr)
+            return false;
+    } else if (!_cursor->rewind()) {
+        return false;
+    }
+
+    _at_eod = !_cursor->next(_entry);
+    _nentries = 0;
     _doffset = 0;
 
     return true;
@@ -50,7 +70,7 @@ next(off_t offset, std::string &name, uint64_t &file_id, off_t &next_offset)
     if (offset != _doffset)
         return false;
 
-    bool at_eod = (_iterator == _entries.end());
+    bool at_eod = _at_eod;
 
     if (!_noxattr && expose_xattr_directory) {
         rfoffset = 1;
@@ -78,19 +98,19 @@ next(off_t offset, std::string &name, uint64_t &file_id, off_t &next_offset)
                 if (!_object->is_root())
                     return false;
 
-                if (_doffset > _entries.size() * 2 + rfoffset)
+                if (_doffset > _nentries * 2 + rfoffset)
                     return false;
 
                 has_rsrc_fork = _object->has_xattr(APFS_XATTR_NAME_RESOURCEFORK);
                 name          = "";
                 file_id       = _object->get_file_id();
             } else {
-                auto *o = _object->get_volume()->open(_iterator->second.oid);
+                auto *o = _object->get_volume()->open(_entry.oid);
                 if (o != nullptr) {
                     has_rsrc_fork = o->has_xattr(APFS_XATTR_NAME_RESOURCEFORK);
                     if (has_rsrc_fork) {
-                        name    = _iterator->second.name;
-                        file_id = _iterator->second.oid;
+                        name    = _entry.name;
+                        file_id = _entry.oid;
                     }
                     o->release();
                 }
@@ -119,11 +139,12 @@ next(off_t offset, std::string &name, uint64_t &file_id, off_t &next_offset)
         return false;
     }
 
-    name        = _iterator->second.name;
-    file_id     = _iterator->second.oid;
+    name        = _entry.name;
+    file_id     = _entry.oid;
     next_offset = ++_doffset;
 
-    ++_iterator;
+    _nentries++;
+    _at_eod = !_cursor->next(_entry);
 
     return true;
 }
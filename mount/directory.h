@@ -29,13 +29,16 @@ namespace apfs_fuse {
 
 class directory : public object {
 private:
-    apfs::object::directory_entry_map const           &_entries;
-    apfs::object::directory_entry_map::const_iterator  _iterator;
-    off_t                                              _doffset;
-    bool                                               _noxattr;
+    apfs::directory_cursor        *_cursor;
+    apfs::object::directory_entry  _entry;
+    bool                           _at_eod;
+    size_t                         _nentries;
+    off_t                          _doffset;
+    bool                           _noxattr;
 
 public:
     directory(apfs::object *o, bool noxattr = false);
+    virtual ~directory();
 
 public: // directory handling
     virtual bool rewind();
@@ -38,5 +38,15 @@ get_size() const
 ssize_t file::
 read(void *buf, size_t size, off_t offset) const
 {
-    return _object->read(buf, size, offset);
+    //
+    // Files are also opened just to be looked at, the stream reading
+    // ahead is opened on the first read.
+    //
+    std::call_once(_stream_once, [this]()
+            { _stream.reset(_object->open_stream()); });
+
+    if (!_stream)
+        return _object->read(buf, size, offset);
+
+    return _object->read(_stream.get(), buf, size, offset);
 }
@@ -25,9 +25,18 @@
 
 #include "object.h"
 
+#include "nx/readahead.h"
+
+#include <memory>
+#include <mutex>
+
 namespace apfs_fuse {
 
 class file : public object {
+private:
+    mutable std::once_flag                 _stream_once;
+    mutable std::unique_ptr<nx::readahead> _stream;
+
 public:
     file(apfs::object *o);
 
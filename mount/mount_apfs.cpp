@@ -54,6 +54,12 @@ main(int argc, char **argv)
     bool has_volid = false;
     bool next_arg_is_for_fuse = false;
     bool foreground = false;
+    bool flatten_omap = false;
+    nx::device::verify_policy verify_policy = nx::device::VERIFY_ALWAYS;
+    bool mapped = false;
+    nx::io_queue::backend_type io_backend = nx::io_queue::BACKEND_SYNC;
+    size_t readahead = nx::device::DEFAULT_READAHEAD;
+    size_t object_cache_size = apfs::internal::object_cache::DEFAULT_BUDGET;
 #ifdef __APPLE__
     bool automounting = false;
 #endif
@@ -111,6 +117,46 @@ main(int argc, char **argv)
                         n++;
                         continue;
                     }
+                    if (strcmp(argv[n + 1], "flatomap") == 0) {
+                        flatten_omap = true;
+                        n++;
+                        continue;
+                    }
+                    if (strcmp(argv[n + 1], "verifyonce") == 0) {
+                        verify_policy = nx::device::VERIFY_ONCE;
+                        n++;
+                        continue;
+                    }
+                    if (strcmp(argv[n + 1], "noverify") == 0) {
+                        verify_policy = nx::device::VERIFY_TRUST;
+                        n++;
+                        continue;
+                    }
+                    if (strcmp(argv[n + 1], "mmap") == 0) {
+                        mapped = true;
+                        n++;
+                        continue;
+                    }
+                    if (strncmp(argv[n + 1], "aio=", 4) == 0) {
+                        if (!nx::io_queue::parse_backend_name(argv[n + 1] + 4,
+                                    io_backend)) {
+                            usage(progname);
+                            exit(EXIT_FAILURE);
+                        }
+                        n++;
+                        continue;
+                    }
+                    if (strncmp(argv[n + 1], "readahead=", 10) == 0) {
+                        readahead = strtoul(argv[n + 1] + 10, nullptr, 0);
+                        n++;
+                        continue;
+                    }
+                    if (strncmp(argv[n + 1], "objcache=", 9) == 0) {
+                        object_cache_size = strtoul(argv[n + 1] + 9, nullptr,
+                                0) << 20;
+                        n++;
+                        continue;
+                    }
                     next_arg_is_fuse = true;
                 }
             } else {
@@ -150,6 +196,10 @@ main(int argc, char **argv)
 
     session.set_logger(&logger);
     session.set_main_device(&device);
+    session.set_flatten_omap(flatten_omap);
+    device.set_verify_policy(verify_policy);
+    device.set_mapping_enabled(mapped);
+    device.set_readahead(readahead);
 
     //
     // Open the device
@@ -184,6 +234,8 @@ main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
+    volume->set_object_cache_size(object_cache_size);
+
     //
     // Wrap the volume for fuse
     //
@@ -247,6 +299,12 @@ main(int argc, char **argv)
     apfs_fuse::novolicon_unsupported = false;
 #endif
 
+    //
+    // The asynchronous queue is opened by the first batched read, which
+    // must come from the daemon: its threads would not survive the fork.
+    //
+    device.set_io_backend(io_backend);
+
     int rc = apfs_fuse::main(args);
 
 #ifdef __APPLE__
@@ -267,6 +325,7 @@ main(int argc, char **argv)
             }
         }
 
+        device.set_io_backend(io_backend);
         rc = apfs_fuse::main(args);
     }
 #endif
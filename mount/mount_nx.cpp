@@ -52,6 +52,11 @@ main(int argc, char **argv)
     char const *devname = nullptr;
     bool next_arg_is_for_fuse = false;
     bool foreground = false;
+    bool flatten_omap = false;
+    nx::device::verify_policy verify_policy = nx::device::VERIFY_ALWAYS;
+    bool mapped = false;
+    nx::io_queue::backend_type io_backend = nx::io_queue::BACKEND_SYNC;
+    size_t readahead = nx::device::DEFAULT_READAHEAD;
 #ifdef __APPLE__
     bool automounting = false;
 #endif
@@ -109,6 +114,40 @@ main(int argc, char **argv)
                         n++;
                         continue;
                     }
+                    if (strcmp(argv[n + 1], "flatomap") == 0) {
+                        flatten_omap = true;
+                        n++;
+                        continue;
+                    }
+                    if (strcmp(argv[n + 1], "verifyonce") == 0) {
+                        verify_policy = nx::device::VERIFY_ONCE;
+                        n++;
+                        continue;
+                    }
+                    if (strcmp(argv[n + 1], "noverify") == 0) {
+                        verify_policy = nx::device::VERIFY_TRUST;
+                        n++;
+                        continue;
+                    }
+                    if (strcmp(argv[n + 1], "mmap") == 0) {
+                        mapped = true;
+                        n++;
+                        continue;
+                    }
+                    if (strncmp(argv[n + 1], "aio=", 4) == 0) {
+                        if (!nx::io_queue::parse_backend_name(argv[n + 1] + 4,
+                                    io_backend)) {
+                            usage(progname);
+                            exit(EXIT_FAILURE);
+                        }
+                        n++;
+                        continue;
+                    }
+                    if (strncmp(argv[n + 1], "readahead=", 10) == 0) {
+                        readahead = strtoul(argv[n + 1] + 10, nullptr, 0);
+                        n++;
+                        continue;
+                    }
                     next_arg_is_fuse = true;
                 }
             } else {
@@ -139,6 +178,10 @@ main(int argc, char **argv)
 
     session.set_logger(&logger);
     session.set_main_device(&device);
+    session.set_flatten_omap(flatten_omap);
+    device.set_verify_policy(verify_policy);
+    device.set_mapping_enabled(mapped);
+    device.set_readahead(readahead);
 
     //
     // Open the device
@@ -221,6 +264,12 @@ main(int argc, char **argv)
     apfs_fuse::novolicon_unsupported = false;
 #endif
 
+    //
+    // The asynchronous queue is opened by the first batched read, which
+    // must come from the daemon: its threads would not survive the fork.
+    //
+    device.set_io_backend(io_backend);
+
     int rc = apfs_fuse::main(args);
 
 #ifdef __APPLE__
@@ -241,6 +290,7 @@ main(int argc, char **argv)
             }
         }
 
+        device.set_io_backend(io_backend);
         rc = apfs_fuse::main(args);
     }
 #endif
@@ -35,7 +35,7 @@ protected:
     object(apfs::object *o);
 
 public:
-    ~object();
+    virtual ~object();
 
 public:
     inline apfs::object *get_object() const
@@ -47,6 +47,7 @@ extern int main_apfs_omap(nx::context &context, int argc, char **argv);
 extern int main_apfs_traverse(nx::context &context, int argc, char **argv);
 extern int main_apfs_content(nx::context &context, int argc, char **argv);
 extern int main_apfs_extract(nx::context &context, int argc, char **argv);
+extern int main_nx_bench(nx::context &context, int argc, char **argv);
 
 int
 main(int argc, char **argv)
@@ -68,6 +69,8 @@ main(int argc, char **argv)
         return main_apfs_content(context, argc, argv);
     } else if (strstr(*argv, "apfs_extract") != nullptr) {
         return main_apfs_extract(context, argc, argv);
+    } else if (strstr(*argv, "nx_bench") != nullptr) {
+        return main_nx_bench(context, argc, argv);
     } else {
         fprintf(stderr, "error: you should not invoke '%s' directly.\n", *argv);
         exit(EXIT_FAILURE);
@@ -0,0 +1,1884 @@
+/*
+ * Copyright (c) 2017-present Orlando Bassotto
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "apfs/internal/extent.h"
+
+#include "nx/btn_view.h"
+#include "nx/container.h"
+#include "nx/context.h"
+#include "nx/enumerator.h"
+#include "nx/format/apfs.h"
+#include "nx/io_queue.h"
+#include "nx/readahead.h"
+#include "nx/scavenge_index.h"
+#include "nx/scavenger.h"
+#include "nx/space_map.h"
+#include "nx/swap.h"
+#include "nx/volume.h"
+
+#include "nxcompat/nxcompat.h"
+
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef std::function<int(uint64_t, uint64_t)> comparer_type;
+
+//
+// Results are accumulated here so that the timed loops are not optimized
+// away.
+//
+static volatile size_t bench_sink;
+
+//
+// Every allocation made through operator new is counted, so that
+// benchmarks can report allocations per operation.
+//
+static std::atomic<size_t> bench_allocations(0);
+
+void *
+operator new(size_t size)
+{
+    bench_allocations.fetch_add(1, std::memory_order_relaxed);
+
+    void *p = malloc(size != 0 ? size : 1);
+    if (p == nullptr)
+        throw std::bad_alloc();
+
+    return p;
+}
+
+void *
+operator new(size_t size, std::nothrow_t const &) noexcept
+{
+    bench_allocations.fetch_add(1, std::memory_order_relaxed);
+
+    return malloc(size != 0 ? size : 1);
+}
+
+void *
+operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void *
+operator new[](size_t size, std::nothrow_t const &nt) noexcept
+{
+    return operator new(size, nt);
+}
+
+void
+operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void
+operator delete(void *p, std::nothrow_t const &) noexcept
+{
+    free(p);
+}
+
+void
+operator delete[](void *p) noexcept
+{
+    free(p);
+}
+
+void
+operator delete[](void *p, std::nothrow_t const &) noexcept
+{
+    free(p);
+}
+
+//
+// Builds a full btree root node, with either fixed size (compressed) slots
+// holding 16 bytes keys, like an object map, or variable size slots
+// holding keys of 8 to 24 bytes, like a file system tree.
+//
+static std::vector<uint8_t>
+make_node(bool fixed, bool leaf, std::mt19937_64 &rng)
+{
+    std::vector<uint8_t> block(NX_OBJECT_SIZE, 0);
+    auto   btn      = reinterpret_cast<nx_btn_t *>(&block[0]);
+    auto   bt       = NX_BTN_FIXED(btn);
+    size_t val_size = leaf ? 16 : sizeof(uint64_t);
+    size_t avail    = NX_OBJECT_SIZE - sizeof(nx_btn_t) - sizeof(bt_fixed_t);
+
+    //
+    // Compute how many entries fit, 8 bytes aligned.
+    //
+    std::vector<size_t> key_sizes;
+    size_t used = 0;
+    for (;;) {
+        size_t key_size  = fixed ? 16 : 8 + 8 * (rng() % 3);
+        size_t slot_size = fixed ? sizeof(btn_cslot_t) : sizeof(btn_slot_t);
+        size_t table_len = ((key_sizes.size() + 1) * slot_size + 7) & ~7;
+        if (table_len + used + key_size + val_size > avail)
+            break;
+        key_sizes.push_back(key_size);
+        used += key_size + val_size;
+    }
+
+    size_t nkeys     = key_sizes.size();
+    size_t table_len = (nkeys * (fixed ? sizeof(btn_cslot_t) :
+                sizeof(btn_slot_t)) + 7) & ~7;
+
+    btn->btn_o.o_type = nx::swap(static_cast<uint32_t>(
+                NX_OBJECT_FLAG_DIRECT | NX_OBJECT_TYPE_BTREE_ROOT));
+    btn->btn_flags = nx::swap(static_cast<uint16_t>(NX_BTN_FLAG_FIXED |
+                (leaf ? NX_BTN_FLAG_LEAF : 0) |
+                (fixed ? NX_BTN_FLAG_COMPRESSED : 0)));
+    btn->btn_level = nx::swap(static_cast<uint16_t>(leaf ? 0 : 1));
+    btn->btn_nkeys = nx::swap(static_cast<uint32_t>(nkeys));
+    btn->btn_table_space.len = nx::swap(static_cast<uint16_t>(table_len));
+
+    bt->bt_node_size = nx::swap(static_cast<uint32_t>(NX_OBJECT_SIZE));
+    bt->bt_key_size  = nx::swap(static_cast<uint32_t>(fixed ? 16 : 0));
+    bt->bt_val_size  = nx::swap(static_cast<uint32_t>(fixed ? 16 : 0));
+
+    uint8_t *keys = reinterpret_cast<uint8_t *>(NX_BTN_DATA(btn)) + table_len;
+    uint8_t *vend = reinterpret_cast<uint8_t *>(bt);
+    uint16_t key_offset = 0;
+    uint16_t val_offset = 0;
+    uint64_t oid = 16;
+
+    for (size_t n = 0; n < nkeys; n++) {
+        oid += 1 + rng() % 4;
+        val_offset += static_cast<uint16_t>(val_size);
+
+        uint64_t swapped = nx::swap(oid);
+        memcpy(keys + key_offset, &swapped, sizeof(swapped));
+
+        if (fixed) {
+            NX_BTN_CSLOT(btn, n)->key_offset = nx::swap(key_offset);
+            NX_BTN_CSLOT(btn, n)->val_offset = nx::swap(val_offset);
+        } else {
+            NX_BTN_SLOT(btn, n)->key_offset = nx::swap(key_offset);
+            NX_BTN_SLOT(btn, n)->key_size =
+                nx::swap(static_cast<uint16_t>(key_sizes[n]));
+            NX_BTN_SLOT(btn, n)->val_offset = nx::swap(val_offset);
+            NX_BTN_SLOT(btn, n)->val_size =
+                nx::swap(static_cast<uint16_t>(val_size));
+        }
+
+        memset(vend - val_offset, 0xa5, val_size);
+        key_offset += static_cast<uint16_t>(key_sizes[n]);
+    }
+
+    return block;
+}
+
+static uint64_t
+node_key(nx_btn_t const *btn, size_t n)
+{
+    btn_kvinfo_t kvi;
+    void const  *key;
+
+    ::nx_btn_get_kvinfo(btn, btn, n, &kvi);
+    ::nx_btn_get_kvptrs(btn, btn, &kvi, &key, nullptr);
+
+    return nx::swap(*reinterpret_cast<uint64_t const *>(key));
+}
+
+//
+// The linear scan formerly done by enumerator::reset(): every slot fetches
+// its key and the following one, until oid <= key <= next_key.
+//
+static size_t
+linear_search(nx_btn_t const *btn, uint64_t oid, comparer_type const &compare)
+{
+    size_t nkeys = nx::swap(btn->btn_nkeys);
+
+    for (size_t n = 0; n < nkeys; n++) {
+        btn_kvinfo_t kvi;
+        void const  *key;
+        void const  *val;
+        uint64_t     next_oid = INT64_MAX;
+
+        if (!::nx_btn_get_kvinfo(btn, btn, n, &kvi) ||
+                !::nx_btn_get_kvptrs(btn, btn, &kvi, &key, &val))
+            return nkeys;
+
+        uint64_t key_oid = nx::swap(*reinterpret_cast<uint64_t const *>(key));
+        if (compare(key_oid, oid) > 0)
+            return nkeys;
+
+        if (n + 1 < nkeys) {
+            if (!::nx_btn_get_kvinfo(btn, btn, n + 1, &kvi) ||
+                    !::nx_btn_get_kvptrs(btn, btn, &kvi, &key, &val))
+                return nkeys;
+
+            next_oid = nx::swap(*reinterpret_cast<uint64_t const *>(key));
+        }
+
+        if (compare(key_oid, oid) <= 0 &&
+                compare(oid, next_oid) <= 0)
+            return n;
+    }
+
+    return nkeys;
+}
+
+struct search_context {
+    comparer_type const *compare;
+    uint64_t             oid;
+};
+
+static int
+compare_key(void *opaque, void const *key, size_t)
+{
+    auto ctx = reinterpret_cast<search_context const *>(opaque);
+    return (*ctx->compare)(nx::swap(*reinterpret_cast<uint64_t const *>(key)),
+            ctx->oid);
+}
+
+//
+// The lower bound search done by enumerator::reset(), mapped to the
+// subtree that may hold oid.
+//
+static size_t
+binary_search(nx_btn_t const *btn, uint64_t oid, comparer_type const &compare)
+{
+    search_context ctx = { &compare, oid };
+    size_t         nkeys = nx::swap(btn->btn_nkeys);
+    uint32_t       n;
+
+    if (!::nx_btn_lower_bound(btn, btn, 0, compare_key, &ctx, &n))
+        return nkeys;
+
+    if (n > 0)
+        return n - 1;
+
+    return (n < nkeys && compare(node_key(btn, n), oid) == 0) ? n : nkeys;
+}
+
+static int
+bench_btn_search(int argc, char **argv)
+{
+    size_t iterations = (argc > 0) ? strtoull(argv[0], nullptr, 0) : 1000000;
+    std::mt19937_64 rng(0x6170667362656e63);
+    comparer_type compare = [](uint64_t a, uint64_t b)
+    { return (a > b) ? 1 : (a < b) ? -1 : 0; };
+
+    printf("%-28s %6s %12s %12s %8s\n", "node", "keys", "linear ns",
+            "binary ns", "speedup");
+
+    for (int fixed = 1; fixed >= 0; fixed--) {
+        for (int leaf = 0; leaf <= 1; leaf++) {
+            auto  block = make_node(fixed != 0, leaf != 0, rng);
+            auto  btn   = reinterpret_cast<nx_btn_t const *>(&block[0]);
+            size_t nkeys = nx::swap(btn->btn_nkeys);
+
+            uint64_t lo = node_key(btn, 0);
+            uint64_t hi = node_key(btn, nkeys - 1);
+
+            std::vector<uint64_t> oids(4096);
+            for (auto &oid : oids) {
+                oid = lo + rng() % (hi - lo + 1);
+            }
+
+            //
+            // Both searches must agree before being timed.
+            //
+            for (auto oid : oids) {
+                if (linear_search(btn, oid, compare) !=
+                        binary_search(btn, oid, compare)) {
+                    fprintf(stderr, "error: search mismatch for oid %#"
+                            PRIx64 "\n", oid);
+                    return EXIT_FAILURE;
+                }
+            }
+
+            double timings[2];
+            size_t sink = 0;
+            for (int pass = 0; pass < 2; pass++) {
+                auto start = std::chrono::steady_clock::now();
+                for (size_t i = 0; i < iterations; i++) {
+                    auto oid = oids[i % oids.size()];
+                    sink += (pass == 0) ? linear_search(btn, oid, compare) :
+                        binary_search(btn, oid, compare);
+                }
+                std::chrono::duration<double, std::nano> elapsed =
+                    std::chrono::steady_clock::now() - start;
+                timings[pass] = elapsed.count() / iterations;
+            }
+
+            bench_sink = sink;
+
+            char name[64];
+            snprintf(name, sizeof(name), "%s %s",
+                    fixed ? "fixed" : "variable", leaf ? "leaf" : "index");
+            printf("%-28s %6zu %12.1f %12.1f %7.1fx\n", name, nkeys,
+                    timings[0], timings[1], timings[0] / timings[1]);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+//
+// Searches fixed size nodes by oid, as object map lookups do: through the
+// comparer callback, through a node view with the comparer inlined, and
+// with the vectorized kernel.
+//
+static int
+bench_omap_search(int argc, char **argv)
+{
+    size_t iterations = (argc > 0) ? strtoull(argv[0], nullptr, 0) : 1000000;
+    std::mt19937_64 rng(0x6f6d617073656172);
+    comparer_type compare = [](uint64_t a, uint64_t b)
+    { return (a > b) ? 1 : (a < b) ? -1 : 0; };
+
+    printf("%-28s %6s %12s %12s %12s\n", "node", "keys", "callback ns",
+            "view ns", "kernel ns");
+
+    for (int leaf = 0; leaf <= 1; leaf++) {
+        auto   block = make_node(true, leaf != 0, rng);
+        auto   btn   = reinterpret_cast<nx_btn_t const *>(&block[0]);
+        size_t nkeys = nx::swap(btn->btn_nkeys);
+
+        nx::btn_view<true> view(btn, btn);
+
+        uint64_t lo = node_key(btn, 0);
+        uint64_t hi = node_key(btn, nkeys - 1);
+
+        std::vector<uint64_t> oids(4096);
+        for (auto &oid : oids) {
+            oid = lo - 2 + rng() % (hi - lo + 5);
+        }
+
+        auto search = [&](int pass, uint64_t oid) -> uint32_t
+        {
+            uint32_t n = UINT32_MAX;
+
+            if (pass == 0) {
+                search_context ctx = { &compare, oid };
+                ::nx_btn_lower_bound(btn, btn, 0, compare_key, &ctx, &n);
+            } else if (pass == 1) {
+                view.lower_bound(0, nx::btn_u64_comparer{ oid }, n);
+            } else {
+                nx::btn_lower_bound(view, 0, nx::btn_u64_comparer{ oid }, n);
+            }
+
+            return n;
+        };
+
+        //
+        // All searches must agree before being timed.
+        //
+        for (auto oid : oids) {
+            uint32_t n = search(0, oid);
+            for (uint32_t first = 0; first < nkeys; first += 7) {
+                uint32_t m = UINT32_MAX;
+                ::nx_btn_lower_bound_u64(btn, btn, first, oid, &m);
+                if (m != std::max(n, first)) {
+                    n = UINT32_MAX;
+                    break;
+                }
+            }
+            if (n == UINT32_MAX || search(1, oid) != n ||
+                    search(2, oid) != n) {
+                fprintf(stderr, "error: search mismatch for oid %#"
+                        PRIx64 "\n", oid);
+                return EXIT_FAILURE;
+            }
+        }
+
+        double timings[3];
+        size_t sink = 0;
+        for (int pass = 0; pass < 3; pass++) {
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < iterations; i++) {
+                sink += search(pass, oids[i % oids.size()]);
+            }
+            std::chrono::duration<double, std::nano> elapsed =
+                std::chrono::steady_clock::now() - start;
+            timings[pass] = elapsed.count() / iterations;
+        }
+
+        bench_sink = sink;
+
+        printf("%-28s %6zu %12.1f %12.1f %12.1f\n",
+                leaf ? "fixed leaf" : "fixed index", nkeys,
+                timings[0], timings[1], timings[2]);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+//
+// Checksums 4 KiB blocks with every implementation the processor supports.
+//
+static int
+bench_checksum(int argc, char **argv)
+{
+    size_t iterations = (argc > 0) ? strtoull(argv[0], nullptr, 0) : 200000;
+    std::mt19937_64 rng(0x6373756d62656e63);
+
+    static char const *const impls[] = { "scalar", "sse4.1", "avx2", "neon" };
+
+    std::vector<uint8_t> blocks(64 * NX_OBJECT_SIZE);
+    for (auto &b : blocks) {
+        b = static_cast<uint8_t>(rng());
+    }
+
+    //
+    // All implementations must agree with the scalar one before being
+    // timed, including on lengths that are not a multiple of the vectors.
+    //
+    std::vector<uint64_t> expected;
+    nx_checksum_set_impl("scalar");
+    for (size_t length = 8; length <= NX_OBJECT_SIZE; length += 4) {
+        expected.push_back(nx_checksum_make(&blocks[length], length));
+    }
+
+    printf("%-28s %12s %12s %8s\n", "implementation", "ns/block", "MiB/s",
+            "speedup");
+
+    double scalar = 0;
+    for (auto impl : impls) {
+        if (!nx_checksum_set_impl(impl))
+            continue;
+
+        size_t n = 0;
+        for (size_t length = 8; length <= NX_OBJECT_SIZE; length += 4) {
+            if (nx_checksum_make(&blocks[length], length) != expected[n++]) {
+                fprintf(stderr, "error: %s checksum mismatch on %zu bytes\n",
+                        impl, length);
+                nx_checksum_set_impl(nullptr);
+                return EXIT_FAILURE;
+            }
+        }
+
+        uint64_t sink  = 0;
+        auto     start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; i++) {
+            sink += nx_checksum_make(&blocks[(i % 64) * NX_OBJECT_SIZE],
+                    NX_OBJECT_SIZE);
+        }
+        std::chrono::duration<double, std::nano> elapsed =
+            std::chrono::steady_clock::now() - start;
+
+        bench_sink = static_cast<size_t>(sink);
+
+        double ns = elapsed.count() / iterations;
+        if (scalar == 0) {
+            scalar = ns;
+        }
+
+        printf("%-28s %12.1f %12.1f %7.1fx\n", impl, ns,
+                NX_OBJECT_SIZE / ns * 1e9 / (1024 * 1024), scalar / ns);
+    }
+
+    nx_checksum_set_impl(nullptr);
+    printf("selected: %s\n", nx_checksum_get_impl());
+
+    return EXIT_SUCCESS;
+}
+
+//
+// The hash formerly done by apfs_hash_name(): the name converted to UTF-32
+// in a heap buffer, then checksummed one bit at a time. The buffer comes
+// from operator new so that it is counted.
+//
+static uint32_t
+reference_hash_name(char const *name, size_t namelen, bool insensitive)
+{
+    UTF8 const *source    = reinterpret_cast<UTF8 const *>(name);
+    UTF8 const *sourceEnd = source + namelen;
+    UTF32      *units     = new (std::nothrow) UTF32[namelen + 1]();
+    UTF32      *target    = units;
+
+    if (units == nullptr)
+        return ~0U & 0x3fffff;
+
+    if (ConvertUTF8toUTF32(&source, sourceEnd, &target, units + namelen,
+                lenientConversion) != conversionOK) {
+        delete[] units;
+        return ~0U & 0x3fffff;
+    }
+
+    uint8_t const *bytes = reinterpret_cast<uint8_t const *>(units);
+    size_t         count = (target - units) * sizeof(UTF32);
+    uint32_t       crc   = ~0U;
+
+    for (size_t n = 0; n < count; n++) {
+        crc ^= insensitive ? tolower(bytes[n]) : bytes[n];
+        for (size_t k = 0; k < 8; k++) {
+            crc = (crc >> 1) ^ (0x82F63B78U & -(crc & 1));
+        }
+    }
+
+    delete[] units;
+    return crc & 0x3fffff;
+}
+
+//
+// Hashes random ASCII and UTF-8 names as directory lookups do.
+//
+static int
+bench_hash_name(int argc, char **argv)
+{
+    size_t iterations = (argc > 0) ? strtoull(argv[0], nullptr, 0) : 1000000;
+    std::mt19937_64 rng(0x686173686e616d65);
+
+    static char const *const pieces[] = {
+        "a", "Z", "_", "0", ".", "\xc3\xa9", "\xc3\x89", "\xc3\x9f",
+        "\xe6\x97\xa5", "\xf0\x9f\x98\x80"
+    };
+
+    std::vector<std::string> ascii, utf8;
+    for (size_t n = 0; n < 1024; n++) {
+        std::string a, u;
+        size_t      length = 4 + rng() % 40;
+
+        for (size_t k = 0; k < length; k++) {
+            a += pieces[rng() % 5];
+            u += pieces[rng() % 10];
+        }
+
+        ascii.push_back(a);
+        utf8.push_back(u);
+    }
+
+    for (auto names : { &ascii, &utf8 }) {
+        for (auto const &name : *names) {
+            for (bool insensitive : { false, true }) {
+                if (apfs_hash_name(name.c_str(), name.size(), insensitive) !=
+                        reference_hash_name(name.c_str(), name.size(),
+                            insensitive)) {
+                    fprintf(stderr, "error: hash mismatch for '%s'\n",
+                            name.c_str());
+                    return EXIT_FAILURE;
+                }
+            }
+        }
+    }
+
+    struct {
+        char const *name;
+        uint32_t  (*hash)(char const *, size_t, bool);
+    } const impls[] = {
+        { "reference", reference_hash_name },
+        { "apfs_hash_name", apfs_hash_name },
+    };
+
+    printf("%-28s %12s %12s %12s\n", "implementation", "ascii ns",
+            "utf-8 ns", "allocs/hash");
+
+    for (auto const &impl : impls) {
+        double ns[2];
+        size_t allocations = 0;
+
+        for (size_t set = 0; set < 2; set++) {
+            auto const &names = set ? utf8 : ascii;
+            uint32_t    sink  = 0;
+
+            size_t before = bench_allocations.load();
+            auto   start  = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < iterations; i++) {
+                auto const &name = names[i % names.size()];
+                sink += impl.hash(name.c_str(), name.size(), (i & 1) != 0);
+            }
+            std::chrono::duration<double, std::nano> elapsed =
+                std::chrono::steady_clock::now() - start;
+
+            allocations += bench_allocations.load() - before;
+            bench_sink   = sink;
+            ns[set]      = elapsed.count() / iterations;
+        }
+
+        printf("%-28s %12.1f %12.1f %12.2f\n", impl.name, ns[0], ns[1],
+                static_cast<double>(allocations) / (2 * iterations));
+    }
+
+    return EXIT_SUCCESS;
+}
+
+//
+// The linear scan formerly done by object::offset_to_extent().
+//
+static bool
+linear_lookup(apfs::internal::extent::vector const &extents, uint64_t bno,
+        apfs::internal::extent &e)
+{
+    for (auto &x : extents) {
+        if (bno >= x.offset && bno < x.offset + x.count) {
+            e = x;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static int
+bench_extents(int argc, char **argv)
+{
+    size_t count = (argc > 0) ? strtoull(argv[0], nullptr, 0) : 100000;
+    size_t iterations = (argc > 1) ? strtoull(argv[1], nullptr, 0) : 20000;
+    std::mt19937_64 rng(0x6170667365787473);
+
+    if (count == 0 || iterations == 0) {
+        fprintf(stderr, "error: invalid extent or iteration count\n");
+        return EXIT_FAILURE;
+    }
+
+    //
+    // A fragmented file: extents of 1 to 16 blocks, never contiguous on
+    // disk, so that none of them gets merged.
+    //
+    apfs::internal::extent::vector extents;
+    apfs::internal::extent_map     map;
+    uint64_t                       offset = 0;
+    uint64_t                       lba    = 1000;
+
+    extents.reserve(count);
+    for (size_t n = 0; n < count; n++) {
+        uint64_t length = 1 + rng() % 16;
+        apfs::internal::extent e(offset, lba, length);
+
+        extents.push_back(e);
+        map.insert(e);
+
+        offset += length;
+        lba += length + 1 + rng() % 64;
+    }
+
+    if (map.size() != extents.size()) {
+        fprintf(stderr, "error: %zu extents merged into %zu\n",
+                extents.size(), map.size());
+        return EXIT_FAILURE;
+    }
+
+    //
+    // Random block numbers, and a walk extent after extent from the
+    // middle of the file, like object::read() does on sequential reads.
+    //
+    std::vector<uint64_t> random(iterations), sequential(iterations);
+    for (size_t n = 0; n < iterations; n++) {
+        random[n] = rng() % offset;
+        sequential[n] = extents[(count / 2 + n) % count].offset;
+    }
+
+    for (auto const *bnos : { &random, &sequential }) {
+        for (auto bno : *bnos) {
+            apfs::internal::extent a, b;
+            if (!linear_lookup(extents, bno, a) || !map.lookup(bno, b) ||
+                    a.offset != b.offset || a.lba != b.lba) {
+                fprintf(stderr, "error: lookup mismatch for block %"
+                        PRIu64 "\n", bno);
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    printf("%-28s %8s %12s %12s %8s\n", "access", "extents", "linear ns",
+            "indexed ns", "speedup");
+
+    for (int seq = 0; seq <= 1; seq++) {
+        auto const &bnos = seq ? sequential : random;
+
+        double timings[2];
+        size_t sink = 0;
+        for (int pass = 0; pass < 2; pass++) {
+            auto start = std::chrono::steady_clock::now();
+            for (auto bno : bnos) {
+                apfs::internal::extent e;
+                if (pass == 0 ? linear_lookup(extents, bno, e) :
+                        map.lookup(bno, e)) {
+                    sink += e.lba;
+                }
+            }
+            std::chrono::duration<double, std::nano> elapsed =
+                std::chrono::steady_clock::now() - start;
+            timings[pass] = elapsed.count() / bnos.size();
+        }
+
+        bench_sink = sink;
+
+        printf("%-28s %8zu %12.1f %12.1f %7.1fx\n",
+                seq ? "sequential" : "random", extents.size(),
+                timings[0], timings[1], timings[0] / timings[1]);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static bool
+count_inode(void *opaque, nx::object::sized_value_type const &,
+        nx::object::sized_value_type const &value)
+{
+    *reinterpret_cast<size_t *>(opaque) += value.second;
+    return false;
+}
+
+//
+// Collects the identifiers of all the inodes of a volume.
+//
+static void
+collect_inodes(nx::volume *volume, std::vector<uint64_t> &oids)
+{
+    volume->traverse_root([&](uint32_t, uint32_t level, uint32_t,
+                nx::object::sized_value_type const &key,
+                nx::object::sized_value_type const &)
+            {
+                auto obj_id = nx::swap(
+                        *reinterpret_cast<uint64_t const *>(key.first));
+                if (level == 0 &&
+                        APFS_OBJECT_ID_TYPE(obj_id) == APFS_OBJECT_TYPE_INODE) {
+                    oids.push_back(APFS_OBJECT_ID_ID(obj_id));
+                }
+                return true;
+            });
+}
+
+//
+// Opens the inode of every object of the first volume of an image, with
+// the enumerator used to list records and with the allocation-free one,
+// once the nodes are cached.
+//
+static int
+bench_lookup(int argc, char **argv)
+{
+    if (argc < 1) {
+        fprintf(stderr, "error: missing image\n");
+        return EXIT_FAILURE;
+    }
+
+    size_t iterations = (argc > 1) ? strtoull(argv[1], nullptr, 0) : 100000;
+
+    nx::context context;
+    nx::device  device;
+    context.set_main_device(&device);
+    if (!device.open(argv[0])) {
+        fprintf(stderr, "error: cannot open '%s' for reading: %s\n",
+                argv[0], strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    nx::container container(&context);
+    if (!container.open()) {
+        fprintf(stderr, "error: cannot open container\n");
+        return EXIT_FAILURE;
+    }
+
+    auto volume = container.open_volume(0);
+    if (volume == nullptr) {
+        fprintf(stderr, "error: cannot open volume #0\n");
+        return EXIT_FAILURE;
+    }
+
+    std::vector<uint64_t> oids;
+    collect_inodes(volume, oids);
+    if (oids.empty()) {
+        fprintf(stderr, "error: no inodes found\n");
+        delete volume;
+        return EXIT_FAILURE;
+    }
+
+    auto lookup = [&](int pass, uint64_t oid) -> size_t
+    {
+        size_t size = 0;
+
+        if (pass == 0) {
+            auto e = volume->open_oid(oid);
+            if (e != nullptr) {
+                nx::object::sized_value_type k, v;
+                while (e->next(k, v)) {
+                    auto obj_id = nx::swap(
+                            *reinterpret_cast<uint64_t const *>(k.first));
+                    if (APFS_OBJECT_ID_TYPE(obj_id) ==
+                            APFS_OBJECT_TYPE_INODE) {
+                        size = v.second;
+                        break;
+                    }
+                }
+                delete e;
+            }
+        } else {
+            apfs_inode_key_t key;
+            key.obj_id = nx::swap(APFS_OBJECT_MAKE(INODE, oid));
+            volume->lookup_records(&key, sizeof(key), count_inode, &size);
+        }
+
+        return size;
+    };
+
+    //
+    // Both lookups must agree, this also warms the cache.
+    //
+    for (auto oid : oids) {
+        if (lookup(0, oid) == 0 || lookup(0, oid) != lookup(1, oid)) {
+            fprintf(stderr, "error: lookup mismatch for oid %#" PRIx64 "\n",
+                    oid);
+            delete volume;
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("%-28s %8s %12s %14s\n", "lookup", "inodes", "ns/lookup",
+            "allocs/lookup");
+
+    size_t sink = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        size_t allocations = bench_allocations.load();
+        auto   start       = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; i++) {
+            sink += lookup(pass, oids[i % oids.size()]);
+        }
+        std::chrono::duration<double, std::nano> elapsed =
+            std::chrono::steady_clock::now() - start;
+        allocations = bench_allocations.load() - allocations;
+
+        printf("%-28s %8zu %12.1f %14.2f\n",
+                pass == 0 ? "std::function" : "basic_enumerator",
+                oids.size(), elapsed.count() / iterations,
+                static_cast<double>(allocations) / iterations);
+    }
+
+    bench_sink = sink;
+
+    delete volume;
+    return EXIT_SUCCESS;
+}
+
+//
+// Looks inodes up with the block cache disabled, so that every btree node
+// is read again, under each checksum verification policy.
+//
+static int
+bench_verify(int argc, char **argv)
+{
+    if (argc < 1) {
+        fprintf(stderr, "error: missing image\n");
+        return EXIT_FAILURE;
+    }
+
+    size_t iterations = (argc > 1) ? strtoull(argv[1], nullptr, 0) : 100000;
+
+    nx::context context;
+    nx::device  device;
+    context.set_main_device(&device);
+    device.set_cache_size(0);
+    if (!device.open(argv[0])) {
+        fprintf(stderr, "error: cannot open '%s' for reading: %s\n",
+                argv[0], strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    nx::container container(&context);
+    if (!container.open()) {
+        fprintf(stderr, "error: cannot open container\n");
+        return EXIT_FAILURE;
+    }
+
+    auto volume = container.open_volume(0);
+    if (volume == nullptr) {
+        fprintf(stderr, "error: cannot open volume #0\n");
+        return EXIT_FAILURE;
+    }
+
+    std::vector<uint64_t> oids;
+    collect_inodes(volume, oids);
+    if (oids.empty()) {
+        fprintf(stderr, "error: no inodes found\n");
+        delete volume;
+        return EXIT_FAILURE;
+    }
+
+    struct {
+        char const                *name;
+        nx::device::verify_policy  policy;
+    } const policies[] = {
+        { "always", nx::device::VERIFY_ALWAYS },
+        { "once", nx::device::VERIFY_ONCE },
+        { "trust", nx::device::VERIFY_TRUST },
+    };
+
+    printf("%-28s %12s %12s %12s %8s\n", "policy", "ns/lookup", "verified",
+            "skipped", "failed");
+
+    size_t sink = 0;
+    for (auto const &p : policies) {
+        device.set_verify_policy(p.policy);
+
+        auto before = device.get_verify_stats();
+        auto start  = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; i++) {
+            apfs_inode_key_t key;
+            size_t           size = 0;
+            uint64_t         oid  = oids[i % oids.size()];
+
+            key.obj_id = nx::swap(APFS_OBJECT_MAKE(INODE, oid));
+            volume->lookup_records(&key, sizeof(key), count_inode, &size);
+            sink += size;
+        }
+        std::chrono::duration<double, std::nano> elapsed =
+            std::chrono::steady_clock::now() - start;
+        auto after = device.get_verify_stats();
+
+        printf("%-28s %12.1f %12" PRIu64 " %12" PRIu64 " %8" PRIu64 "\n",
+                p.name, elapsed.count() / iterations,
+                after.verified - before.verified,
+                after.skipped - before.skipped,
+                after.failed - before.failed);
+    }
+
+    bench_sink = sink;
+
+    device.set_verify_policy(nx::device::VERIFY_ALWAYS);
+
+    delete volume;
+    return EXIT_SUCCESS;
+}
+
+//
+// Looks inodes up reading btree nodes through the block cache, without it,
+// and in place from a mapped image.
+//
+static int
+bench_mapped(int argc, char **argv)
+{
+    if (argc < 1) {
+        fprintf(stderr, "error: missing image\n");
+        return EXIT_FAILURE;
+    }
+
+    size_t iterations = (argc > 1) ? strtoull(argv[1], nullptr, 0) : 100000;
+
+    struct {
+        char const *name;
+        size_t      cache_size;
+        bool        mapped;
+    } const modes[] = {
+        { "read, cached", nx::device::DEFAULT_CACHE_SIZE, false },
+        { "read, uncached", 0, false },
+        { "mapped", 0, true },
+    };
+
+    printf("%-28s %12s %14s %12s\n", "mode", "ns/lookup", "allocs/lookup",
+            "verified");
+
+    for (auto const &m : modes) {
+        nx::context context;
+        nx::device  device;
+        context.set_main_device(&device);
+        device.set_cache_size(m.cache_size);
+        device.set_mapping_enabled(m.mapped);
+        device.set_verify_policy(nx::device::VERIFY_ONCE);
+        if (!device.open(argv[0])) {
+            fprintf(stderr, "error: cannot open '%s' for reading: %s\n",
+                    argv[0], strerror(errno));
+            return EXIT_FAILURE;
+        }
+
+        if (m.mapped && !device.is_mapped()) {
+            fprintf(stderr, "error: cannot map '%s'\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        nx::container container(&context);
+        if (!container.open()) {
+            fprintf(stderr, "error: cannot open container\n");
+            return EXIT_FAILURE;
+        }
+
+        auto volume = container.open_volume(0);
+        if (volume == nullptr) {
+            fprintf(stderr, "error: cannot open volume #0\n");
+            return EXIT_FAILURE;
+        }
+
+        std::vector<uint64_t> oids;
+        collect_inodes(volume, oids);
+        if (oids.empty()) {
+            fprintf(stderr, "error: no inodes found\n");
+            delete volume;
+            return EXIT_FAILURE;
+        }
+
+        size_t sink        = 0;
+        size_t allocations = bench_allocations.load();
+        auto   before      = device.get_verify_stats();
+        auto   start       = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; i++) {
+            apfs_inode_key_t key;
+            size_t           size = 0;
+            uint64_t         oid  = oids[i % oids.size()];
+
+            key.obj_id = nx::swap(APFS_OBJECT_MAKE(INODE, oid));
+            if (!volume->lookup_records(&key, sizeof(key), count_inode,
+                        &size)) {
+                fprintf(stderr, "error: cannot find oid %#" PRIx64 "\n",
+                        oid);
+                delete volume;
+                return EXIT_FAILURE;
+            }
+            sink += size;
+        }
+        std::chrono::duration<double, std::nano> elapsed =
+            std::chrono::steady_clock::now() - start;
+        allocations = bench_allocations.load() - allocations;
+
+        printf("%-28s %12.1f %14.2f %12" PRIu64 "\n", m.name,
+                elapsed.count() / iterations,
+                static_cast<double>(allocations) / iterations,
+                device.get_verify_stats().verified - before.verified);
+
+        bench_sink = sink;
+        delete volume;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+//
+// Reads clustered blocks of an image one request at a time, then as
+// batches with increasing coalescing gaps.
+//
+static int
+bench_batch(int argc, char **argv)
+{
+    if (argc < 1) {
+        fprintf(stderr, "error: missing image\n");
+        return EXIT_FAILURE;
+    }
+
+    size_t iterations = (argc > 1) ? strtoull(argv[1], nullptr, 0) : 20000;
+    std::mt19937_64 rng(0x6261746368726561);
+
+    nx::device device;
+    if (!device.open(argv[0])) {
+        fprintf(stderr, "error: cannot open '%s' for reading: %s\n",
+                argv[0], strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    static size_t const BATCH = 32;
+
+    uint64_t block_count = device.get_block_count();
+    if (block_count < 1024) {
+        fprintf(stderr, "error: image too small\n");
+        return EXIT_FAILURE;
+    }
+
+    //
+    // Requests of one to four blocks, clustered within 256 blocks.
+    //
+    std::vector<std::vector<nx::device::read_request>> batches(64);
+    std::vector<uint8_t> buffer(BATCH * 4 * device.get_block_size());
+    for (auto &batch : batches) {
+        uint64_t base = rng() % (block_count - 260);
+        uint8_t *p    = buffer.data();
+
+        for (size_t n = 0; n < BATCH; n++) {
+            nx::device::read_request r;
+
+            r.lba    = base + rng() % 256;
+            r.count  = 1 + rng() % 4;
+            r.buffer = p;
+            r.nread  = 0;
+            batch.push_back(r);
+
+            p += r.count * device.get_block_size();
+        }
+    }
+
+    printf("%-28s %12s %12s %12s\n", "mode", "ns/batch", "calls/batch",
+            "blocks/batch");
+
+    for (int gap = -1; gap <= 16; gap = (gap <= 0) ? gap + 1 : gap * 4) {
+        if (gap >= 0) {
+            device.set_coalesce_gap(gap);
+        }
+
+        auto before = device.get_read_stats();
+        auto start  = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; i++) {
+            auto &batch = batches[i % batches.size()];
+            bool  ok    = true;
+
+            if (gap < 0) {
+                for (auto &r : batch) {
+                    ok &= device.read(r.lba, r.buffer, r.count, &r.nread);
+                }
+            } else {
+                ok = device.read_batch(batch.data(), batch.size());
+            }
+
+            if (!ok) {
+                fprintf(stderr, "error: read failed: %s\n", strerror(errno));
+                return EXIT_FAILURE;
+            }
+        }
+        std::chrono::duration<double, std::nano> elapsed =
+            std::chrono::steady_clock::now() - start;
+        auto after = device.get_read_stats();
+
+        char name[32];
+        if (gap < 0) {
+            snprintf(name, sizeof(name), "one by one");
+        } else {
+            snprintf(name, sizeof(name), "batch, gap %d", gap);
+        }
+
+        printf("%-28s %12.1f %12.2f %12.2f\n", name,
+                elapsed.count() / iterations,
+                static_cast<double>(after.calls - before.calls) / iterations,
+                static_cast<double>(after.blocks - before.blocks) /
+                iterations);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+//
+// Reads random blocks of an image one at a time, then through every
+// asynchronous backend with a number of reads kept in flight.
+//
+static int
+bench_aio(int argc, char **argv)
+{
+    if (argc < 1) {
+        fprintf(stderr, "error: missing image\n");
+        return EXIT_FAILURE;
+    }
+
+    size_t iterations = (argc > 1) ? strtoull(argv[1], nullptr, 0) : 200000;
+    size_t depth      = (argc > 2) ? strtoull(argv[2], nullptr, 0) :
+                            nx::io_queue::DEFAULT_DEPTH;
+    std::mt19937_64 rng(0x6173796e63696f21);
+
+    nx::device device;
+    if (!device.open(argv[0])) {
+        fprintf(stderr, "error: cannot open '%s' for reading: %s\n",
+                argv[0], strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    if (depth == 0) {
+        depth = 1;
+    }
+
+    size_t                 block_size = device.get_block_size();
+    std::vector<uint64_t>  lbas(4096);
+    std::vector<uint64_t>  sums(lbas.size());
+    std::vector<uint8_t>   buffer(depth * block_size);
+
+    //
+    // The data read asynchronously must match the data read with pread.
+    //
+    for (size_t n = 0; n < lbas.size(); n++) {
+        lbas[n] = rng() % device.get_block_count();
+        if (!device.read(lbas[n], buffer.data(), 1, nullptr)) {
+            fprintf(stderr, "error: read failed: %s\n", strerror(errno));
+            return EXIT_FAILURE;
+        }
+        sums[n] = nx_checksum_make(buffer.data(), block_size);
+    }
+
+    printf("%-28s %8s %12s %12s %12s\n", "backend", "depth", "ns/read",
+            "MiB/s", "calls/read");
+
+    auto report = [&](char const *name, size_t d, double ns,
+            nx::device::read_stats const &before)
+    {
+        auto after = device.get_read_stats();
+        printf("%-28s %8zu %12.1f %12.1f %12.3f\n", name, d, ns,
+                block_size / ns * 1e9 / (1024 * 1024),
+                static_cast<double>(after.calls - before.calls) / iterations);
+    };
+
+    {
+        auto before = device.get_read_stats();
+        auto start  = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; i++) {
+            device.read(lbas[i % lbas.size()], buffer.data(), 1, nullptr);
+        }
+        std::chrono::duration<double, std::nano> elapsed =
+            std::chrono::steady_clock::now() - start;
+        report("pread", 1, elapsed.count() / iterations, before);
+    }
+
+    static nx::io_queue::backend_type const backends[] = {
+        nx::io_queue::BACKEND_SYNC,
+        nx::io_queue::BACKEND_THREADS,
+        nx::io_queue::BACKEND_URING,
+    };
+
+    for (auto type : backends) {
+        if (!nx::io_queue::is_supported(type))
+            continue;
+
+        nx::io_queue queue;
+        if (!queue.open(&device, type, depth)) {
+            fprintf(stderr, "error: cannot open %s queue: %s\n",
+                    nx::io_queue::get_backend_name(type), strerror(errno));
+            return EXIT_FAILURE;
+        }
+
+        std::vector<nx::io_queue::request> requests(depth);
+        std::vector<nx::io_queue::request *> free;
+        for (size_t n = 0; n < depth; n++) {
+            requests[n].buffer = &buffer[n * block_size];
+            free.push_back(&requests[n]);
+        }
+
+        //
+        // Keeps depth reads in flight until count have completed, the
+        // first pass checks the data and is not timed.
+        //
+        auto run = [&](size_t count, bool check) -> bool
+        {
+            size_t submitted = 0;
+            size_t completed = 0;
+
+            while (completed < count) {
+                while (submitted < count && !free.empty()) {
+                    auto   r = free.back();
+                    size_t n = submitted % lbas.size();
+
+                    r->lba    = lbas[n];
+                    r->count  = 1;
+                    r->opaque = reinterpret_cast<void *>(n);
+                    if (!queue.submit(r))
+                        break;
+
+                    free.pop_back();
+                    submitted++;
+                }
+
+                nx::io_queue::request *done[64];
+                size_t ndone = queue.complete(done, 64, true);
+                for (size_t n = 0; n < ndone; n++) {
+                    auto index = reinterpret_cast<size_t>(done[n]->opaque);
+                    if (done[n]->nread != 1 || (check &&
+                            nx_checksum_make(done[n]->buffer, block_size) !=
+                            sums[index])) {
+                        fprintf(stderr, "error: read of block %" PRIu64
+                                " mismatched\n", done[n]->lba);
+                        return false;
+                    }
+                    free.push_back(done[n]);
+                }
+                completed += ndone;
+
+                if (ndone == 0 && queue.get_in_flight() == 0) {
+                    fprintf(stderr, "error: submit failed: %s\n",
+                            strerror(errno));
+                    return false;
+                }
+            }
+
+            return true;
+        };
+
+        if (!run(lbas.size(), true))
+            return EXIT_FAILURE;
+
+        auto before = device.get_read_stats();
+        auto start  = std::chrono::steady_clock::now();
+        if (!run(iterations, false))
+            return EXIT_FAILURE;
+        std::chrono::duration<double, std::nano> elapsed =
+            std::chrono::steady_clock::now() - start;
+
+        report(nx::io_queue::get_backend_name(type), depth,
+                elapsed.count() / iterations, before);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+//
+// Streams through an image in reads of a few blocks, with pread and then
+// through a readahead stream on every backend.
+//
+static int
+bench_readahead(int argc, char **argv)
+{
+    if (argc < 1) {
+        fprintf(stderr, "error: missing image\n");
+        return EXIT_FAILURE;
+    }
+
+    size_t chunk  = (argc > 1) ? strtoull(argv[1], nullptr, 0) : 32;
+    size_t passes = (argc > 2) ? strtoull(argv[2], nullptr, 0) : 4;
+
+    if (chunk == 0) {
+        chunk = 1;
+    }
+
+    static nx::io_queue::backend_type const backends[] = {
+        nx::io_queue::BACKEND_SYNC,
+        nx::io_queue::BACKEND_THREADS,
+        nx::io_queue::BACKEND_URING,
+    };
+
+    std::vector<uint64_t> sums;
+
+    printf("%-28s %12s %12s %12s %12s\n", "mode", "MiB/s", "calls/MiB",
+            "hit rate", "wasted");
+
+    for (int mode = -1; mode < 3; mode++) {
+        nx::device device;
+
+        if (mode >= 0) {
+            if (!nx::io_queue::is_supported(backends[mode]))
+                continue;
+
+            device.set_io_backend(backends[mode]);
+        }
+
+        if (!device.open(argv[0])) {
+            fprintf(stderr, "error: cannot open '%s' for reading: %s\n",
+                    argv[0], strerror(errno));
+            return EXIT_FAILURE;
+        }
+
+        size_t               block_size  = device.get_block_size();
+        uint64_t             block_count = device.get_block_count();
+        std::vector<uint8_t> buffer(chunk * block_size);
+        nx::readahead::stats stats;
+
+        //
+        // Reads the image once, the first pass checks the data read
+        // through streams against pread and is not timed.
+        //
+        auto run = [&](bool check) -> bool
+        {
+            std::unique_ptr<nx::readahead> stream;
+            if (mode >= 0) {
+                stream.reset(new nx::readahead(&device));
+            }
+
+            size_t n = 0;
+            for (uint64_t lba = 0; lba < block_count; lba += chunk, n++) {
+                size_t count = std::min(static_cast<uint64_t>(chunk),
+                        block_count - lba);
+                bool   ok;
+
+                if (stream) {
+                    ok = stream->read(lba, buffer.data(), count, nullptr);
+                } else {
+                    ok = device.read(lba, buffer.data(), count, nullptr);
+                }
+
+                if (!ok) {
+                    fprintf(stderr, "error: read failed: %s\n",
+                            strerror(errno));
+                    return false;
+                }
+
+                if (check) {
+                    uint64_t sum = nx_checksum_make(buffer.data(),
+                            count * block_size);
+                    if (!stream) {
+                        sums.push_back(sum);
+                    } else if (sums[n] != sum) {
+                        fprintf(stderr, "error: read of block %" PRIu64
+                                " mismatched\n", lba);
+                        return false;
+                    }
+                } else {
+                    bench_sink += buffer[0];
+                }
+            }
+
+            if (stream && !check) {
+                stream->reset();
+
+                auto s = stream->get_stats();
+                stats.hits       += s.hits;
+                stats.misses     += s.misses;
+                stats.prefetched += s.prefetched;
+                stats.wasted     += s.wasted;
+            }
+
+            return true;
+        };
+
+        if (!run(true))
+            return EXIT_FAILURE;
+
+        auto before = device.get_read_stats();
+        auto start  = std::chrono::steady_clock::now();
+        for (size_t n = 0; n < passes; n++) {
+            if (!run(false))
+                return EXIT_FAILURE;
+        }
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        auto after = device.get_read_stats();
+
+        double mib = static_cast<double>(passes) * block_count * block_size /
+            (1024 * 1024);
+
+        char name[32];
+        if (mode < 0) {
+            snprintf(name, sizeof(name), "pread");
+            printf("%-28s %12.1f %12.2f %12s %12s\n", name,
+                    mib / elapsed.count(), (after.calls - before.calls) / mib,
+                    "-", "-");
+        } else {
+            snprintf(name, sizeof(name), "readahead, %s",
+                    nx::io_queue::get_backend_name(backends[mode]));
+            printf("%-28s %12.1f %12.2f %11.1f%% %12" PRIu64 "\n", name,
+                    mib / elapsed.count(), (after.calls - before.calls) / mib,
+                    stats.get_hit_rate() * 100, stats.wasted);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+//
+// Scans an image for objects a block at a time, as the scavenger used to,
+// then through the scavenger with an increasing number of threads.
+//
+static int
+bench_scavenge(int argc, char **argv)
+{
+    if (argc < 1) {
+        fprintf(stderr, "error: missing image\n");
+        return EXIT_FAILURE;
+    }
+
+    size_t passes = (argc > 1) ? strtoull(argv[1], nullptr, 0) : 4;
+
+    nx::device device;
+    device.set_io_backend(nx::io_queue::BACKEND_DEFAULT);
+    if (!device.open(argv[0])) {
+        fprintf(stderr, "error: cannot open '%s' for reading: %s\n",
+                argv[0], strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    size_t   block_size  = device.get_block_size();
+    uint64_t block_count = device.get_block_count();
+    double   mib         = static_cast<double>(passes) * block_count *
+        block_size / (1024 * 1024);
+    uint64_t expected    = 0;
+
+    printf("%-28s %12s %12s\n", "mode", "MiB/s", "objects");
+
+    {
+        std::vector<uint8_t> buffer(block_size);
+        uint64_t             objects = 0;
+
+        auto start = std::chrono::steady_clock::now();
+        for (size_t n = 0; n < passes; n++) {
+            for (uint64_t lba = 0; lba < block_count; lba++) {
+                auto object = reinterpret_cast<nx_object_t const *>(
+                        buffer.data());
+
+                if (!device.read(lba, buffer.data(), 1, nullptr)) {
+                    fprintf(stderr, "error: read failed: %s\n",
+                            strerror(errno));
+                    return EXIT_FAILURE;
+                }
+
+                if (object->o_checksum != 0 &&
+                        object->o_checksum != UINT64_MAX &&
+                        nx_object_verify(object)) {
+                    objects++;
+                }
+            }
+        }
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+
+        expected = objects / passes;
+        printf("%-28s %12.1f %12" PRIu64 "\n", "block by block",
+                mib / elapsed.count(), expected);
+    }
+
+    size_t max_threads = std::max(std::thread::hardware_concurrency(), 4u);
+
+    for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+        nx::scavenger scavenger(&device);
+        uint64_t      objects = 0;
+
+        scavenger.set_threads(threads);
+
+        auto start = std::chrono::steady_clock::now();
+        for (size_t n = 0; n < passes; n++) {
+            if (!scavenger.run([&objects](uint64_t, nx_object_t const *)
+                        { objects++; return true; })) {
+                fprintf(stderr, "error: scan failed: %s\n", strerror(errno));
+                return EXIT_FAILURE;
+            }
+        }
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+
+        if (objects / passes != expected) {
+            fprintf(stderr, "error: found %" PRIu64 " objects instead of %"
+                    PRIu64 "\n", objects / passes, expected);
+            return EXIT_FAILURE;
+        }
+
+        char name[32];
+        snprintf(name, sizeof(name), "scavenger, %zu threads", threads);
+        printf("%-28s %12.1f %12" PRIu64 "\n", name, mib / elapsed.count(),
+                objects / passes);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+//
+// Queries objects by id and by transaction id in an index of an image,
+// against a scan of all its entries.
+//
+static int
+bench_index(int argc, char **argv)
+{
+    if (argc < 1) {
+        fprintf(stderr, "error: missing image\n");
+        return EXIT_FAILURE;
+    }
+
+    size_t iterations = (argc > 1) ? strtoull(argv[1], nullptr, 0) : 100000;
+    std::mt19937_64 rng(0x696e646578696e64);
+
+    nx::device device;
+    if (!device.open(argv[0])) {
+        fprintf(stderr, "error: cannot open '%s' for reading: %s\n",
+                argv[0], strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    nx::scavenge_index index;
+    nx::scavenger      scavenger(&device);
+
+    index.reset(&device, 0, device.get_block_count());
+
+    auto start = std::chrono::steady_clock::now();
+    if (!scavenger.run([&index](uint64_t paddr, nx_object_t const *object)
+                { return index.add(paddr, object); })) {
+        fprintf(stderr, "error: scan failed: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    std::chrono::duration<double, std::milli> scan =
+        std::chrono::steady_clock::now() - start;
+
+    char path[] = "/tmp/nx_bench_index.XXXXXX";
+    int  fd     = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "error: cannot create index: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    ::close(fd);
+
+    bool saved = index.save(path) && index.open(path, &device);
+    unlink(path);
+    if (!saved || index.size() == 0) {
+        fprintf(stderr, "error: cannot index '%s'\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("%zu objects indexed, scan %.1f ms\n\n", index.size(),
+            scan.count());
+    printf("%-28s %12s %12s\n", "query", "ns/query", "objects");
+
+    for (int mode = 0; mode < 4; mode++) {
+        size_t matched = 0;
+
+        start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; i++) {
+            auto const &e       = index[rng() % index.size()];
+            auto        type    = NX_OBJECT_GET_TYPE(e.type);
+            auto        visitor = [&matched](
+                    nx::scavenge_index::entry const &)
+                { matched++; return true; };
+
+            switch (mode) {
+                case 0:
+                    index.find_oid(type, e.subtype, e.oid, visitor);
+                    break;
+
+                case 1:
+                    index.find_xid(type, e.subtype, e.xid, UINT64_MAX,
+                            visitor);
+                    break;
+
+                case 2:
+                    for (size_t n = 0; n < index.size(); n++) {
+                        auto const &o = index[n];
+                        if (NX_OBJECT_GET_TYPE(o.type) == type &&
+                                o.subtype == e.subtype && o.oid == e.oid) {
+                            matched++;
+                        }
+                    }
+                    break;
+
+                case 3:
+                    for (size_t n = 0; n < index.size(); n++) {
+                        auto const &o = index[n];
+                        if (NX_OBJECT_GET_TYPE(o.type) == type &&
+                                o.subtype == e.subtype && o.xid >= e.xid) {
+                            matched++;
+                        }
+                    }
+                    break;
+            }
+        }
+        std::chrono::duration<double, std::nano> elapsed =
+            std::chrono::steady_clock::now() - start;
+
+        static char const *const names[] = {
+            "by oid, indexed", "by xid, indexed", "by oid, scan",
+            "by xid, scan"
+        };
+
+        printf("%-28s %12.1f %12.2f\n", names[mode],
+                elapsed.count() / iterations,
+                static_cast<double>(matched) / iterations);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+//
+// Scans of a whole image against scans restricted to its allocated or free
+// extents, as decoded from the space manager.
+//
+static int
+bench_space(int argc, char **argv)
+{
+    if (argc < 1) {
+        fprintf(stderr, "error: missing image\n");
+        return EXIT_FAILURE;
+    }
+
+    size_t passes = (argc > 1) ? strtoull(argv[1], nullptr, 0) : 4;
+
+    nx::context context;
+    nx::device  device;
+    context.set_main_device(&device);
+    if (!device.open(argv[0])) {
+        fprintf(stderr, "error: cannot open '%s' for reading: %s\n",
+                argv[0], strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    nx::container container(&context);
+    if (!container.open()) {
+        fprintf(stderr, "error: cannot open container\n");
+        return EXIT_FAILURE;
+    }
+
+    nx::space_map map;
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t n = 0; n < passes; n++) {
+        if (!container.load_space_map(map)) {
+            fprintf(stderr, "error: cannot load the space map\n");
+            return EXIT_FAILURE;
+        }
+    }
+    std::chrono::duration<double, std::milli> load =
+        std::chrono::steady_clock::now() - start;
+
+    printf("space map: %" PRIu64 " allocated blocks in %zu extents, %"
+            PRIu64 " free blocks in %zu extents, loaded in %.3f ms\n\n",
+            map.get_allocated_count(), map.get_allocated().size(),
+            map.get_free_count(), map.get_free().size(),
+            load.count() / passes);
+
+    printf("%-28s %12s %12s %12s\n", "mode", "blocks", "ms", "objects");
+
+    for (int mode = 0; mode < 3; mode++) {
+        nx::scavenger scavenger(&device);
+        uint64_t      objects = 0;
+        uint64_t      blocks  = device.get_block_count();
+
+        if (mode != 0) {
+            scavenger.set_extents(map.get_extents(mode == 1));
+            blocks = (mode == 1) ? map.get_allocated_count() :
+                map.get_free_count();
+        }
+
+        start = std::chrono::steady_clock::now();
+        for (size_t n = 0; n < passes; n++) {
+            if (!scavenger.run([&objects](uint64_t, nx_object_t const *)
+                        { objects++; return true; })) {
+                fprintf(stderr, "error: scan failed: %s\n", strerror(errno));
+                return EXIT_FAILURE;
+            }
+        }
+        std::chrono::duration<double, std::milli> elapsed =
+            std::chrono::steady_clock::now() - start;
+
+        static char const *const names[] = {
+            "whole device", "allocated extents", "free extents"
+        };
+
+        printf("%-28s %12" PRIu64 " %12.3f %12" PRIu64 "\n", names[mode],
+                blocks, elapsed.count() / passes, objects / passes);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+//
+// Opens of the container of an image, each from a newly opened device so
+// that nothing is served by its block cache, with the checkpoint lookup
+// of the space manager as done by get_info().
+//
+static int
+bench_open(int argc, char **argv)
+{
+    if (argc < 1) {
+        fprintf(stderr, "error: missing image\n");
+        return EXIT_FAILURE;
+    }
+
+    size_t iterations = (argc > 1) ? strtoull(argv[1], nullptr, 0) : 1000;
+
+    printf("%-28s %12s %12s %12s\n", "mode", "us/open", "reads/open",
+            "blocks/open");
+
+    for (int mode = 0; mode < 2; mode++) {
+        nx::device::read_stats stats;
+
+        auto start = std::chrono::steady_clock::now();
+        for (size_t n = 0; n < iterations; n++) {
+            nx::context context;
+            nx::device  device;
+            context.set_main_device(&device);
+            if (!device.open(argv[0])) {
+                fprintf(stderr, "error: cannot open '%s' for reading: %s\n",
+                        argv[0], strerror(errno));
+                return EXIT_FAILURE;
+            }
+
+            nx::container       container(&context);
+            nx::container::info     info;
+            if (!(mode == 0 ? container.open() : container.open(false)) ||
+                    !container.get_info(info)) {
+                fprintf(stderr, "error: cannot open container\n");
+                return EXIT_FAILURE;
+            }
+
+            auto s = device.get_read_stats();
+            stats.requests += s.requests;
+            stats.blocks   += s.blocks;
+        }
+        std::chrono::duration<double, std::micro> elapsed =
+            std::chrono::steady_clock::now() - start;
+
+        static char const *const names[] = {
+            "latest checkpoint", "oldest checkpoint"
+        };
+
+        printf("%-28s %12.1f %12.1f %12.1f\n", names[mode],
+                elapsed.count() / iterations,
+                static_cast<double>(stats.requests) / iterations,
+                static_cast<double>(stats.blocks) / iterations);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+struct benchmark {
+    char const *name;
+    char const *description;
+    int       (*run)(int argc, char **argv);
+};
+
+static benchmark const benchmarks[] = {
+    { "btn_search", "linear vs binary search in full btree nodes "
+        "[iterations]", bench_btn_search },
+    { "omap_search", "callback vs inline vs vectorized search in object "
+        "map nodes [iterations]", bench_omap_search },
+    { "checksum", "scalar vs vectorized checksums of 4 KiB blocks "
+        "[iterations]", bench_checksum },
+    { "hash_name", "reference vs table driven directory name hashing "
+        "[iterations]", bench_hash_name },
+    { "extents", "linear vs indexed extent lookup in fragmented files "
+        "[extents] [iterations]", bench_extents },
+    { "lookup", "inode lookups and allocations per lookup "
+        "image [iterations]", bench_lookup },
+    { "verify", "inode lookups without cache under each checksum "
+        "verification policy image [iterations]", bench_verify },
+    { "mapped", "inode lookups through the cache, without it and from "
+        "a mapped image image [iterations]", bench_mapped },
+    { "batch", "clustered block reads one by one vs batched "
+        "image [iterations]", bench_batch },
+    { "aio", "random block reads with pread vs asynchronous backends "
+        "image [iterations] [depth]", bench_aio },
+    { "readahead", "sequential reads with pread vs readahead streams "
+        "image [blocks per read] [passes]", bench_readahead },
+    { "scavenge", "block by block vs pipelined scans for objects "
+        "image [passes]", bench_scavenge },
+    { "index", "indexed vs scanned queries of scavenged objects "
+        "image [iterations]", bench_index },
+    { "space", "whole device vs allocated or free extents scans "
+        "image [passes]", bench_space },
+    { "open", "container opens from a cold block cache "
+        "image [iterations]", bench_open },
+};
+
+static void
+usage(char const *progname)
+{
+    fprintf(stderr, "usage: %s benchmark [arguments]\n\n", progname);
+    fprintf(stderr, "available benchmarks:\n");
+    for (auto const &b : benchmarks) {
+        fprintf(stderr, "  %-16s %s\n", b.name, b.description);
+    }
+}
+
+int
+main_nx_bench(nx::context &, int argc, char **argv)
+{
+    char const *progname = *argv;
+
+    if (argc < 2) {
+        usage(progname);
+        exit(EXIT_FAILURE);
+    }
+
+    for (auto const &b : benchmarks) {
+        if (strcmp(argv[1], b.name) == 0)
+            return b.run(argc - 2, argv + 2);
+    }
+
+    usage(progname);
+    exit(EXIT_FAILURE);
+    return EXIT_FAILURE;
+}
@@ -22,12 +22,15 @@
 
 #include "nx/container.h"
 #include "nx/enumerator.h"
+#include "nx/scavenge_index.h"
+#include "nx/scavenger.h"
 #include "nx/volume.h"
 
 #include "nxcompat/nxcompat.h"
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 
 static bool verbose = false;
 
@@ -73,10 +76,124 @@ scavenge(void *opaque, uint64_t blockno, nx_object_t const *object)
     return true;
 }
 
+static bool
+progress(nx::scavenger::progress const &state, size_t block_size)
+{
+    uint64_t total = state.blocks;
+
+    fprintf(stderr, "\r[scavenge] %" PRIu64 "/%" PRIu64 " blocks (%.1f%%), "
+            "%" PRIu64 " objects, %.1f MiB/s", state.scanned, total,
+            total != 0 ? 100.0 * state.scanned / total : 100.0,
+            state.objects, state.elapsed > 0 ?
+            state.scanned * block_size / state.elapsed / (1024 * 1024) : 0.0);
+    return true;
+}
+
+//
+// Objects selected from a saved index.
+//
+struct query {
+    bool     has_type;
+    uint32_t type;
+    bool     has_subtype;
+    uint32_t subtype;
+    bool     has_oid;
+    uint64_t oid;
+    uint64_t min_xid;
+    uint64_t max_xid;
+    bool     leaves;
+    uint64_t start;
+    uint64_t end;
+
+    query()
+    {
+        has_type = false;
+        type = 0;
+        has_subtype = false;
+        subtype = 0;
+        has_oid = false;
+        oid = 0;
+        min_xid = 0;
+        max_xid = UINT64_MAX;
+        leaves = false;
+        start = 0;
+        end = UINT64_MAX;
+    }
+
+    bool matches(nx::scavenge_index::entry const &e) const
+    {
+        if (has_type && NX_OBJECT_GET_TYPE(e.type) != type)
+            return false;
+        if (has_subtype && e.subtype != subtype)
+            return false;
+        if (has_oid && e.oid != oid)
+            return false;
+        if (e.xid < min_xid || e.xid > max_xid)
+            return false;
+        if (e.paddr < start || e.paddr >= end)
+            return false;
+        if (leaves && (e.flags & NX_BTN_FLAG_LEAF) == 0)
+            return false;
+
+        return true;
+    }
+};
+
+//
+// Dumps the objects of the index matching the query, the blocks are read
+// again as the index only has their headers.
+//
+static bool
+run_query(nx::device const &device, nx::scavenge_index const &index,
+        query const &q, nx_dumper_t *dumper)
+{
+    auto buffer = device.new_block<nx_object_t>();
+    if (buffer == nullptr)
+        return false;
+
+    size_t found = 0;
+    auto   visit = [&](nx::scavenge_index::entry const &e) -> bool
+    {
+        if (!q.matches(e))
+            return true;
+
+        found++;
+        if (!device.read(e.paddr, buffer)) {
+            fprintf(stderr, "warning: cannot read object at block %" PRIu64
+                    "\n", e.paddr);
+            return true;
+        }
+
+        return scavenge(dumper, e.paddr, buffer);
+    };
+
+    if (q.has_type && q.has_subtype && q.has_oid) {
+        index.find_oid(q.type, q.subtype, q.oid, visit);
+    } else if (q.has_type && q.has_subtype) {
+        index.find_xid(q.type, q.subtype, q.min_xid, q.max_xid, visit);
+    } else {
+        for (size_t n = 0; n < index.size(); n++) {
+            if (!visit(index[n]))
+                break;
+        }
+    }
+
+    fprintf(stderr, "[index] %zu of %zu objects matched\n", found,
+            index.size());
+
+    nx::device::free_block(buffer);
+    return true;
+}
+
 static void
 usage(char const *progname)
 {
-    fprintf(stderr, "usage: %s [-v] device [block]\n", progname);
+    fprintf(stderr, "usage: %s [-m] [-p] [-u] [-v] [-a backend] "
+            "[-F allocated|free] [-j threads] [-s start] [-e end] "
+            "[-i index] device [block]\n"
+            "       %s -I index [-l] [-t type] [-T subtype] [-o oid] "
+            "[-x min-xid] [-X max-xid] [-s start] [-e end] device\n",
+            progname, progname);
 }
 
 int
@@ -84,9 +201,96 @@ main_nx_scavenge(nx::context &context, int argc, char **argv)
 {
     char const *progname = *argv;
 
+    bool mapped = false;
+    bool show_progress = false;
+    bool ordered = true;
+    size_t threads = 0;
+    uint64_t start = 0;
+    uint64_t end = static_cast <uint64_t> (-1);
+    nx::io_queue::backend_type io_backend = nx::io_queue::BACKEND_DEFAULT;
+    char const *index_path = nullptr;
+    char const *query_path = nullptr;
+    char const *filter = nullptr;
+    query q;
+
     int c;
-    while ((c = getopt(argc, argv, "v")) != EOF) {
+    while ((c = getopt(argc, argv, "a:e:F:I:i:j:lmo:ps:T:t:uvX:x:")) != EOF) {
         switch (c) {
+            case 'a':
+                if (!nx::io_queue::parse_backend_name(optarg, io_backend)) {
+                    usage(progname);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'e':
+                end = strtoull(optarg, nullptr, 0);
+                break;
+
+            case 'F':
+                if (strcmp(optarg, "allocated") != 0 &&
+                        strcmp(optarg, "free") != 0) {
+                    usage(progname);
+                    exit(EXIT_FAILURE);
+                }
+                filter = optarg;
+                break;
+
+            case 'I':
+                query_path = optarg;
+                break;
+
+            case 'i':
+                index_path = optarg;
+                break;
+
+            case 'l':
+                q.leaves = true;
+                break;
+
+            case 'o':
+                q.has_oid = true;
+                q.oid = strtoull(optarg, nullptr, 0);
+                break;
+
+            case 'T':
+                q.has_subtype = true;
+                q.subtype = strtoul(optarg, nullptr, 0);
+                break;
+
+            case 't':
+                q.has_type = true;
+                q.type = strtoul(optarg, nullptr, 0);
+                break;
+
+            case 'X':
+                q.max_xid = strtoull(optarg, nullptr, 0);
+                break;
+
+            case 'x':
+                q.min_xid = strtoull(optarg, nullptr, 0);
+                break;
+
+            case 'j':
+                threads = strtoul(optarg, nullptr, 0);
+                break;
+
+            case 'm':
+                mapped = true;
+                break;
+
+            case 'p':
+                show_progress = true;
+                break;
+
+            case 's':
+                start = strtoull(optarg, nullptr, 0);
+                break;
+
+            case 'u':
+                ordered = false;
+                break;
+
             case 'v':
                 verbose = true;
                 break;
@@ -107,6 +311,8 @@ main_nx_scavenge(nx::context &context, int argc, char **argv)
 
     nx::device device;
     context.set_main_device(&device);
+    device.set_mapping_enabled(mapped);
+    device.set_io_backend(io_backend);
     if (!device.open(argv[0])) {
         fprintf(stderr, "error: cannot open '%s' for reading: %s\n",
                 argv[0],strerror(errno));
@@ -126,7 +332,104 @@ main_nx_scavenge(nx::context &context, int argc, char **argv)
 
     nx_dumper_open_container(dumper, "nx-scavenge");
 
-    container->scavenge(scavenge, dumper, bno);
+    //
+    // A range is scanned by a pipeline reading ahead of the threads
+    // verifying the blocks, objects are still dumped in block order
+    // unless asked otherwise, or indexed instead.
+    //
+    bool scanned = true;
+    int error = 0;
+    if (query_path != nullptr) {
+        nx::scavenge_index index;
+
+        if (!index.open(query_path, &device)) {
+            fprintf(stderr, "error: cannot open index '%s': %s\n",
+                    query_path, errno == ESTALE ?
+                    "index is not of this device, or out of date" :
+                    strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        q.start = start;
+        q.end = end;
+        scanned = run_query(device, index, q, dumper);
+        error = errno;
+    } else if (bno != static_cast <uint64_t> (-1)) {
+        container->scavenge(scavenge, dumper, bno);
+    } else {
+        nx::scavenge_index index;
+        nx::scavenger scavenger(&device);
+
+        scavenger.set_range(start, end);
+        scavenger.set_threads(threads);
+
+        //
+        // Carving deleted objects only needs the free blocks, recovering
+        // metadata only the allocated ones.
+        //
+        if (filter != nullptr) {
+            nx::space_map map;
+
+            if (!container->open() || !container->load_space_map(map)) {
+                fprintf(stderr, "error: cannot load the space map of "
+                        "'%s'\n", argv[0]);
+                exit(EXIT_FAILURE);
+            }
+
+            bool allocated = (strcmp(filter, "allocated") == 0);
+            fprintf(stderr, "[space] %" PRIu64 " allocated blocks in %zu "
+                    "extents, %" PRIu64 " free blocks in %zu extents\n",
+                    map.get_allocated_count(), map.get_allocated().size(),
+                    map.get_free_count(), map.get_free().size());
+            scavenger.set_extents(map.get_extents(allocated));
+        }
+
+        scavenger.set_ordered(ordered);
+        if (show_progress) {
+            size_t block_size = device.get_block_size();
+            scavenger.set_progress([block_size](
+                        nx::scavenger::progress const &state)
+                    { return progress(state, block_size); });
+        }
+
+        if (index_path != nullptr) {
+            bool full = false;
+
+            index.reset(&device, start, end);
+            scanned = scavenger.run([&index, &full](uint64_t blockno,
+                        nx_object_t const *object)
+                    {
+                        if (index.add(blockno, object))
+                            return true;
+
+                        full = true;
+                        return false;
+                    });
+            if (full) {
+                scanned = false;
+            }
+        } else {
+            scanned = scavenger.run([dumper](uint64_t blockno,
+                        nx_object_t const *object)
+                    { return scavenge(dumper, blockno, object); });
+        }
+        error = errno;
+
+        if (show_progress) {
+            fputc('\n', stderr);
+        }
+
+        if (scanned && index_path != nullptr) {
+            if (!index.save(index_path)) {
+                fprintf(stderr, "error: cannot write index '%s': %s\n",
+                        index_path, strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+
+            fprintf(stderr, "[index] %zu objects written to '%s'\n",
+                    index.size(), index_path);
+        }
+    }
 
     nx_dumper_close(dumper);
 
@@ -134,6 +437,12 @@ main_nx_scavenge(nx::context &context, int argc, char **argv)
 
     delete container;
 
+    if (!scanned) {
+        fprintf(stderr, "error: cannot read '%s': %s\n", argv[0],
+                strerror(error));
+        exit(EXIT_FAILURE);
+    }
+
     exit(EXIT_SUCCESS);
     return EXIT_SUCCESS;
 }